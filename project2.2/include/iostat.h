@@ -0,0 +1,212 @@
+#ifndef IOSTAT_H
+#define IOSTAT_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+    Contabilidade das syscalls de E/S feitas pelos wrappers do namespace sock.
+
+    Cada chamada (read, write, sendto, recvfrom, select, ...) soma, no contexto
+    atual, o número de chamadas, os bytes transferidos, as leituras/escritas
+    curtas (menos bytes que o pedido), os EAGAIN, os erros e o tempo gasto
+    dentro da syscall. O contexto é escolhido pelo programa (no servidor do
+    lobby, o tipo da mensagem sendo tratada), e cada troca de contexto conta
+    uma requisição, o que permite comparar syscalls por requisição.
+
+    Só é compilado com IOSTAT_ENABLED (make IOSTAT=1); caso contrário as macros
+    não geram código nenhum. O relatório é escrito na saída do programa e,
+    opcionalmente, quando um sinal o pede: o tratador só marca o pedido
+    (vsnprintf não é seguro dentro de um tratador de sinal), e o loop do
+    programa o atende com IOSTAT_POLL.
+*/
+#define IOSTAT_MAX_CONTEXTS 32
+
+namespace iostat {
+    enum Op {
+        OpRead,
+        OpWrite,
+        OpWritev,
+        OpSendto,
+        OpRecvfrom,
+        OpSelect,
+        OpAccept,
+        OpPoll,
+        OpEpoll,
+        NUM_OPS
+    };
+
+    class Counter {
+        public:
+            long long calls, bytes, shorts, again, errors, ns;
+    };
+
+#ifdef IOSTAT_ENABLED
+    int context = 0;
+    long long requests[IOSTAT_MAX_CONTEXTS];
+    Counter counters[IOSTAT_MAX_CONTEXTS][NUM_OPS];
+
+    /* nome de cada contexto no relatório; NULL usa o número do contexto */
+    const char *(*contextName)(int) = NULL;
+
+    const char *opName(int op) {
+        static const char *names[NUM_OPS] = {"read", "write", "writev", "sendto", "recvfrom", "select", "accept", "poll", "epoll"};
+
+        return names[op];
+    }
+
+    long long now() {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    /* as próximas syscalls pertencem a uma nova requisição do contexto `ctx` */
+    inline void enter(int ctx) {
+        context = (ctx >= 0 && ctx < IOSTAT_MAX_CONTEXTS) ? ctx : 0;
+
+        ++requests[context];
+    }
+
+    /*
+        registra uma syscall que pediu `requested` bytes (ou -1 quando não se aplica)
+        e retornou `n`; preserva o errno para o tratamento de erro do wrapper
+    */
+    inline void account(Op op, long long start, long long requested, long long n) {
+        int savedErrno = errno;
+        Counter &c = counters[context][op];
+
+        ++c.calls;
+        c.ns += now() - start;
+
+        if (n < 0) {
+            if (savedErrno == EAGAIN || savedErrno == EWOULDBLOCK) ++c.again;
+            else ++c.errors;
+        } else {
+            c.bytes += (requested >= 0) ? n : 0;
+
+            if (requested >= 0 ? n < requested : n == 0) ++c.shorts;
+        }
+
+        errno = savedErrno;
+    }
+
+    void reset() {
+        for (int i = 0; i < IOSTAT_MAX_CONTEXTS; ++i) {
+            requests[i] = 0;
+
+            for (int op = 0; op < NUM_OPS; ++op) counters[i][op] = Counter();
+        }
+    }
+
+    void print(int fd, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+    void print(int fd, const char *fmt, ...) {
+        char line[256];
+        va_list args;
+
+        va_start(args, fmt);
+        int len = vsnprintf(line, sizeof(line), fmt, args);
+        va_end(args);
+
+        if (len > (int) sizeof(line) - 1) len = sizeof(line) - 1;
+
+        if (len > 0 && write(fd, line, len) < 0) return;
+    }
+
+    void report(int fd) {
+        Counter total[NUM_OPS] = {};
+
+        print(fd, "syscalls por contexto (chamadas, bytes, curtas, EAGAIN, erros, tempo em us)\n");
+
+        for (int i = 0; i < IOSTAT_MAX_CONTEXTS; ++i) {
+            long long calls = 0;
+
+            for (int op = 0; op < NUM_OPS; ++op) calls += counters[i][op].calls;
+
+            if (calls == 0) continue;
+
+            if (contextName != NULL) print(fd, "  %s", contextName(i));
+            else print(fd, "  contexto %d", i);
+
+            if (requests[i] > 0) print(fd, ": %lld requisições, %.2f syscalls/requisição\n", requests[i], (double) calls / requests[i]);
+            else print(fd, "\n");
+
+            for (int op = 0; op < NUM_OPS; ++op) {
+                Counter &c = counters[i][op];
+
+                if (c.calls == 0) continue;
+
+                print(fd, "    %-9s %10lld %12lld %8lld %8lld %6lld %12.1f\n", opName(op), c.calls, c.bytes, c.shorts, c.again, c.errors, c.ns / 1000.0);
+
+                total[op].calls += c.calls;
+                total[op].bytes += c.bytes;
+                total[op].shorts += c.shorts;
+                total[op].again += c.again;
+                total[op].errors += c.errors;
+                total[op].ns += c.ns;
+            }
+        }
+
+        print(fd, "  total\n");
+
+        for (int op = 0; op < NUM_OPS; ++op) {
+            Counter &c = total[op];
+
+            if (c.calls > 0) print(fd, "    %-9s %10lld %12lld %8lld %8lld %6lld %12.1f\n", opName(op), c.calls, c.bytes, c.shorts, c.again, c.errors, c.ns / 1000.0);
+        }
+    }
+
+    void reportAtExit() { report(STDERR_FILENO); }
+
+    /* relatório pedido pelo sinal e ainda não escrito */
+    volatile sig_atomic_t requested = 0;
+
+    void onSignal(int signo) { requested = 1; }
+
+    /* escreve o relatório caso um sinal o tenha pedido; chamado do loop, fora do tratador */
+    void poll(int fd) {
+        if (!requested) return;
+
+        requested = 0;
+
+        report(fd);
+    }
+
+    /* registra o relatório na saída e, se `signo` > 0, também ao receber esse sinal (ver poll) */
+    void start(const char *(*names)(int), int signo) {
+        contextName = names;
+
+        atexit(reportAtExit);
+
+        if (signo > 0) signal(signo, onSignal);
+    }
+#endif
+}
+
+#ifdef IOSTAT_ENABLED
+#define IOSTAT_START(names, signo) iostat::start(names, signo)
+#define IOSTAT_CONTEXT(ctx) iostat::enter(ctx)
+#define IOSTAT_RESET() iostat::reset()
+#define IOSTAT_REPORT(fd) iostat::report(fd)
+#define IOSTAT_POLL(fd) iostat::poll(fd)
+#define IOSTAT_BEGIN() long long iostatStart = iostat::now()
+#define IOSTAT_END(op, requested, n) iostat::account(iostat::op, iostatStart, requested, n)
+#else
+#define IOSTAT_START(names, signo) do {} while (0)
+#define IOSTAT_CONTEXT(ctx) do {} while (0)
+#define IOSTAT_RESET() do {} while (0)
+#define IOSTAT_REPORT(fd) do {} while (0)
+#define IOSTAT_POLL(fd) do {} while (0)
+#define IOSTAT_BEGIN() do {} while (0)
+#define IOSTAT_END(op, requested, n) do {} while (0)
+#endif
+
+#endif
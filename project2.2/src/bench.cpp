@@ -0,0 +1,60 @@
+#include <socket.h>
+#include <bench.h>
+
+#include <sys/socket.h>
+
+/*
+    Microbenchmarks do projeto 2.2 (make bench; ver include/bench.h).
+
+        sock_ntop           conversão do endereço do cliente para texto
+        comando/socketpair  ida e volta de um comando como o servidor o envia
+                            (tamanho e texto, por sock::Write) e o cliente o
+                            recebe (sock::ReadSocket), com a resposta no
+                            sentido contrário, pelo kernel
+*/
+#define MAXLINE 4096
+
+int main(int argc, char **argv) {
+    bench::Suite suite("project2.2", argc, argv);
+    sock::SocketAddr addr(AF_INET, 54321);
+    char ip[] = "192.168.100.200";
+    int fds[2];
+
+    addr.setInAddress(ip);
+
+    suite.run("sock_ntop", 0, 0, [&](long long n) {
+        for (long long i = 0; i < n; ++i) bench::keep(sock::sock_ntop((struct sockaddr *) &addr.addr, sizeof(addr.addr))[0]);
+    });
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair error");
+        exit(1);
+    }
+
+    const int sizes[] = {16, 256, 4096};
+    char command[MAXLINE], recvline[MAXLINE + 1];
+
+    memset(command, 'c', sizeof(command));
+
+    for (int size : sizes) {
+        suite.run("comando/socketpair", size, 2.0 * (size + sizeof(int)), [&](long long n) {
+            for (long long i = 0; i < n; ++i) {
+                int numBytes = size;
+
+                /* servidor -> cliente */
+                sock::Write(fds[0], (char *) &numBytes, sizeof(int));
+                sock::Write(fds[0], command, numBytes);
+                numBytes = sock::ReadSocket(fds[1], recvline, MAXLINE);
+
+                /* cliente -> servidor */
+                sock::Write(fds[1], (char *) &numBytes, sizeof(int));
+                sock::Write(fds[1], recvline, numBytes);
+                sock::ReadSocket(fds[0], recvline, MAXLINE);
+            }
+        });
+    }
+
+    suite.finish();
+
+    return 0;
+}
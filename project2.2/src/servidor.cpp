@@ -1,4 +1,5 @@
 #include <socket.h>
+#include <log.h>
 
 #define LISTENQ 10
 #define MAXLINE 4096
@@ -48,6 +49,9 @@ int main (int argc, char **argv) {
    /* faz com que o socket vire um socket passivo (escuta requisições) */
    sock::Listen(listenfd, LISTENQ);
 
+   /* contas de syscalls (make IOSTAT=1): relatório na saída e no SIGUSR1 */
+   IOSTAT_START(NULL, SIGUSR1);
+
    int userId = 0;
 
    /* 
@@ -59,12 +63,17 @@ int main (int argc, char **argv) {
       /* quando uma requisição for recebida, servidor a aceita */
       int connfd = Accept(listenfd, &clientaddr);
 
+      /* relatório de syscalls pedido pelo SIGUSR1 enquanto o servidor esperava */
+      IOSTAT_POLL(STDERR_FILENO);
+
       /* 
          faz com que o programa se divida em dois processos (pai e filho).
          O processo que entra no if é o filho 
       */
       if((pid = fork()) == 0) {
          char buf[MAXDATASIZE];
+
+         IOSTAT_RESET(); /* o relatório do filho (na sua saída) conta só a sua conexão */
          
          /* obtem o horário do servidor */
          time_t ticks = time(NULL);
@@ -83,20 +92,24 @@ int main (int argc, char **argv) {
          
          // sock::Write(connfd, buf, strlen(buf));
 
+         /*
+            a thread de fundo do log não sobrevive ao fork: o filho inicia a sua,
+            que escreve o arquivo enquanto o filho conversa com o cliente
+         */
+         logger::start();
+
          /* Abrimos o arquivo que contém o output da execução do cliente */
-         FILE *fp = fopen(std::string("user_file_" + std::to_string(userId) + ".txt").c_str(), "w+");
+         int fd = logger::open(std::string("user_file_" + std::to_string(userId) + ".txt").c_str());
 
          /* printa num arquivo o inicio da conexão com o cliente, assim com o horário em que a mesma ocorreu */
          std::string message = "Início da conexão com cliente " + std::string(user_data) + ": " + std::string(buf);
 
-         /* Lemos estes bytes para o buffer recvline */
-         if (fwrite(message.c_str(), sizeof(char), message.size(), fp) != (size_t) message.size()) {
-            perror("read error");
-            exit(1);
-         }
+         logger::write(fd, message.c_str(), message.size());
 
          /* Itera sobre cada um dos commandos especificados no array de comandos */
          for (int i = 0; i < NUMCOMMANDS; ++i) {
+            IOSTAT_POLL(STDERR_FILENO);
+
             int numBytes = strlen(commands[i]);
 
             /* Escreve no socket do cliente o tamanho (em bytes) do commando */
@@ -118,11 +131,7 @@ int main (int argc, char **argv) {
 
                   message = "***************************************\nResultado retornado pelo cliente " + std::string(user_data) + " para o comando: '" + std::string(commands[i]) + "'\n\n" + std::string(recvline);
 
-                  /* Lemos estes bytes para o buffer recvline */
-                  if (fwrite(message.c_str(), sizeof(char), message.size(), fp) != (size_t) message.size()) {
-                     perror("read error");
-                     exit(1);
-                  }
+                  logger::write(fd, message.c_str(), message.size());
                }
                
                fflush(stdout);
@@ -144,13 +153,9 @@ int main (int argc, char **argv) {
          /* printa num arquivo o fim da conexão com o cliente, assim com o horário em que a mesma ocorreu */
          message = "***************************************\nFim da conexão com cliente " + std::string(user_data) + ": " + std::string(buf);
 
-         /* Lemos estes bytes para o buffer recvline */
-         if (fwrite(message.c_str(), sizeof(char), message.size(), fp) != (size_t) message.size()) {
-            perror("read error");
-            exit(1);
-         }
+         logger::write(fd, message.c_str(), message.size());
 
-         exit(0); /* processo filho termina */
+         exit(0); /* processo filho termina (o atexit do log esvazia o que falta escrever) */
       }
 
       /* printa os ids dos processos pai e filho */
@@ -14,6 +14,8 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <iostat.h>
+
 #define END_COMMAND "exit"
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
@@ -151,7 +153,11 @@ namespace sock {
             Caso o retorno do accept seja igual a -1, então houve algum erro com a tentativa
             de aceitar a conexão com o cliente.
         */
-        if ((connfd = accept(sockfd, sockAddrAux, &addrlen)) == -1 ) {
+        IOSTAT_BEGIN();
+        connfd = accept(sockfd, sockAddrAux, &addrlen);
+        IOSTAT_END(OpAccept, -1, connfd);
+
+        if (connfd == -1 ) {
             perror("accept");
             exit(1);
         }
@@ -183,8 +189,12 @@ namespace sock {
             possa receber o horário obtido pelo servidor
         */
 
+        IOSTAT_BEGIN();
+        int n = write(sockfd, buf, sizebuf);
+        IOSTAT_END(OpWrite, sizebuf, n);
+
         /* verifica se houve algum erro com a escrita do buffer no socket descriptor */
-        if (!write(sockfd, buf, sizebuf)) {
+        if (!n) {
             perror("Something went wrong");
             exit(1);
         }
@@ -255,7 +265,11 @@ namespace sock {
             Lemos o 32 bytes que representarão o tamanho da mensagem enviada pelo servidor.
             Verificamos também se houve erro na leitura.
         */
-        if (read(sockfd, (char *) &numBytes, sizeof(int)) < 0) {
+        IOSTAT_BEGIN();
+        int n = read(sockfd, (char *) &numBytes, sizeof(int));
+        IOSTAT_END(OpRead, sizeof(int), n);
+
+        if (n < 0) {
             perror("read error");
             exit(1);
         }
@@ -265,7 +279,11 @@ namespace sock {
             Verificamos neste processo se houve erros na leitura.
         */
         if (numBytes > 0) {
-            if (read(sockfd, recvline, numBytes) < 0) {
+            IOSTAT_BEGIN();
+            n = read(sockfd, recvline, numBytes);
+            IOSTAT_END(OpRead, numBytes, n);
+
+            if (n < 0) {
                 perror("read error");
                 exit(1);
             }
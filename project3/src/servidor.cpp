@@ -61,6 +61,9 @@ int main (int argc, char **argv) {
 
    signal(SIGCHLD, sig_chld);
 
+   /* contas de syscalls (make IOSTAT=1): relatório na saída e no SIGUSR1 */
+   IOSTAT_START(NULL, SIGUSR1);
+
    int userId = 0;
 
    /* 
@@ -74,12 +77,17 @@ int main (int argc, char **argv) {
       /* quando uma requisição for recebida, servidor a aceita */
       int connfd = Accept(listenfd, &clientaddr);
 
+      /* relatório de syscalls pedido pelo SIGUSR1 enquanto o servidor esperava */
+      IOSTAT_POLL(STDERR_FILENO);
+
       /* 
          faz com que o programa se divida em dois processos (pai e filho).
          O processo que entra no if é o filho 
       */
       if((pid = fork()) == 0) {
          char buf[MAXDATASIZE];
+
+         IOSTAT_RESET(); /* o relatório do filho (na sua saída) conta só a sua conexão */
          
          /* obtem o horário do servidor */
          time_t ticks = time(NULL);
@@ -112,6 +120,8 @@ int main (int argc, char **argv) {
 
          /* Itera sobre cada um dos commandos especificados no array de comandos */
          for (int i = 0; i < NUMCOMMANDS; ++i) {
+            IOSTAT_POLL(STDERR_FILENO);
+
             int numBytes = strlen(commands[i]);
 
             /* Escreve no socket do cliente o tamanho (em bytes) do commando */
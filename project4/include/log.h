@@ -0,0 +1,502 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <type_traits>
+
+/*
+    Log assíncrono.
+
+    Quem gera o log (o loop do servidor) não formata nem escreve nada: apenas
+    copia o ponteiro do formato, os argumentos e o horário para um registro
+    binário de tamanho fixo num buffer circular da própria thread (um produtor,
+    um consumidor, sem locks). Uma thread de fundo esvazia os buffers de todas
+    as threads, formata os registros e os escreve em lote com um único write
+    por destino.
+
+    Se o buffer circular estiver cheio o registro é descartado (e contado): o
+    loop nunca espera pelo terminal ou pelo disco. A exceção são os bytes
+    prontos de logger::write (a transcrição de uma conexão, por exemplo), que
+    são dados e não diagnóstico: esses esperam por espaço no buffer.
+
+    Os níveis abaixo de LOG_LEVEL são removidos em tempo de compilação.
+*/
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SIZE 4096      /* registros por thread (potência de 2) */
+#define LOG_MAX_RINGS 64        /* threads que podem gerar log */
+#define LOG_MAX_ARGS 8
+#define LOG_STR_SIZE 128        /* bytes para os argumentos do tipo string de um registro */
+#define LOG_MAX_SINKS 16
+#define LOG_SINK_BUFFER 65536
+#define LOG_IDLE_US 1000        /* espera da thread de fundo quando não há registros */
+
+namespace logger {
+    enum Level : char {
+        Debug = LOG_LEVEL_DEBUG,
+        Info = LOG_LEVEL_INFO,
+        Warn = LOG_LEVEL_WARN,
+        Error = LOG_LEVEL_ERROR,
+        Raw                         // bytes já prontos, escritos sem formatação
+    };
+
+    enum ArgType : char {
+        ArgInt,
+        ArgDouble,
+        ArgString
+    };
+
+    class Record {
+        public:
+            long long timestamp;
+            const char *fmt;
+            int fd;
+            Level level;
+            char nargs;
+            short strLen;
+            ArgType types[LOG_MAX_ARGS];
+            union {
+                long long i;
+                double d;
+            } args[LOG_MAX_ARGS];
+            char str[LOG_STR_SIZE];
+    };
+
+    /* buffer circular de uma thread: só ela escreve em `head`, só a thread de fundo escreve em `tail` */
+    class Ring {
+        public:
+            Record records[LOG_RING_SIZE];
+            std::atomic<unsigned> head, tail;
+            std::atomic<long long> dropped;
+
+            Ring() : head(0), tail(0), dropped(0) {}
+
+            Record *claim() {
+                unsigned h = head.load(std::memory_order_relaxed);
+
+                if (h - tail.load(std::memory_order_acquire) >= LOG_RING_SIZE) return NULL;
+
+                return &records[h & (LOG_RING_SIZE - 1)];
+            }
+
+            void publish() {
+                head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+    };
+
+    class Sink {
+        public:
+            int fd, len;
+            char buf[LOG_SINK_BUFFER];
+    };
+
+    std::atomic<Ring *> rings[LOG_MAX_RINGS];
+    std::atomic<int> numRings(0);
+    std::atomic<bool> running(false);
+    std::thread *worker = NULL;
+    pid_t owner = 0;
+    Sink sinks[LOG_MAX_SINKS];
+    int numSinks = 0;
+
+    thread_local Ring *localRing = NULL;
+
+    /* chamada no início da thread de fundo (ex.: para tirá-la da contagem de alocações) */
+    void (*onThreadStart)() = NULL;
+
+    Ring *ring() {
+        if (localRing == NULL) {
+            int i = numRings.fetch_add(1);
+
+            if (i >= LOG_MAX_RINGS) return NULL;
+
+            localRing = new Ring();
+            rings[i].store(localRing, std::memory_order_release);
+        }
+
+        return localRing;
+    }
+
+    long long now() {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+
+        return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    /* captura de argumentos: inteiros (e enums) e ponteiros viram long long, reais viram double, strings são copiadas */
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+    put(Record *rec, T value) {
+        rec->types[(int) rec->nargs] = ArgInt;
+        rec->args[(int) rec->nargs++].i = (long long) value;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type
+    put(Record *rec, T value) {
+        rec->types[(int) rec->nargs] = ArgDouble;
+        rec->args[(int) rec->nargs++].d = (double) value;
+    }
+
+    void put(Record *rec, const char *value) {
+        int len = (value != NULL) ? (int) strlen(value) : 0;
+
+        if (len > LOG_STR_SIZE - 1 - rec->strLen) len = LOG_STR_SIZE - 1 - rec->strLen;
+
+        rec->types[(int) rec->nargs] = ArgString;
+        rec->args[(int) rec->nargs++].i = rec->strLen;
+
+        if (len > 0) memcpy(rec->str + rec->strLen, value, len);
+
+        rec->strLen += len;
+        rec->str[rec->strLen++] = '\0';
+    }
+
+    void capture(Record *rec) {}
+
+    template <typename T, typename... Rest>
+    void capture(Record *rec, T value, Rest... rest) {
+        if (rec->nargs < LOG_MAX_ARGS) put(rec, value);
+
+        capture(rec, rest...);
+    }
+
+    template <typename... Args>
+    void log(int fd, Level level, const char *fmt, Args... args) {
+        Ring *r = ring();
+        Record *rec = (r != NULL) ? r->claim() : NULL;
+
+        if (rec == NULL) {
+            if (r != NULL) r->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        rec->timestamp = now();
+        rec->fmt = fmt;
+        rec->fd = fd;
+        rec->level = level;
+        rec->nargs = 0;
+        rec->strLen = 0;
+
+        capture(rec, args...);
+
+        r->publish();
+    }
+
+    /*
+        bytes prontos (por exemplo, a saída de um comando) para o arquivo `fd`, em pedaços de
+        LOG_STR_SIZE. Com o buffer cheio, espera a thread de fundo esvaziá-lo: nada é descartado,
+        nem parte de uma mensagem. Sem a thread de fundo neste processo, escreve direto
+    */
+    void write(int fd, const char *data, int len) {
+        Ring *r = ring();
+
+        if (r == NULL || !running.load(std::memory_order_acquire) || owner != getpid()) {
+            for (int off = 0, n; off < len; off += n) {
+                if ((n = ::write(fd, data + off, len - off)) <= 0) {
+                    perror("log write error");
+                    return;
+                }
+            }
+
+            return;
+        }
+
+        for (int off = 0; off < len; off += LOG_STR_SIZE) {
+            Record *rec;
+
+            while ((rec = r->claim()) == NULL) usleep(LOG_IDLE_US);
+
+            rec->fmt = NULL;
+            rec->fd = fd;
+            rec->level = Raw;
+            rec->strLen = (len - off < LOG_STR_SIZE) ? len - off : LOG_STR_SIZE;
+
+            memcpy(rec->str, data + off, rec->strLen);
+
+            r->publish();
+        }
+    }
+
+    /* a partir daqui só a thread de fundo executa */
+
+    Sink *sink(int fd) {
+        for (int i = 0; i < numSinks; ++i) {
+            if (sinks[i].fd == fd) return &sinks[i];
+        }
+
+        if (numSinks == LOG_MAX_SINKS) return NULL;
+
+        sinks[numSinks].fd = fd;
+        sinks[numSinks].len = 0;
+
+        return &sinks[numSinks++];
+    }
+
+    void flush(Sink *s) {
+        for (int off = 0, n; off < s->len; off += n) {
+            if ((n = ::write(s->fd, s->buf + off, s->len - off)) <= 0) {
+                perror("log write error");
+                break;
+            }
+        }
+
+        s->len = 0;
+    }
+
+    void append(Sink *s, const char *data, int len) {
+        if (s->len + len > LOG_SINK_BUFFER) flush(s);
+
+        if (len > LOG_SINK_BUFFER) len = LOG_SINK_BUFFER;
+
+        memcpy(s->buf + s->len, data, len);
+        s->len += len;
+    }
+
+    /*
+        formata um registro. Cada especificador de conversão do formato é
+        reescrito para o tipo capturado (por exemplo "%d" vira "%lld") e
+        formatado individualmente com snprintf.
+    */
+    int format(Record *rec, char *out, int size) {
+        static const char *levels[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+        char spec[32];
+        int len = 0, arg = 0;
+
+        time_t secs = rec->timestamp / 1000000000LL;
+        struct tm tm;
+
+        localtime_r(&secs, &tm);
+
+        len += strftime(out, size, "[%H:%M:%S", &tm);
+        len += snprintf(out + len, size - len, ".%03lld %s] ", (rec->timestamp / 1000000LL) % 1000, levels[(int) rec->level]);
+
+        for (const char *p = rec->fmt; *p && len < size - 1; ++p) {
+            if (*p != '%') {
+                out[len++] = *p;
+                continue;
+            }
+
+            if (*(p + 1) == '%') {
+                out[len++] = '%';
+                ++p;
+                continue;
+            }
+
+            int s = 0;
+
+            spec[s++] = *p++;
+
+            /* flags, largura e precisão são mantidos; modificadores de tamanho são descartados */
+            while (*p && strchr("-+ #0123456789.", *p) && s < 24) spec[s++] = *p++;
+            while (*p && strchr("hlLqjzt", *p)) ++p;
+
+            if (!*p) break;
+
+            char conv = *p;
+
+            if (arg >= rec->nargs) {
+                len += snprintf(out + len, size - len, "<?>");
+                continue;
+            }
+
+            ArgType type = rec->types[arg];
+
+            if (type == ArgString) {
+                spec[s++] = 's';
+                spec[s] = '\0';
+                len += snprintf(out + len, size - len, spec, rec->str + rec->args[arg].i);
+            } else if (type == ArgDouble) {
+                spec[s++] = strchr("feEgGaA", conv) ? conv : 'f';
+                spec[s] = '\0';
+                len += snprintf(out + len, size - len, spec, rec->args[arg].d);
+            } else if (conv == 'c') {
+                spec[s++] = 'c';
+                spec[s] = '\0';
+                len += snprintf(out + len, size - len, spec, (int) rec->args[arg].i);
+            } else if (conv == 'p') {
+                spec[s++] = 'p';
+                spec[s] = '\0';
+                len += snprintf(out + len, size - len, spec, (void *) rec->args[arg].i);
+            } else {
+                spec[s++] = 'l';
+                spec[s++] = 'l';
+                spec[s++] = strchr("diuxXo", conv) ? conv : 'd';
+                spec[s] = '\0';
+                len += snprintf(out + len, size - len, spec, rec->args[arg].i);
+            }
+
+            ++arg;
+        }
+
+        if (len > size - 2) len = size - 2;
+
+        out[len++] = '\n';
+
+        return len;
+    }
+
+    /* esvazia os buffers de todas as threads; retorna o número de registros tratados */
+    int drain() {
+        static char line[LOG_STR_SIZE * 4];
+        int total = 0, n = numRings.load(std::memory_order_acquire);
+
+        if (n > LOG_MAX_RINGS) n = LOG_MAX_RINGS;
+
+        for (int i = 0; i < n; ++i) {
+            Ring *r = rings[i].load(std::memory_order_acquire);
+
+            if (r == NULL) continue;
+
+            unsigned t = r->tail.load(std::memory_order_relaxed);
+            unsigned h = r->head.load(std::memory_order_acquire);
+
+            for (; t != h; ++t, ++total) {
+                Record *rec = &r->records[t & (LOG_RING_SIZE - 1)];
+                Sink *s = sink(rec->fd);
+
+                if (s == NULL) continue;
+
+                if (rec->level == Raw) append(s, rec->str, rec->strLen);
+                else append(s, line, format(rec, line, sizeof(line)));
+            }
+
+            r->tail.store(t, std::memory_order_release);
+        }
+
+        for (int i = 0; i < numSinks; ++i) {
+            if (sinks[i].len > 0) flush(&sinks[i]);
+        }
+
+        return total;
+    }
+
+    void run() {
+        if (onThreadStart != NULL) onThreadStart();
+
+        while (running.load(std::memory_order_acquire)) {
+            if (drain() == 0) usleep(LOG_IDLE_US);
+        }
+
+        drain();
+    }
+
+    long long dropped() {
+        long long total = 0;
+
+        for (int i = 0; i < numRings.load() && i < LOG_MAX_RINGS; ++i) {
+            Ring *r = rings[i].load();
+
+            if (r != NULL) total += r->dropped.load();
+        }
+
+        return total;
+    }
+
+    /* esvazia o que restou e encerra a thread de fundo (também chamado na saída do programa) */
+    void stop() {
+        if (owner != getpid() || !running.exchange(false)) return;
+
+        worker->join();
+
+        delete worker;
+        worker = NULL;
+
+        long long lost = dropped();
+
+        if (lost > 0) fprintf(stderr, "log: %lld registros descartados (buffer cheio)\n", lost);
+    }
+
+    /*
+        inicia a thread de fundo e já reserva o buffer da thread que chamou
+        (para que o primeiro log do loop não aloque memória). Depois de um
+        fork, o processo filho deve chamar start() de novo, pois a thread
+        de fundo não existe no filho.
+    */
+    void start() {
+        if (running.load() && owner == getpid()) {
+            ring();
+            return;
+        }
+
+        /*
+            processo filho de um fork: a thread de fundo herdada não existe aqui, e
+            os registros pendentes do pai não devem ser escritos de novo
+        */
+        for (int i = 0; i < numRings.load() && i < LOG_MAX_RINGS; ++i) {
+            Ring *r = rings[i].load();
+
+            if (r != NULL) r->tail.store(r->head.load());
+        }
+
+        numSinks = 0;
+        owner = getpid();
+
+        ring();
+
+        running.store(true);
+        worker = new std::thread(run);
+
+        static bool registered = false;
+
+        if (!registered) {
+            atexit(stop);
+            registered = true;
+        }
+    }
+
+    /* abre (e trunca) um arquivo de destino para os registros */
+    int open(const char *path) {
+        int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+
+        if (fd < 0) {
+            perror("log open error");
+            exit(1);
+        }
+
+        return fd;
+    }
+}
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(fmt, ...) logger::log(STDOUT_FILENO, logger::Debug, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(fmt, ...) logger::log(STDOUT_FILENO, logger::Info, fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(fmt, ...) logger::log(STDERR_FILENO, logger::Warn, fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(fmt, ...) logger::log(STDERR_FILENO, logger::Error, fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) do {} while (0)
+#endif
+
+#endif
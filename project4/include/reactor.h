@@ -0,0 +1,242 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <socket.h>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include <vector>
+
+#define REACTOR_BATCH 256       /* descritores prontos entregues por espera */
+
+/*
+    Espera por descritores prontos para leitura, com o mecanismo escolhido
+    na inicialização:
+
+        select      o de sempre: conjunto de bits refeito a cada espera, no
+                    máximo FD_SETSIZE descritores (add() recusa os demais)
+        poll        vetor de pollfd, sem limite além do de descritores; a
+                    espera custa O(descritores registrados)
+        epoll       o kernel mantém o conjunto e devolve só os prontos; a
+                    espera custa O(prontos)
+        epoll-et    epoll com notificação por borda: um descritor só volta
+                    a ser entregue quando chegarem dados novos, então quem
+                    o trata precisa ler até esvaziá-lo (sock::TryRead)
+
+    Nos três primeiros (nível) um descritor com dados ainda não lidos é
+    entregue de novo na próxima espera. wait() devolve no máximo `max`
+    descritores; os demais ficam para a próxima.
+*/
+namespace reactor {
+    enum Backend {
+        Select,
+        Poll,
+        Epoll,
+        EpollEdge,
+        NUM_BACKENDS
+    };
+
+    const char *backendNames[NUM_BACKENDS] = {"select", "poll", "epoll", "epoll-et"};
+
+    /* nome -> backend; falso caso desconhecido */
+    bool parseBackend(const char *name, Backend &backend) {
+        for (int b = 0; b < NUM_BACKENDS; ++b) {
+            if (strcmp(name, backendNames[b]) == 0) {
+                backend = (Backend) b;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    class Reactor {
+        public:
+            virtual ~Reactor() {}
+
+            /* passa a observar `fd`; falso caso o backend não comporte mais um descritor */
+            virtual bool add(int fd) = 0;
+
+            /* deixa de observar `fd` (antes de fechá-lo) */
+            virtual void remove(int fd) = 0;
+
+            /* espera até haver descritores prontos e os escreve em `ready`; 0 caso interrompido por um sinal */
+            virtual int wait(int *ready, int max) = 0;
+
+            /* o tratador precisa esvaziar o descritor a cada entrega */
+            virtual bool edgeTriggered() { return false; }
+    };
+
+    class SelectReactor : public Reactor {
+        public:
+            fd_set allset;
+            int maxfd;
+            std::vector<int> fds;       // registrados, na ordem de registro
+            std::vector<int> pos;       // posição de cada descritor em fds (-1 = ausente)
+
+            SelectReactor() : maxfd(-1), pos(FD_SETSIZE, -1) { FD_ZERO(&allset); }
+
+            bool add(int fd) {
+                if (fd < 0 || fd >= FD_SETSIZE) return false;
+
+                FD_SET(fd, &allset);
+
+                if (fd > maxfd) maxfd = fd;
+
+                pos[fd] = (int) fds.size();
+                fds.push_back(fd);
+
+                return true;
+            }
+
+            void remove(int fd) {
+                if (fd < 0 || fd >= FD_SETSIZE || pos[fd] < 0) return;
+
+                FD_CLR(fd, &allset);
+
+                /* move o último para o lugar do removido */
+                fds[pos[fd]] = fds.back();
+                pos[fds.back()] = pos[fd];
+                fds.pop_back();
+                pos[fd] = -1;
+            }
+
+            int wait(int *ready, int max) {
+                fd_set rset = allset;
+                int nready = sock::Select(maxfd + 1, &rset), n = 0;
+
+                for (int i = 0; i < (int) fds.size() && n < nready && n < max; ++i) {
+                    if (FD_ISSET(fds[i], &rset)) ready[n++] = fds[i];
+                }
+
+                return n;
+            }
+    };
+
+    class PollReactor : public Reactor {
+        public:
+            std::vector<struct pollfd> fds;
+            std::vector<int> pos;       // posição de cada descritor em fds, cresce com o maior descritor
+
+            bool add(int fd) {
+                if (fd < 0) return false;
+
+                if (fd >= (int) pos.size()) pos.resize(fd + 1, -1);
+
+                struct pollfd entry = {fd, POLLIN, 0};
+
+                pos[fd] = (int) fds.size();
+                fds.push_back(entry);
+
+                return true;
+            }
+
+            void remove(int fd) {
+                if (fd < 0 || fd >= (int) pos.size() || pos[fd] < 0) return;
+
+                fds[pos[fd]] = fds.back();
+                pos[fds.back().fd] = pos[fd];
+                fds.pop_back();
+                pos[fd] = -1;
+            }
+
+            int wait(int *ready, int max) {
+                int nready, n = 0;
+
+                IOSTAT_BEGIN();
+                nready = poll(fds.empty() ? NULL : &fds[0], fds.size(), -1);
+                IOSTAT_END(OpPoll, -1, nready);
+
+                if (nready < 0) {
+                    if (errno == EINTR) return 0;
+
+                    perror("poll error");
+                    exit(1);
+                }
+
+                /* fechamento e erro também são entregues: a leitura os revela */
+                for (int i = 0; i < (int) fds.size() && n < nready && n < max; ++i) {
+                    if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) ready[n++] = fds[i].fd;
+                }
+
+                return n;
+            }
+    };
+
+    class EpollReactor : public Reactor {
+        public:
+            int epfd;
+            bool edge;
+            struct epoll_event events[REACTOR_BATCH];
+
+            EpollReactor(bool _edge) : edge(_edge) {
+                if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+                    perror("epoll_create1 error");
+                    exit(1);
+                }
+            }
+
+            ~EpollReactor() { close(epfd); }
+
+            bool add(int fd) {
+                struct epoll_event event;
+
+                event.events = EPOLLIN | (edge ? EPOLLET : 0);
+                event.data.fd = fd;
+
+                return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) == 0;
+            }
+
+            void remove(int fd) { epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL); }
+
+            int wait(int *ready, int max) {
+                int nready;
+
+                if (max > REACTOR_BATCH) max = REACTOR_BATCH;
+
+                IOSTAT_BEGIN();
+                nready = epoll_wait(epfd, events, max, -1);
+                IOSTAT_END(OpEpoll, -1, nready);
+
+                if (nready < 0) {
+                    if (errno == EINTR) return 0;
+
+                    perror("epoll_wait error");
+                    exit(1);
+                }
+
+                for (int i = 0; i < nready; ++i) ready[i] = events[i].data.fd;
+
+                return nready;
+            }
+
+            bool edgeTriggered() { return edge; }
+    };
+
+    Reactor *create(Backend backend) {
+        switch (backend) {
+            case Select: return new SelectReactor();
+            case Poll: return new PollReactor();
+            case Epoll: return new EpollReactor(false);
+            default: return new EpollReactor(true);
+        }
+    }
+
+    /* sobe o limite de descritores do processo até o máximo permitido; retorna o novo limite */
+    long long raiseFdLimit() {
+        struct rlimit limit;
+
+        if (getrlimit(RLIMIT_NOFILE, &limit) < 0) return -1;
+
+        limit.rlim_cur = limit.rlim_max;
+
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+
+        return (long long) limit.rlim_cur;
+    }
+}
+
+#endif
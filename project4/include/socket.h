@@ -13,8 +13,13 @@
 #include <sys/socket.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+
+#include <trace.h>
+#include <iostat.h>
 
 #define MAX_LINE 4096
+#define ACCEPT_EXHAUSTED -2    /* TryAccept: sem descritores livres para a conexão */
 
 namespace sock {
     class SocketAddr {
@@ -150,7 +155,11 @@ namespace sock {
             Caso o retorno do accept seja igual a -1, então houve algum erro com a tentativa
             de aceitar a conexão com o cliente.
         */
-        if ((connfd = accept(sockfd, sockAddrAux, &addrlen)) == -1 ) {
+        IOSTAT_BEGIN();
+        connfd = accept(sockfd, sockAddrAux, &addrlen);
+        IOSTAT_END(OpAccept, -1, connfd);
+
+        if (connfd == -1 ) {
             perror("accept");
             exit(1);
         }
@@ -177,13 +186,19 @@ namespace sock {
     }
 
     void Write(int sockfd, char *buf, int sizebuf) {
+        TRACE_SPAN(StageWrite, sockfd);
+
         /*
             escreve o buffer `buf` no socket connfd conectado com o cliente, para que o
             possa receber o horário obtido pelo servidor
         */
 
+        IOSTAT_BEGIN();
+        int n = write(sockfd, buf, sizebuf);
+        IOSTAT_END(OpWrite, sizebuf, n);
+
         /* verifica se houve algum erro com a escrita do buffer no socket descriptor */
-        if (!write(sockfd, buf, sizebuf)) {
+        if (!n) {
             perror("Something went wrong");
             exit(1);
         }
@@ -192,7 +207,13 @@ namespace sock {
     int Read(int sockfd, char *recvline, int maxline) {
         int n;
 
-        if ((n = read(sockfd, recvline, maxline)) < 0) {
+        TRACE_SPAN(StageRead, sockfd);
+
+        IOSTAT_BEGIN();
+        n = read(sockfd, recvline, maxline);
+        IOSTAT_END(OpRead, maxline, n);
+
+        if (n < 0) {
             perror("read error");
             exit(1);
         }
@@ -202,6 +223,64 @@ namespace sock {
         return n;
     }
 
+    /* Read que não espera: -1 caso não haja nada a ler (para descritores entregues por borda, ver include/reactor.h) */
+    int TryRead(int sockfd, char *recvline, int maxline) {
+        int n;
+
+        TRACE_SPAN(StageRead, sockfd);
+
+        IOSTAT_BEGIN();
+        n = recv(sockfd, recvline, maxline, MSG_DONTWAIT);
+        IOSTAT_END(OpRead, maxline, n);
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return -1;
+
+            perror("read error");
+            exit(1);
+        }
+
+        recvline[n] = 0;
+
+        return n;
+    }
+
+    /*
+        Accept que não espera (o socket de escuta precisa ser não bloqueante): -1 caso não haja
+        conexão pendente, ACCEPT_EXHAUSTED caso acabem os descritores (a conexão continua na fila;
+        quem chama decide o que fazer, ver src/servidor.cpp)
+    */
+    int TryAccept(int sockfd, SocketAddr *sockAddr) {
+        int connfd;
+        socklen_t addrlen =  (sockAddr != NULL) ? sizeof(sockAddr->addr) : 0;
+        struct sockaddr *sockAddrAux = (sockAddr != NULL) ? (struct sockaddr *) &sockAddr->addr : NULL;
+
+        IOSTAT_BEGIN();
+        connfd = accept(sockfd, sockAddrAux, &addrlen);
+        IOSTAT_END(OpAccept, -1, connfd);
+
+        if (connfd == -1) {
+            /* a conexão desistiu antes de ser aceita: tenta de novo depois */
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED || errno == EINTR) return -1;
+
+            if (errno == EMFILE || errno == ENFILE) return ACCEPT_EXHAUSTED;
+
+            perror("accept");
+            exit(1);
+        }
+
+        return connfd;
+    }
+
+    void SetNonBlocking(int sockfd) {
+        int flags = fcntl(sockfd, F_GETFL, 0);
+
+        if (flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            perror("fcntl error");
+            exit(1);
+        }
+    }
+
     void Close(int sockfd) {
       /* 
          Quando chamamos a syscall close(), começamos a sequência padrão para término da conexão TCP.
@@ -263,7 +342,17 @@ namespace sock {
     int Select(int maxfdp1, fd_set *rset) {
         int n;
         
-        if ((n = select(maxfdp1, rset, NULL, NULL, NULL)) < 0) {
+        IOSTAT_BEGIN();
+        n = select(maxfdp1, rset, NULL, NULL, NULL);
+        IOSTAT_END(OpSelect, -1, n);
+
+        if (n < 0) {
+            /* interrompido por um sinal: nenhum descritor pronto */
+            if (errno == EINTR) {
+                FD_ZERO(rset);
+                return 0;
+            }
+
             perror("select error");
             exit(1);
         }
@@ -0,0 +1,279 @@
+#include <trace.h>
+
+#include <map>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+/*
+    Analisador dos arquivos de trace gerados pelo servidor (make TRACE=1).
+
+    Reconstrói as etapas (pares início/fim) de cada thread, agrupa as etapas de
+    cada requisição e imprime a distribuição da latência por etapa e por
+    requisição. Opcionalmente imprime a linha do tempo das primeiras
+    requisições (-r) e gera um JSON no formato do Chrome trace (-c), que
+    pode ser aberto em chrome://tracing ou no Perfetto.
+*/
+
+class Span {
+    public:
+        int thread, stage, fd;
+        uint32_t request;
+        uint64_t begin, end;
+        int depth;
+};
+
+class Request {
+    public:
+        int thread, fd;
+        uint32_t request;
+        uint64_t begin, end, wakeup;
+        double stageUs[TRACE_MAX_STAGES];
+        std::vector<int> spans;
+};
+
+static double ticksPerUs;
+static uint64_t tscStart;
+static char stageNames[TRACE_MAX_STAGES][TRACE_NAME_LEN];
+
+double toUs(uint64_t ticks) {
+    return ticks / ticksPerUs;
+}
+
+double percentile(std::vector<double> &values, double p) {
+    return values[(size_t) (p * (values.size() - 1))];
+}
+
+void printDistribution(const char *name, std::vector<double> &values) {
+    if (values.empty()) return;
+
+    std::sort(values.begin(), values.end());
+
+    printf("  %-22s %8zu %10.2f %10.2f %10.2f %10.2f %10.2f\n", name, values.size(),
+        values.front(), percentile(values, 0.5), percentile(values, 0.9), percentile(values, 0.99), values.back());
+}
+
+void printHeader(const char *title) {
+    printf("\n%s (us)\n  %-22s %8s %10s %10s %10s %10s %10s\n", title, "", "n", "min", "p50", "p90", "p99", "max");
+}
+
+int main (int argc, char **argv) {
+    const char *chromePath = NULL;
+    int timelines = 0;
+
+    /*
+       Verificamos se o usuário passou o número correto de parâmetros
+    */
+    if (argc < 2) {
+        char   error[100];
+
+        strcpy(error,"uso: ");
+        strcat(error,argv[0]);
+        strcat(error," <TraceFile> [-c <ChromeJson>] [-r <NumRequests>]");
+        perror(error);
+
+        exit(1);
+    }
+
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-c") == 0) chromePath = argv[i + 1];
+        else if (strcmp(argv[i], "-r") == 0) timelines = atoi(argv[i + 1]);
+    }
+
+    FILE *fp = fopen(argv[1], "rb");
+
+    if (fp == NULL) {
+        perror("open error");
+        exit(1);
+    }
+
+    trace::Header header;
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION
+            || header.eventSize != sizeof(trace::Event) || header.numStages > TRACE_MAX_STAGES) {
+        fprintf(stderr, "%s: arquivo de trace inválido\n", argv[1]);
+        exit(1);
+    }
+
+    ticksPerUs = header.ticksPerUs;
+    tscStart = header.tscStart;
+
+    memcpy(stageNames, header.names, sizeof(stageNames));
+
+    std::vector<trace::Event> events;
+    trace::Event event;
+
+    while (fread(&event, sizeof(event), 1, fp) == 1) events.push_back(event);
+
+    fclose(fp);
+
+    /*
+        Os blocos de threads diferentes podem estar intercalados no arquivo, mas
+        dentro de uma thread os eventos estão em ordem: uma pilha por thread
+        basta para casar os inícios com os fins.
+    */
+    std::map<int, std::vector<trace::Event> > open;
+    std::map<int, uint64_t> lastWakeup;
+    std::map<uint64_t, int> requestIndex;
+    std::vector<Span> spans;
+    std::vector<Request> requests;
+    uint64_t first = ~0ULL, last = 0;
+
+    for (size_t i = 0; i < events.size(); ++i) {
+        trace::Event &e = events[i];
+        std::vector<trace::Event> &stack = open[e.thread];
+
+        first = std::min(first, e.tsc);
+        last = std::max(last, e.tsc);
+
+        if (e.phase == trace::Begin) {
+            stack.push_back(e);
+            continue;
+        }
+
+        /* fim sem início (o início ficou antes do arquivo ser aberto): ignorado */
+        if (stack.empty() || stack.back().stage != e.stage) continue;
+
+        trace::Event begin = stack.back();
+
+        stack.pop_back();
+
+        Span span;
+
+        span.thread = e.thread;
+        span.stage = e.stage;
+        span.fd = begin.fd;
+        span.request = begin.request;
+        span.begin = begin.tsc;
+        span.end = e.tsc;
+        span.depth = (int) stack.size();
+
+        spans.push_back(span);
+
+        if (span.stage == trace::StageSelect) lastWakeup[span.thread] = span.end;
+
+        if (span.request == 0) continue;
+
+        uint64_t key = ((uint64_t) span.thread << 32) | span.request;
+        std::map<uint64_t, int>::iterator it = requestIndex.find(key);
+
+        if (it == requestIndex.end()) {
+            Request req;
+
+            req.thread = span.thread;
+            req.request = span.request;
+            req.fd = span.fd;
+            req.begin = span.begin;
+            req.end = span.end;
+            req.wakeup = lastWakeup.count(span.thread) ? lastWakeup[span.thread] : span.begin;
+
+            for (int s = 0; s < TRACE_MAX_STAGES; ++s) req.stageUs[s] = 0;
+
+            it = requestIndex.insert(std::make_pair(key, (int) requests.size())).first;
+            requests.push_back(req);
+        }
+
+        Request &req = requests[it->second];
+
+        req.begin = std::min(req.begin, span.begin);
+        req.end = std::max(req.end, span.end);
+        req.spans.push_back((int) spans.size() - 1);
+
+        /* só a etapa mais externa de cada tipo conta (Read e Write aparecem dentro do Handle) */
+        bool nested = false;
+
+        for (int k = (int) stack.size() - 1; k >= 0; --k) {
+            if (stack[k].stage == span.stage) nested = true;
+        }
+
+        if (!nested) req.stageUs[span.stage] += toUs(span.end - span.begin);
+    }
+
+    printf("%zu eventos, %zu etapas, %zu requisições, %zu threads, %.3f ms, TSC %.1f ciclos/us\n",
+        events.size(), spans.size(), requests.size(), open.size(),
+        spans.empty() ? 0.0 : toUs(last - first) / 1000.0, ticksPerUs);
+
+    /* latência de cada ocorrência de cada etapa */
+    printHeader("latência por etapa");
+
+    for (int s = 0; s < (int) header.numStages; ++s) {
+        std::vector<double> values;
+
+        for (size_t i = 0; i < spans.size(); ++i) {
+            if (spans[i].stage == s) values.push_back(toUs(spans[i].end - spans[i].begin));
+        }
+
+        printDistribution(stageNames[s], values);
+    }
+
+    /* soma das etapas de cada requisição */
+    if (!requests.empty()) {
+        std::vector<double> total, wait;
+
+        printHeader("latência por requisição");
+
+        for (size_t i = 0; i < requests.size(); ++i) {
+            total.push_back(toUs(requests[i].end - requests[i].begin));
+            wait.push_back(requests[i].begin > requests[i].wakeup ? toUs(requests[i].begin - requests[i].wakeup) : 0.0);
+        }
+
+        printDistribution("total", total);
+        printDistribution("desde o select", wait);
+
+        for (int s = 0; s < (int) header.numStages; ++s) {
+            std::vector<double> values;
+
+            for (size_t i = 0; i < requests.size(); ++i) {
+                if (requests[i].stageUs[s] > 0) values.push_back(requests[i].stageUs[s]);
+            }
+
+            printDistribution(stageNames[s], values);
+        }
+    }
+
+    /* linha do tempo das primeiras requisições */
+    for (int i = 0; i < timelines && i < (int) requests.size(); ++i) {
+        Request &req = requests[i];
+
+        printf("\nrequisição %u (thread %d, fd %d): %.2f us, começou %.2f us depois do select\n", req.request, req.thread, req.fd,
+            toUs(req.end - req.begin), req.begin > req.wakeup ? toUs(req.begin - req.wakeup) : 0.0);
+
+        /* as etapas são registradas no fim; ordena pelo início */
+        std::vector<std::pair<uint64_t, int> > order;
+
+        for (size_t k = 0; k < req.spans.size(); ++k) order.push_back(std::make_pair(spans[req.spans[k]].begin, req.spans[k]));
+
+        std::sort(order.begin(), order.end());
+
+        for (size_t k = 0; k < order.size(); ++k) {
+            Span &span = spans[order[k].second];
+
+            printf("  +%9.2f  %*s%-10s %9.2f\n", toUs(span.begin - req.begin), 2 * span.depth, "", stageNames[span.stage], toUs(span.end - span.begin));
+        }
+    }
+
+    /* eventos completos ("ph": "X") do formato do Chrome trace */
+    if (chromePath != NULL) {
+        FILE *out = fopen(chromePath, "w");
+
+        if (out == NULL) {
+            perror("open error");
+            exit(1);
+        }
+
+        fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+
+        for (size_t i = 0; i < spans.size(); ++i) {
+            Span &span = spans[i];
+
+            fprintf(out, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"request\": %u, \"fd\": %d}}",
+                i ? ",\n" : "", stageNames[span.stage], span.thread, toUs(span.begin - tscStart), toUs(span.end - span.begin), span.request, span.fd);
+        }
+
+        fprintf(out, "\n]}\n");
+
+        fclose(out);
+    }
+
+    return 0;
+}
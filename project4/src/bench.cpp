@@ -0,0 +1,171 @@
+#include <socket.h>
+#include <reactor.h>
+#include <bench.h>
+
+#include <vector>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+/*
+    Microbenchmarks do projeto 4 (make bench; ver include/bench.h).
+
+        sock_ntop           conversão do endereço do cliente para texto
+        eco/socketpair      ida e volta de uma linha pelo caminho do servidor de
+                            eco: o cliente escreve, o servidor lê e devolve o
+                            que leu, o cliente lê, tudo por sock::Write e
+                            sock::Read, pelo kernel
+        reator/<backend>    uma rodada do servidor de eco com 100, 10k e 50k
+                            conexões, das quais BENCH_ACTIVE enviam uma linha:
+                            a espera do reator e o eco de cada linha (ns por
+                            rodada). As conexões ociosas são eventfds (um
+                            descritor cada, nunca prontos), para que caibam no
+                            limite de descritores; os tamanhos que não cabem
+                            (no select, além de FD_SETSIZE) são pulados
+*/
+#define BENCH_ACTIVE 64     /* conexões ativas por rodada */
+#define BENCH_LINE 16       /* bytes de cada linha */
+
+/* lê exatamente `len` bytes, como o cliente faz ao esperar a linha de volta */
+void drain(int fd, char *buf, int len) {
+    for (int n = 0, got; n < len; n += got) {
+        if ((got = sock::Read(fd, buf + n, len - n)) == 0) {
+            perror("bench: conexão fechada");
+            exit(1);
+        }
+    }
+}
+
+void benchReactor(bench::Suite &suite, reactor::Backend backend, int connections, long long fdLimit) {
+    int active = (connections < BENCH_ACTIVE) ? connections : BENCH_ACTIVE;
+    int needed = connections + active + 16;     // ociosas, os dois lados das ativas e os da suíte
+    char name[32];
+
+    snprintf(name, sizeof(name), "reator/%s", reactor::backendNames[backend]);
+
+    if (suite.filter != NULL && strstr(name, suite.filter) == NULL) return;
+
+    if (needed > fdLimit || (backend == reactor::Select && needed > FD_SETSIZE)) {
+        fprintf(stderr, "%s com %d conexões pulado: %d descritores necessários, limite %lld\n", name, connections, needed,
+                (backend == reactor::Select) ? (long long) FD_SETSIZE : fdLimit);
+        return;
+    }
+
+    reactor::Reactor *loop = reactor::create(backend);
+    std::vector<int> idle, servers(active), clients(active);
+    int ready[REACTOR_BATCH];
+    char line[BENCH_LINE], buf[MAX_LINE + 1];
+
+    memset(line, 'r', sizeof(line));
+
+    for (int i = 0; i < connections - active; ++i) {
+        int fd = eventfd(0, EFD_CLOEXEC);
+
+        if (fd < 0) {
+            perror("eventfd error");
+            exit(1);
+        }
+
+        idle.push_back(fd);
+        loop->add(fd);
+    }
+
+    for (int i = 0; i < active; ++i) {
+        int pair[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+            perror("socketpair error");
+            exit(1);
+        }
+
+        servers[i] = pair[0];
+        clients[i] = pair[1];
+
+        loop->add(servers[i]);
+    }
+
+    bool edge = loop->edgeTriggered();
+
+    suite.run(name, connections, 2.0 * BENCH_LINE * active, [&](long long n) {
+        for (long long round = 0; round < n; ++round) {
+            for (int i = 0; i < active; ++i) sock::Write(clients[i], line, BENCH_LINE);
+
+            /* o laço do servidor de eco até todas as linhas terem voltado */
+            for (int echoed = 0; echoed < active * BENCH_LINE; ) {
+                int nready = loop->wait(ready, REACTOR_BATCH);
+
+                for (int k = 0; k < nready; ++k) {
+                    int got;
+
+                    while ((got = edge ? sock::TryRead(ready[k], buf, MAX_LINE) : sock::Read(ready[k], buf, MAX_LINE)) > 0) {
+                        sock::Write(ready[k], buf, got);
+
+                        echoed += got;
+
+                        if (!edge) break;
+                    }
+                }
+            }
+
+            for (int i = 0; i < active; ++i) drain(clients[i], buf, BENCH_LINE);
+        }
+    });
+
+    delete loop;
+
+    for (int fd : idle) close(fd);
+
+    for (int i = 0; i < active; ++i) {
+        close(servers[i]);
+        close(clients[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    bench::Suite suite("project4", argc, argv);
+    sock::SocketAddr addr(AF_INET, 54321);
+    char ip[] = "192.168.100.200";
+    int fds[2];
+
+    addr.setInAddress(ip);
+
+    suite.run("sock_ntop", 0, 0, [&](long long n) {
+        for (long long i = 0; i < n; ++i) bench::keep(sock::sock_ntop((struct sockaddr *) &addr.addr, sizeof(addr.addr))[0]);
+    });
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair error");
+        exit(1);
+    }
+
+    const int sizes[] = {16, 256, 4096};
+    char line[MAX_LINE], buf[MAX_LINE + 1];
+
+    memset(line, 'e', sizeof(line));
+
+    for (int size : sizes) {
+        suite.run("eco/socketpair", size, 2.0 * size, [&](long long n) {
+            for (long long i = 0; i < n; ++i) {
+                sock::Write(fds[1], line, size);
+
+                /* o servidor devolve o que cada read trouxe */
+                for (int echoed = 0, got; echoed < size; echoed += got) {
+                    got = sock::Read(fds[0], buf, MAX_LINE);
+                    sock::Write(fds[0], buf, got);
+                }
+
+                drain(fds[1], buf, size);
+            }
+        });
+    }
+
+    const int connections[] = {100, 10000, 50000};
+    long long fdLimit = reactor::raiseFdLimit();
+
+    for (int b = 0; b < reactor::NUM_BACKENDS; ++b) {
+        for (int n : connections) benchReactor(suite, (reactor::Backend) b, n, fdLimit);
+    }
+
+    suite.finish();
+
+    return 0;
+}
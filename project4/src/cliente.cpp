@@ -9,7 +9,7 @@ void str_cli(FILE *fp, int sockfd) {
     fd_set rset;
     int n, counter = 0;
     char *buf = new char[MAX_LINE];
-    char *recvline = new char[MAX_LINE];
+    char *recvline = new char[MAX_LINE + 1];
 
     stdineof = 0;
 
@@ -1,4 +1,7 @@
 #include <socket.h>
+#include <reactor.h>
+#include <log.h>
+#include <trace.h>
 
 #define LISTENQ 9
 #define MAXLINE 4096
@@ -7,17 +10,25 @@
 #define MAXDATASIZE 100
 
 #include <stdio.h>
+#include <signal.h>
+
+/* SIGINT/SIGTERM encerram o loop, para que o log e o trace sejam esvaziados na saída */
+volatile sig_atomic_t stopRequested = 0;
+
+void sig_stop(int signo) { stopRequested = 1; }
 
 int main (int argc, char **argv) {
     /* 
        Verificamos se o usuário passou o número correto de parâmetros
     */
-    if (argc != 2) {
+    reactor::Backend backend = reactor::Epoll;
+
+    if ((argc != 2 && argc != 3) || (argc == 3 && !reactor::parseBackend(argv[2], backend))) {
        char   error[100];
 
        strcpy(error,"uso: ");
        strcat(error,argv[0]);
-       strcat(error," <Port>");
+       strcat(error," <Port> [select|poll|epoll|epoll-et]");
        perror(error);
 
        exit(1);
@@ -37,6 +48,18 @@ int main (int argc, char **argv) {
     */
     servaddr.setInAddress((int) INADDR_ANY);
 
+    /* o log das conexões é escrito por uma thread de fundo, fora do loop do select */
+    logger::start();
+
+    /* só abre o arquivo de trace quando compilado com make TRACE=1 */
+    TRACE_START();
+
+    /* contas de syscalls (make IOSTAT=1): relatório na saída e no SIGUSR1 */
+    IOSTAT_START(NULL, SIGUSR1);
+
+    signal(SIGINT, sig_stop);
+    signal(SIGTERM, sig_stop);
+
     /* cria um novo socket */
     int listenfd = sock::Socket(AF_INET, SOCK_STREAM, 0);
 
@@ -46,91 +69,151 @@ int main (int argc, char **argv) {
     /* faz com que o socket vire um socket passivo (escuta requisições) */
     sock::Listen(listenfd, LISTENQ);
 
-    int maxi = -1;
-    char buf[MAXLINE];
-    fd_set rset, allset;
-    int maxfd = listenfd;
-    int nready, client[FD_SETSIZE];
+    /* as conexões pendentes são todas aceitas a cada aviso, até o accept não ter mais nenhuma */
+    sock::SetNonBlocking(listenfd);
+
+    /*
+       espera pelos descritores prontos com o backend escolhido (ver include/reactor.h);
+       fora o select, o número de clientes só é limitado pelo de descritores do processo
+    */
+    reactor::Reactor *loop = reactor::create(backend);
+    bool edge = loop->edgeTriggered();
+
+    LOG_INFO("reator %s, até %lld descritores", reactor::backendNames[backend], reactor::raiseFdLimit());
 
-    for (int i = 0; i < FD_SETSIZE; ++i) client[i] = -1; /* inicializa todos os índices do vetor de clientes como estando inativos */
+    loop->add(listenfd);
 
-    FD_ZERO(&allset); /* zera todos os bits de allset */
+    /*
+       descritor de reserva: quando os descritores acabam, ele é fechado para tirar da fila
+       (e fechar) a conexão pendente. Sem isso a conexão ficaria na fila e o socket de escuta
+       continuaria pronto: por nível o loop giraria sem parar, por borda as pendentes não
+       seriam avisadas de novo. Caso nem a reserva baste (limite do sistema), o socket de
+       escuta deixa de ser observado até algum cliente sair
+    */
+    int spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    bool listening = true, exhausted = false;
 
-    FD_SET(listenfd, &allset); /* seta o bit listenfd de allset */
+    char buf[MAXLINE + 1]; /* + 1 para o terminador escrito pelo sock::Read */
+    int ready[REACTOR_BATCH];
 
     /* 
        Servidor entra em um loop infinito esperando por novas requisições dos clientes
+       (até receber SIGINT/SIGTERM)
     */
-    for ( ; ; ) {
-        int i;
+    while (!stopRequested) {
+        int nready;
 
-        rset = allset; /* atribuição da estrutura */
-        nready = sock::Select(maxfd + 1, &rset);
+        {
+            TRACE_SPAN(StageSelect, -1);
 
-        if (FD_ISSET(listenfd, &rset)) { /* nova conexão de cliente */
-            /* quando uma requisição for recebida, servidor a aceita */
-            int connfd = Accept(listenfd, &clientaddr);      
+            nready = loop->wait(ready, REACTOR_BATCH);
+        }
 
-            /* pega informações do socket do cliente */
-            char *user_data = sock::sock_ntop((struct sockaddr *) &clientaddr.addr, sizeof(clientaddr.addr));
+        /* relatório de syscalls pedido pelo SIGUSR1 */
+        IOSTAT_POLL(STDERR_FILENO);
 
-            printf("Client: %s\n", user_data);
+        for (int k = 0; k < nready; ++k) {
+            int sockfd = ready[k];
 
-            /* informa que o file descriptor na posição i agora está ativo (e relacionado com o cliente i) */
-            for (i = 0; i < FD_SETSIZE; ++i) {
-                if (client[i] < 0) {
-                    client[i] = connfd; /* salva descritor */
-                    break;
-                }
-            }
+            if (sockfd == listenfd) { /* novas conexões de clientes */
+                int connfd;
 
-            /* verifica se o número máximo de conexões foi atingido. */
-            if (i == FD_SETSIZE) {
-                perror("too many clients");
+                TRACE_SPAN(StageAccept, listenfd);
 
-                exit(1);
-            }
+                while ((connfd = sock::TryAccept(listenfd, &clientaddr)) != -1) {
+                    if (connfd == ACCEPT_EXHAUSTED) {
+                        /* avisa uma vez por episódio, não a cada conexão */
+                        if (!exhausted) LOG_WARN("descritores esgotados: novas conexões são fechadas até algum cliente sair");
 
-            /* seta o bit connfd na variável allset */
-            FD_SET(connfd, &allset);
+                        exhausted = true;
 
-            /* verifica o índice do maior file descriptor aberto e o atualiza em maxfd */
-            if (connfd > maxfd) maxfd = connfd;
+                        if (spare >= 0) close(spare);
 
-            /* verifica o indíce do maior cliente aberto e o atualiza em maxi */
-            if (i > maxi) maxi = i;
+                        if ((connfd = sock::TryAccept(listenfd, NULL)) >= 0) sock::Close(connfd);
 
-            if (--nready <= 0) continue;    /* não há mais descritores prontos para leitura. continua para a próxima iteração do loop. */
-        }
+                        spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+                        if (connfd == ACCEPT_EXHAUSTED) {
+                            loop->remove(listenfd);
+
+                            listening = false;
+                        }
+
+                        /* sem descritores o accept falha mesmo com a fila vazia: só continua enquanto houver conexões */
+                        if (connfd < 0) break;
 
-        /* itera sobre todos os descritores abertos (igual ao numero total de clientes ativos)
-            e busca o descritor do cliente que possui algum conteúdo a ser lido */
-        for (i = 0; i <= maxi; ++i) {
-            int n, sockfd;
+                        continue;
+                    }
 
-            /* verifica se o descritor i está ativo */
-            if ((sockfd = client[i]) < 0) continue;
+                    if (exhausted) {
+                        LOG_INFO("descritores liberados: aceitando conexões de novo");
 
-            /* se estiver ativo, verifica se possui algum conteúdo pronto para ser lido */
-            if (FD_ISSET(sockfd, &rset)) {
-                /* Lê o conteúdo do sockfd, e envia o conteúdo lido de volta para o cliente */
-                if ((n = sock::Read(sockfd, buf, MAX_LINE)) == 0) {
+                        exhausted = false;
+                    }
+
+                    /* o select só comporta descritores menores que FD_SETSIZE */
+                    if (!loop->add(connfd)) {
+                        LOG_WARN("too many clients: conexão recusada");
+
+                        sock::Close(connfd);
+
+                        continue;
+                    }
+
+                    /* pega informações do socket do cliente */
+                    char *user_data = sock::sock_ntop((struct sockaddr *) &clientaddr.addr, sizeof(clientaddr.addr));
+
+                    LOG_INFO("Client: %s", user_data);
+                }
+
+                continue;
+            }
+
+            /* os eventos de trace a seguir (leitura e eco) formam uma requisição */
+            TRACE_REQUEST(sockfd);
+
+            /*
+                Lê o conteúdo do sockfd e envia o conteúdo lido de volta para o cliente; por borda,
+                lê até não haver mais nada, pois o descritor só será entregue de novo com dados novos
+            */
+            while (true) {
+                int n = edge ? sock::TryRead(sockfd, buf, MAX_LINE) : sock::Read(sockfd, buf, MAX_LINE);
+
+                if (n < 0) break;   /* esvaziado (só por borda) */
+
+                if (n == 0) {
                     /* caso nenhum caracter seja lido, então o cliente fechou a conexão (FIN enviado). então o servidor
                     também fecha a conexão (envia FIN). */
+                    loop->remove(sockfd);
+
                     sock::Close(sockfd);
 
-                    FD_CLR(sockfd, &allset); /* limpa os bits de allset */
+                    /* um descritor livre: recupera a reserva e volta a escutar */
+                    if (spare < 0) spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+                    if (!listening) {
+                        loop->add(listenfd);
+
+                        listening = true;
+                    }
+
+                    break;
+                }
+
+                {
+                    TRACE_SPAN(StageHandle, sockfd);
 
-                    client[i] = -1; /* informa que o cliente i não está mais ativo */
-                } else {
-                    sock::Write(sockfd, buf, n); /* do contrário, caso haja algo lido pelo servidor do sockfd, então
-                    rebate o conteúdo lido de volta para o cliente */
+                    sock::Write(sockfd, buf, n); /* rebate o conteúdo lido de volta para o cliente */
                 }
 
-                if (--nready <= 0) break;   /* não há mais descritores prontos para leitura. para loop então */
+                if (!edge) break;   /* por nível, o restante é entregue na próxima espera */
             }
+
+            TRACE_REQUEST_END();
         }
     }
+
+    delete loop;
    
     return(0);
 }
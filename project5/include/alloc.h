@@ -0,0 +1,126 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <socket.h>
+
+#include <new>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+    Contabilidade de alocações no heap.
+
+    Substitui os operator new/delete globais do programa (este header deve ser
+    incluído por um único arquivo .cpp) por versões que contam alocações e
+    bytes por escopo: um escopo para cada tipo de mensagem (MessageStatus)
+    e alguns extras para o restante do loop. O servidor marca o escopo atual
+    antes de tratar cada evento.
+
+    Depois da inicialização (alloc::steady = true) o loop não deveria alocar
+    nada; com alloc::strict ligado, qualquer alocação nesse estado aborta o
+    programa indicando o escopo responsável.
+
+    O escopo é de cada thread e os contadores são atômicos: uma thread que não
+    faz parte do que é medido (o log, os workers, os clientes do
+    bin/simulador.o) chama alloc::exemptThread() ao começar e fica fora das
+    contas, sem disputar os contadores com o loop.
+*/
+#define NUM_ALLOC_SCOPES (NUM_MSG_TYPES + 6)
+
+namespace alloc {
+    enum Scope {
+        ScopeAccept = NUM_MSG_TYPES,    // nova conexão / desconexão
+        ScopeMesh,                      // mensagens de outros shards
+        ScopeFlush,                     // trabalho no fim da iteração (listas, presença, anúncios, gossip)
+        ScopeWait,                      // select e leitura do tipo de cada mensagem
+        ScopeWork,                      // jogadas do bot e tarefas concluídas pelos workers
+        ScopeStartup                    // inicialização (pools e tabelas)
+    };
+
+    thread_local int scope = ScopeStartup;
+    thread_local bool exempt = false;
+    std::atomic<bool> steady(false);
+    std::atomic<bool> strict(false);
+
+    std::atomic<long long> count[NUM_ALLOC_SCOPES];
+    std::atomic<long long> bytes[NUM_ALLOC_SCOPES];
+
+    /* tira a thread atual das contas (ver logger::onThreadStart e sched::onThreadStart) */
+    void exemptThread() {
+        exempt = true;
+    }
+
+    const char *scopeName(int s) {
+        switch (s) {
+            case ScopeAccept: return "Accept/Close";
+            case ScopeMesh: return "Mesh";
+            case ScopeFlush: return "Flush";
+            case ScopeWait: return "Wait";
+            case ScopeWork: return "Work";
+            case ScopeStartup: return "Startup";
+        }
+
+        return sock::messageName(s);
+    }
+
+    /* alocações feitas depois da inicialização */
+    long long steadyCount() {
+        long long total = 0;
+
+        for (int i = 0; i < NUM_ALLOC_SCOPES; ++i) {
+            if (i != ScopeStartup) total += count[i].load(std::memory_order_relaxed);
+        }
+
+        return total;
+    }
+
+    void report(FILE *fp) {
+        fprintf(fp, "alocações por escopo (escopo: alocações / bytes)\n");
+
+        for (int i = 0; i < NUM_ALLOC_SCOPES; ++i) {
+            long long n = count[i].load(std::memory_order_relaxed);
+
+            if (n > 0) fprintf(fp, "  %-16s %10lld / %lld\n", scopeName(i), n, bytes[i].load(std::memory_order_relaxed));
+        }
+
+        fprintf(fp, "  alocações depois da inicialização: %lld\n", steadyCount());
+        fflush(fp);
+    }
+
+    void *allocate(size_t size) {
+        if (exempt) {
+            void *ptr = malloc(size ? size : 1);
+
+            if (ptr == NULL) throw std::bad_alloc();
+
+            return ptr;
+        }
+
+        int s = (scope >= 0 && scope < NUM_ALLOC_SCOPES) ? scope : ScopeFlush;
+
+        count[s].fetch_add(1, std::memory_order_relaxed);
+        bytes[s].fetch_add((long long) size, std::memory_order_relaxed);
+
+        if (strict && steady) {
+            fprintf(stderr, "alocação de %zu bytes no loop (escopo %s)\n", size, scopeName(s));
+            abort();
+        }
+
+        void *ptr = malloc(size ? size : 1);
+
+        if (ptr == NULL) throw std::bad_alloc();
+
+        return ptr;
+    }
+}
+
+void *operator new(size_t size) { return alloc::allocate(size); }
+
+void *operator new[](size_t size) { return alloc::allocate(size); }
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+
+void operator delete[](void *ptr) noexcept { free(ptr); }
+
+#endif
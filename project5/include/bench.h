@@ -0,0 +1,144 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#define BENCH_MIN_NS 200000000LL    /* tempo mínimo de medição de cada caso */
+
+/*
+    Microbenchmarks (make bench).
+
+    Cada caso é uma função que executa a operação medida `n` vezes; run() a
+    chama com `n` crescente até que uma chamada dure BENCH_MIN_NS e registra
+    o tempo por operação. O caso tem um nome ("lista/codifica", ...), um
+    parâmetro (tamanho da lista, da mensagem, ...; 0 caso não tenha) e os
+    bytes que cada operação transfere (0 caso não se aplique).
+
+    Sem argumentos o resultado sai como tabela, à medida que os casos
+    terminam; com "json" sai no fim um único objeto JSON (projeto, compilador,
+    flags e a lista de casos), para ser guardado e comparado entre builds.
+    Um segundo argumento filtra os casos pelo nome (substring).
+*/
+namespace bench {
+    long long now() {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    /* impede que o compilador descarte um resultado que nunca é lido */
+    template <typename T>
+    void keep(const T &value) {
+        asm volatile("" : : "r"(&value) : "memory");
+    }
+
+    class Result {
+        public:
+            std::string name;
+            long long param, ops;
+            double nsPerOp, bytesPerOp;
+    };
+
+    class Suite {
+        public:
+            const char *project;
+            const char *filter;
+            bool json;
+            std::vector<Result> results;
+
+            Suite(const char *name, int argc, char **argv) : project(name), filter(NULL), json(false) {
+                int arg = 1;
+
+                if (argc > arg && strcmp(argv[arg], "json") == 0) {
+                    json = true;
+                    ++arg;
+                }
+
+                if (argc > arg) filter = argv[arg];
+
+                if (!json) printf("  %-28s %10s %14s %14s %12s\n", "caso", "param", "ops", "ns/op", "MB/s");
+            }
+
+            template <typename Op>
+            void run(const char *name, long long param, double bytesPerOp, Op op) {
+                if (filter != NULL && strstr(name, filter) == NULL) return;
+
+                long long n = 1, elapsed;
+
+                op(1);  // aquecimento
+
+                while (true) {
+                    long long start = now();
+
+                    op(n);
+
+                    elapsed = now() - start;
+
+                    if (elapsed >= BENCH_MIN_NS || n >= (1LL << 40)) break;
+
+                    /* próxima tentativa: o suficiente para passar do mínimo, sem crescer mais que 100 vezes */
+                    long long next = (elapsed > 0) ? (long long) (n * 1.2 * BENCH_MIN_NS / elapsed) : n * 100;
+
+                    n = (next > n * 100) ? n * 100 : (next > n ? next : n + 1);
+                }
+
+                Result result;
+
+                result.name = name;
+                result.param = param;
+                result.ops = n;
+                result.nsPerOp = (double) elapsed / n;
+                result.bytesPerOp = bytesPerOp;
+
+                results.push_back(result);
+
+                if (!json) {
+                    printf("  %-28s %10lld %14lld %14.2f %12.1f\n", name, param, n, result.nsPerOp, (bytesPerOp > 0) ? bytesPerOp * 1e3 / result.nsPerOp : 0.0);
+                    fflush(stdout);
+                }
+            }
+
+            void finish() {
+                if (!json) return;
+
+                printf("{\n  \"project\": \"%s\",\n  \"compiler\": \"%s\",\n  \"flags\": [", project, __VERSION__);
+
+                const char *flags[] = {
+#ifdef __OPTIMIZE__
+                    "optimize",
+#endif
+#ifdef TRACE_ENABLED
+                    "TRACE_ENABLED",
+#endif
+#ifdef IOSTAT_ENABLED
+                    "IOSTAT_ENABLED",
+#endif
+                    NULL
+                };
+
+                for (int i = 0; flags[i] != NULL; ++i) printf("%s\"%s\"", (i > 0) ? ", " : "", flags[i]);
+
+                printf("],\n  \"results\": [\n");
+
+                for (size_t i = 0; i < results.size(); ++i) {
+                    Result &r = results[i];
+
+                    printf("    {\"name\": \"%s\", \"param\": %lld, \"ops\": %lld, \"ns_per_op\": %.3f, \"bytes_per_op\": %.1f}%s\n",
+                           r.name.c_str(), r.param, r.ops, r.nsPerOp, r.bytesPerOp, (i + 1 < results.size()) ? "," : "");
+                }
+
+                printf("  ]\n}\n");
+                fflush(stdout);
+            }
+    };
+}
+
+#endif
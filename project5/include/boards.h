@@ -0,0 +1,138 @@
+#ifndef BOARDS_H
+#define BOARDS_H
+
+#include <game.h>
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include <vector>
+
+#define BOARDS_LANES 16     /* tabuleiros por vetor AVX2 (16 bits por tabuleiro) */
+
+/*
+    Vencedor de muitos tabuleiros de uma vez.
+
+    Cada tabuleiro vira duas máscaras de 9 bits (bit i = célula i), uma por
+    jogador, e uma linha vencedora é uma máscara de 3 bits: o jogador venceu
+    se (máscara & linha) == linha para alguma das 8. Guardadas em vetores
+    separados (todas as máscaras de X, todas as de O), 16 delas cabem num
+    registrador AVX2 e as 8 linhas são testadas nos 16 tabuleiros com 16
+    instruções. Sem AVX2 (detectado na primeira chamada) o mesmo teste é
+    feito um tabuleiro por vez.
+
+    Para tabuleiros de partidas válidas o resultado é o de test_board; num
+    tabuleiro em que os dois jogadores têm uma linha (impossível numa
+    partida) X é o vencedor.
+*/
+namespace boards {
+    /* as linhas de winningLines como máscaras */
+    static const uint16_t lineMasks[8] = {0x007, 0x038, 0x1c0, 0x049, 0x092, 0x124, 0x111, 0x054};
+
+    /* máscara das células de `player` */
+    inline uint16_t maskOf(const char *board, char player) {
+        uint16_t mask = 0;
+
+        for (int cell = 0; cell < 9; ++cell) {
+            if (board[cell] == player) mask |= (uint16_t) (1 << cell);
+        }
+
+        return mask;
+    }
+
+    inline bool wins(uint16_t mask) {
+        for (int i = 0; i < 8; ++i) {
+            if ((mask & lineMasks[i]) == lineMasks[i]) return true;
+        }
+
+        return false;
+    }
+
+    inline char winner(uint16_t xs, uint16_t os) {
+        return wins(xs) ? Player1 : (wins(os) ? Player2 : NoPlayer);
+    }
+
+    void evaluateScalar(const uint16_t *xs, const uint16_t *os, char *winners, int n) {
+        for (int i = 0; i < n; ++i) winners[i] = winner(xs[i], os[i]);
+    }
+
+    __attribute__((target("avx2")))
+    void evaluateAvx2(const uint16_t *xs, const uint16_t *os, char *winners, int n) {
+        const __m256i playerX = _mm256_set1_epi16(Player1), playerO = _mm256_set1_epi16(Player2), nobody = _mm256_set1_epi16(NoPlayer);
+        int i = 0;
+
+        for (; i + BOARDS_LANES <= n; i += BOARDS_LANES) {
+            __m256i x = _mm256_loadu_si256((const __m256i *) (xs + i));
+            __m256i o = _mm256_loadu_si256((const __m256i *) (os + i));
+            __m256i winX = _mm256_setzero_si256(), winO = _mm256_setzero_si256();
+
+            for (int k = 0; k < 8; ++k) {
+                __m256i line = _mm256_set1_epi16((short) lineMasks[k]);
+
+                winX = _mm256_or_si256(winX, _mm256_cmpeq_epi16(_mm256_and_si256(x, line), line));
+                winO = _mm256_or_si256(winO, _mm256_cmpeq_epi16(_mm256_and_si256(o, line), line));
+            }
+
+            /* X tem prioridade; cada lane de 16 bits fica com o caractere do vencedor */
+            __m256i result = _mm256_blendv_epi8(_mm256_blendv_epi8(nobody, playerO, winO), playerX, winX);
+
+            /* 16 lanes de 16 bits para 16 bytes: packus intercala as metades, o permute as junta */
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(result, result), 0x08);
+
+            _mm_storeu_si128((__m128i *) (winners + i), _mm256_castsi256_si128(packed));
+        }
+
+        evaluateScalar(xs + i, os + i, winners + i, n - i);
+    }
+
+    bool hasAvx2() {
+        static int supported = -1;
+
+        if (supported < 0) supported = __builtin_cpu_supports("avx2") ? 1 : 0;
+
+        return supported == 1;
+    }
+
+    /* winners[i] = vencedor do tabuleiro (xs[i], os[i]) */
+    void evaluate(const uint16_t *xs, const uint16_t *os, char *winners, int n) {
+        if (hasAvx2()) {
+            evaluateAvx2(xs, os, winners, n);
+        } else {
+            evaluateScalar(xs, os, winners, n);
+        }
+    }
+
+    /* tabuleiros a avaliar juntos, com a capacidade reservada em init() */
+    class Batch {
+        public:
+            std::vector<uint16_t> xs, os;
+            std::vector<int> owners;    // de quem é cada tabuleiro (slot, ...)
+            std::vector<char> winners;
+            int size;
+
+            Batch() : size(0) {}
+
+            void init(int capacity) {
+                xs.assign(capacity, 0);
+                os.assign(capacity, 0);
+                owners.assign(capacity, -1);
+                winners.assign(capacity, NoPlayer);
+                size = 0;
+            }
+
+            bool full() { return size == (int) xs.size(); }
+
+            void clear() { size = 0; }
+
+            void add(int owner, uint16_t x, uint16_t o) {
+                xs[size] = x;
+                os[size] = o;
+                owners[size] = owner;
+                ++size;
+            }
+
+            void evaluate() { boards::evaluate(&xs[0], &os[0], &winners[0], size); }
+    };
+}
+
+#endif
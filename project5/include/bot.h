@@ -0,0 +1,295 @@
+#ifndef BOT_H
+#define BOT_H
+
+#include <socket.h>
+#include <lobby.h>
+#include <game.h>
+#include <boards.h>
+#include <scheduler.h>
+
+#include <vector>
+
+#define ARENA_BATCH 64  /* jogadas lidas do socket UDP (e tabuleiros avaliados juntos) por iteração do loop */
+
+/*
+    Adversário jogado pelo servidor (NewGameMsg para BOT_PEER).
+
+    O servidor responde o convite com um AcceptMsg cujo endereço é o do seu
+    socket UDP de partidas, e o cliente joga exatamente como contra outro
+    cliente: as jogadas vão e voltam como "linha coluna". O servidor mantém o
+    tabuleiro de cada partida, recusa jogadas fora de vez ou em células
+    ocupadas, e o resultado que vale no FinishGame é o do seu tabuleiro.
+
+    A resposta do bot (minimax com poda alfa-beta) é uma tarefa do
+    escalonador (include/scheduler.h), executada fora do loop quando há
+    workers; a partida guarda uma geração para que uma resposta que chegue
+    depois do fim da partida seja descartada.
+
+    As jogadas que chegaram juntas são lidas de uma vez (até ARENA_BATCH),
+    e os tabuleiros que elas alteraram são avaliados num único lote
+    (include/boards.h). Os tabuleiros também são mantidos como máscaras de
+    bits, e o minimax trabalha sobre elas.
+*/
+namespace bot {
+    /*
+        valor do tabuleiro para o bot (células em `mine`; as do cliente em `theirs`), com o
+        bot a jogar caso `myTurn`: +10/-10 (vitória/derrota, antes é melhor) ou 0
+    */
+    int minimax(uint16_t mine, uint16_t theirs, bool myTurn, int depth, int alpha, int beta) {
+        if (boards::wins(mine)) return 10 - depth;
+        if (boards::wins(theirs)) return depth - 10;
+
+        uint16_t empty = (uint16_t) (~(mine | theirs) & 0x1ff);
+
+        if (empty == 0) return 0;
+
+        for (int cell = 0; cell < 9; ++cell) {
+            uint16_t bit = (uint16_t) (1 << cell);
+
+            if (!(empty & bit)) continue;
+
+            int value = myTurn ? minimax(mine | bit, theirs, false, depth + 1, alpha, beta)
+                               : minimax(mine, theirs | bit, true, depth + 1, alpha, beta);
+
+            if (myTurn && value > alpha) alpha = value;
+            if (!myTurn && value < beta) beta = value;
+
+            if (alpha >= beta) break;
+        }
+
+        return myTurn ? alpha : beta;
+    }
+
+    /* melhor célula para `me` jogar; -1 caso o tabuleiro esteja cheio */
+    int bestMove(const char *position, char me) {
+        uint16_t mine = boards::maskOf(position, me);
+        uint16_t theirs = boards::maskOf(position, (me == Player1) ? Player2 : Player1);
+        int best = -1, bestValue = -100;
+
+        for (int cell = 0; cell < 9; ++cell) {
+            uint16_t bit = (uint16_t) (1 << cell);
+
+            if ((mine | theirs) & bit) continue;
+
+            int value = minimax(mine | bit, theirs, false, 1, -100, 100);
+
+            if (value > bestValue) {
+                best = cell;
+                bestValue = value;
+            }
+        }
+
+        return best;
+    }
+
+    /* tarefa: data[0..8] é o tabuleiro, data[9] o símbolo do bot; a jogada escolhida volta em data[10] */
+    void think(sched::Task &task) {
+        task.data[10] = (char) bestMove(task.data, task.data[9]);
+    }
+
+    class Match {
+        public:
+            bool active;
+            char board[9];
+            uint16_t xs, os;        // o tabuleiro como máscaras (include/boards.h)
+            char me;                // símbolo do bot
+            char winner;            // atualizado depois de cada jogada
+            int moves, generation;
+            sock::SocketAddr peer;  // socket UDP do cliente
+
+            Match() : active(false), xs(0), os(0), me(NoPlayer), winner(NoPlayer), moves(0), generation(0), peer(0, 0, 0) {}
+
+            char turn() { return (moves % 2 == 0) ? Player1 : Player2; }
+
+            bool over() { return winner != NoPlayer || moves == 9; }
+
+            void reset() {
+                for (int i = 0; i < 9; ++i) board[i] = NoPlayer;
+
+                xs = os = 0;
+                winner = NoPlayer;
+                moves = 0;
+            }
+
+            /* joga na célula; o vencedor fica para quem avalia o tabuleiro */
+            void play(int cell) {
+                board[cell] = turn();
+
+                if (board[cell] == Player1) {
+                    xs |= (uint16_t) (1 << cell);
+                } else {
+                    os |= (uint16_t) (1 << cell);
+                }
+
+                ++moves;
+            }
+    };
+
+    class Arena {
+        public:
+            int fd, port;
+            std::vector<Match> matches;     // indexado pelo slot do cliente
+            lobby::IndexSet active;
+            boards::Batch batch;            // tabuleiros alterados pelas jogadas lidas numa iteração
+
+            Arena() : fd(-1), port(0) {}
+
+            /* socket UDP das partidas, numa porta efêmera */
+            void open() {
+                sock::SocketAddr addr(AF_INET, (int) INADDR_ANY, 0);
+                socklen_t len = sizeof(addr.addr);
+
+                fd = sock::Socket(AF_INET, SOCK_DGRAM, 0);
+
+                sock::Bind(fd, &addr);
+
+                getsockname(fd, (struct sockaddr *) &addr.addr, &len);
+
+                port = ntohs(addr.addr.sin_port);
+
+                matches.assign(FD_SETSIZE, Match());
+                active.init(FD_SETSIZE);
+                batch.init(ARENA_BATCH);
+            }
+
+            bool playing(int slot) { return active.has(slot); }
+
+            /*
+                endereço que o cliente da conexão `sockfd` usa para falar com o bot: o IP
+                local dessa conexão (que o cliente sabe alcançar) e a porta das partidas
+            */
+            void address(int sockfd, schema::Endpoint &out) {
+                struct sockaddr_in local;
+                socklen_t len = sizeof(local);
+
+                local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+                getsockname(sockfd, (struct sockaddr *) &local, &len);
+
+                memset(&out, 0, sizeof(out));
+
+                out.family = 4;
+                memcpy(out.addr, &local.sin_addr, sizeof(local.sin_addr));
+                out.port = htons((unsigned short) port);
+            }
+
+            /* pede a jogada do bot: a um worker ou, sem workers livres, aqui mesmo */
+            void think(int slot, sched::Scheduler &workers) {
+                Match &match = matches[slot];
+                sched::Task task;
+
+                task.run = bot::think;
+                task.owner = slot;
+                task.tag = match.generation;
+
+                memcpy(task.data, match.board, sizeof(match.board));
+                task.data[9] = match.me;
+
+                if (workers.submit(task)) return;
+
+                workers.runInline(task);
+
+                reply(task);
+            }
+
+            /* começa uma partida contra o cliente do slot `slot`, cujo socket UDP está em `peer` */
+            void start(int slot, const schema::Endpoint &peer, bool botFirst, sched::Scheduler &workers) {
+                Match &match = matches[slot];
+
+                match.active = true;
+                match.me = botFirst ? Player1 : Player2;
+                match.peer = sock::endpointAddr(peer);
+
+                match.reset();
+
+                active.insert(slot);
+
+                if (botFirst) think(slot, workers);
+            }
+
+            /* a partida acabou (ou o cliente saiu): respostas pendentes do bot serão descartadas */
+            void end(int slot) {
+                if (!active.has(slot)) return;
+
+                matches[slot].active = false;
+                ++matches[slot].generation;
+
+                active.erase(slot);
+            }
+
+            /* pontos do cliente segundo o tabuleiro do servidor */
+            int score(int slot) {
+                Match &match = matches[slot];
+
+                return (match.winner != NoPlayer && match.winner != match.me) ? 1 : 0;
+            }
+
+            /* jogadas dos clientes que chegaram no socket UDP: aplicadas, avaliadas em lote, e o bot responde */
+            void receive(sched::Scheduler &workers) {
+                char move[MAX_LINE];
+                sock::SocketAddr from(0, 0, 0);
+
+                batch.clear();
+
+                for (int n = 0; n < ARENA_BATCH && sock::TryRecvfrom(fd, move, MAX_LINE - 1, &from) >= 0; ++n) {
+                    int slot = find(from);
+
+                    if (slot < 0) continue;
+
+                    Match &match = matches[slot];
+                    int cell = parseMove(move);
+
+                    /* só vale a jogada do cliente na vez dele, numa célula vazia */
+                    if (match.over() || match.turn() == match.me || cell < 0 || match.board[cell] != NoPlayer) continue;
+
+                    match.play(cell);
+
+                    batch.add(slot, match.xs, match.os);
+                }
+
+                batch.evaluate();
+
+                for (int k = 0; k < batch.size; ++k) {
+                    Match &match = matches[batch.owners[k]];
+
+                    match.winner = batch.winners[k];
+
+                    if (!match.over()) think(batch.owners[k], workers);
+                }
+            }
+
+            /* slot da partida cujo cliente está em `from`; -1 caso nenhuma */
+            int find(sock::SocketAddr &from) {
+                for (int k = 0; k < active.size; ++k) {
+                    Match &match = matches[active[k]];
+
+                    if (match.peer.addr.sin_addr.s_addr == from.addr.sin_addr.s_addr && match.peer.addr.sin_port == from.addr.sin_port) return active[k];
+                }
+
+                return -1;
+            }
+
+            /* jogada calculada pelo bot: aplica e envia ao cliente */
+            void reply(sched::Task &task) {
+                int slot = task.owner, cell = task.data[10];
+
+                if (slot < 0 || slot >= (int) matches.size()) return;
+
+                Match &match = matches[slot];
+
+                if (!match.active || match.generation != task.tag || match.turn() != match.me || cell < 0 || match.board[cell] != NoPlayer) return;
+
+                char move[4];
+
+                match.play(cell);
+
+                match.winner = boards::winner(match.xs, match.os);
+
+                formatMove(cell, move);
+
+                sock::Sendto(fd, move, &match.peer);
+            }
+    };
+}
+
+#endif
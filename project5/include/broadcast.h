@@ -0,0 +1,84 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <socket.h>
+#include <lobby.h>
+#include <shard.h>
+
+#include <vector>
+#include <sys/uio.h>
+
+/*
+    Canal de anúncios do lobby.
+
+    Os BroadcastMsg recebidos durante uma iteração do loop são codificados uma
+    única vez num só buffer (já no formato enviado aos clientes). No fim da
+    iteração o buffer é enviado a cada conexão com um único sendmsg não
+    bloqueante (sock::Writev), a única syscall por destinatário.
+
+    Um destinatário cujo buffer de envio do kernel está cheio perde os anúncios
+    deste lote: anúncios são descartáveis, e assim um cliente lento nunca
+    bloqueia o loop nem atrasa o tráfego de jogo. Se só parte do lote coube, a
+    conexão ficou com uma mensagem pela metade e é derrubada (sock::Shutdown);
+    o loop a fecha quando ler o fim dela.
+
+    Há um lote por sala, enviado só aos membros locais da sala.
+*/
+namespace broadcast {
+    class Batch {
+        public:
+            std::vector<char> buf;
+            int count;
+            long long sent, dropped;    /* destinatários que receberam o lote e que o perderam */
+
+            Batch() : count(0), sent(0), dropped(0) {
+                buf.reserve(MAX_BROADCAST_BATCH);
+            }
+
+            bool empty() { return count == 0; }
+
+            /* retorna falso caso o lote já esteja cheio */
+            bool add(int senderId, const char *text, int len) {
+                if ((int) buf.size() + BROADCAST_HEADER_SIZE + len > MAX_BROADCAST_BATCH) return false;
+
+                size_t pos = buf.size();
+
+                buf.resize(pos + BROADCAST_HEADER_SIZE + len);
+
+                sock::encodeBroadcastMsg(&buf[pos], senderId, text, len);
+
+                ++count;
+
+                return true;
+            }
+
+            /* envia o lote aos membros de `members` que estão conectados a este shard */
+            void fanOut(int *client, lobby::IndexSet &members, shard::Mesh &mesh) {
+                struct iovec iov;
+
+                iov.iov_base = &buf[0];
+                iov.iov_len = buf.size();
+
+                for (int i = 0; i < members.size; ++i) {
+                    int slot = mesh.slotOf(members[i]);
+
+                    if (slot < 0 || client[slot] < 0) continue;
+
+                    int n = sock::Writev(client[slot], &iov, 1);
+
+                    if (n == (int) buf.size()) {
+                        ++sent;
+                    } else {
+                        if (n > 0) sock::Shutdown(client[slot]);
+
+                        ++dropped;
+                    }
+                }
+
+                buf.clear();
+                count = 0;
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <socket.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+#define CAPTURE_MAGIC 0x3150434c        /* "LCP1" */
+#define CAPTURE_VERSION 3               /* 2: UpdateList e AcceptMsg compactos; 3: fichas de sessão de 64 bits */
+#define CAPTURE_CHUNK 65536             /* bytes de um registro antes de gravá-lo */
+#define CAPTURE_FILE_BUFFER (1 << 20)   /* buffer do stdio para o arquivo */
+#define CAPTURE_FLUSH_MS 1000
+
+/*
+    Captura do tráfego dos clientes (LOBBY_CAPTURE=<caminho>), para ser
+    reproduzido depois pelo bin/replay.o.
+
+    Cada conexão de cliente recebe um número, e o arquivo guarda, com o
+    instante em microssegundos desde o início da captura, a abertura e o
+    fechamento de cada conexão e os bytes lidos (Input) e escritos (Output)
+    nela. Os bytes são observados em sock::Read/Write/Writev (os ganchos
+    sock::inputHook/outputHook) e os trechos consecutivos da mesma conexão e
+    direção viram um único registro, normalmente uma mensagem inteira. Nada
+    é alocado no loop: os registros passam por um buffer reservado na
+    abertura e pelo buffer do stdio, despejado a cada CAPTURE_FLUSH_MS.
+
+    messageSize() mede cada mensagem, nas duas direções, pelos schemas de
+    sock::msg; é com ela que o replay separa os registros em mensagens.
+*/
+namespace capture {
+    enum Kind : uint8_t {
+        Open,
+        Close,
+        Input,      // cliente -> servidor
+        Output      // servidor -> cliente
+    };
+
+    struct Header {
+        uint32_t magic, version;
+    };
+
+    /* seguido por `len` bytes */
+    struct Record {
+        int64_t timeUs;
+        int32_t conn;
+        uint8_t kind;
+        uint8_t reserved[3];
+        uint32_t len;
+    };
+
+    class Recorder {
+        public:
+            FILE *fp;
+            std::vector<char> fileBuffer, data;
+            std::vector<int> connOf;        // número da conexão de cada fd (-1 = não capturado)
+            int nextConn;
+            long long start, lastFlush;
+            Record pending;                 // registro em formação; `data` tem os seus bytes
+
+            Recorder() : fp(NULL), nextConn(0), start(0), lastFlush(0) {}
+
+            bool enabled() { return fp != NULL; }
+
+            void open(const char *path) {
+                Header header = {CAPTURE_MAGIC, CAPTURE_VERSION};
+
+                if ((fp = fopen(path, "wb")) == NULL) {
+                    perror("capture open error");
+                    exit(1);
+                }
+
+                fileBuffer.assign(CAPTURE_FILE_BUFFER, 0);
+                setvbuf(fp, &fileBuffer[0], _IOFBF, fileBuffer.size());
+
+                data.reserve(CAPTURE_CHUNK);
+                connOf.assign(FD_SETSIZE, -1);
+
+                memset(&pending, 0, sizeof(pending));
+
+                start = sock::nowUs();
+                lastFlush = sock::nowMs();
+
+                fwrite(&header, sizeof(header), 1, fp);
+            }
+
+            void write(const Record &record, const char *bytes) {
+                fwrite(&record, sizeof(record), 1, fp);
+
+                if (record.len > 0) fwrite(bytes, 1, record.len, fp);
+            }
+
+            void flushPending() {
+                if (pending.len > 0) write(pending, &data[0]);
+
+                pending.len = 0;
+                data.clear();
+            }
+
+            void event(int fd, Kind kind) {
+                if (!enabled() || fd < 0 || fd >= (int) connOf.size()) return;
+
+                if (kind == Open) connOf[fd] = nextConn++;
+
+                if (connOf[fd] < 0) return;
+
+                Record record;
+
+                flushPending();
+
+                memset(&record, 0, sizeof(record));
+
+                record.timeUs = sock::nowUs() - start;
+                record.conn = connOf[fd];
+                record.kind = kind;
+
+                fwrite(&record, sizeof(record), 1, fp);
+
+                if (kind == Close) connOf[fd] = -1;
+            }
+
+            void connect(int fd) { event(fd, Open); }
+
+            void disconnect(int fd) { event(fd, Close); }
+
+            void append(int fd, Kind kind, const char *buf, int len) {
+                if (fd < 0 || fd >= (int) connOf.size() || connOf[fd] < 0) return;
+
+                int conn = connOf[fd];
+
+                if (pending.len > 0 && (pending.conn != conn || pending.kind != kind || data.size() + len > CAPTURE_CHUNK)) flushPending();
+
+                if (pending.len == 0) {
+                    memset(&pending, 0, sizeof(pending));
+
+                    pending.timeUs = sock::nowUs() - start;
+                    pending.conn = conn;
+                    pending.kind = kind;
+                }
+
+                /* maior que o buffer reservado: vai direto para o arquivo */
+                if (len > CAPTURE_CHUNK) {
+                    pending.len = len;
+                    write(pending, buf);
+                    pending.len = 0;
+                    return;
+                }
+
+                data.insert(data.end(), buf, buf + len);
+                pending.len += len;
+            }
+
+            /* fim da iteração do loop: grava o registro em formação e, de tempos em tempos, despeja o arquivo */
+            void flush(long long now) {
+                if (!enabled()) return;
+
+                flushPending();
+
+                if (now - lastFlush >= CAPTURE_FLUSH_MS) {
+                    fflush(fp);
+                    lastFlush = now;
+                }
+            }
+
+            void close() {
+                if (!enabled()) return;
+
+                flushPending();
+
+                fclose(fp);
+                fp = NULL;
+
+                sock::inputHook = sock::outputHook = NULL;
+            }
+    };
+
+    Recorder recorder;
+
+    void onInput(int sockfd, const char *buf, int len) { recorder.append(sockfd, Input, buf, len); }
+
+    void onOutput(int sockfd, const char *buf, int len) { recorder.append(sockfd, Output, buf, len); }
+
+    /* liga a captura: abre o arquivo e passa a observar os sockets */
+    void start(const char *path) {
+        recorder.open(path);
+
+        sock::inputHook = onInput;
+        sock::outputHook = onOutput;
+    }
+
+    /*
+        tamanho da primeira mensagem de `buf` (enviada pelo servidor caso `fromServer`,
+        pelo cliente caso contrário); 0 caso ela ainda esteja incompleta, -1 caso seja inválida
+    */
+    int messageSize(const char *buf, int len, bool fromServer) {
+        using namespace sock;
+
+        if (len < 1) return 0;
+
+        if (fromServer) {
+            switch (buf[0]) {
+                case NewGameMsg: return msg::NewGame::measure(buf, len);
+                case AcceptMsg: return msg::Accept::measure(buf, len);
+                case DenyMsg: return msg::Deny::measure(buf, len);
+                case UpdateList: return msg::ListOfClients::measure(buf, len);
+                case PresenceMsg: return msg::Presence::measure(buf, len);
+                case BroadcastMsg: return msg::Broadcast::measure(buf, len);
+                case SessionMsg: return msg::Session::measure(buf, len);
+                case RoomMsg: return msg::Room::measure(buf, len);
+                case PingMsg: return msg::Ping::measure(buf, len);
+            }
+        } else {
+            switch (buf[0]) {
+                case NewGameMsg: return msg::NewGame::measure(buf, len);
+                case AcceptMsg: return msg::AcceptReply::measure(buf, len);
+                case DenyMsg: return msg::DenyReply::measure(buf, len);
+                case UpdateList: return msg::ListRequest::measure(buf, len);
+                case FinishGame: return msg::Finish::measure(buf, len);
+                case SubscribeMsg: return msg::Subscribe::measure(buf, len);
+                case UnsubscribeMsg: return msg::Unsubscribe::measure(buf, len);
+                case BroadcastMsg: return msg::Announce::measure(buf, len);
+                case ResumeMsg: return msg::Resume::measure(buf, len);
+                case RoomMsg: return msg::Room::measure(buf, len);
+                case PingMsg: return msg::Ping::measure(buf, len);
+            }
+        }
+
+        return -1;
+    }
+}
+
+#endif
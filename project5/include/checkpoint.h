@@ -0,0 +1,219 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <socket.h>
+#include <lobby.h>
+#include <shard.h>
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define CHECKPOINT_MAGIC 0x3143424c     /* "LBC1" */
+#define CHECKPOINT_VERSION 4
+#define CHECKPOINT_LOG_SIZE 4096        /* registros de log entre dois checkpoints */
+#define CHECKPOINT_INTERVAL_MS 1000
+
+/*
+    Checkpoint do lobby num arquivo mapeado em memória (LOBBY_CHECKPOINT=<caminho>).
+
+    O arquivo tem duas cópias da tabela de jogadores locais (uma por slot) e um
+    log. A cada CHECKPOINT_INTERVAL_MS (ou quando o log enche) a tabela é
+    copiada para a cópia inativa, e uma única escrita de 64 bits (`commit`:
+    geração e cópia ativa) a torna a atual. Entre dois checkpoints, no fim de
+    cada iteração do loop, os jogadores alterados (Roster::changed) são
+    anexados ao log com a geração atual; um registro só conta depois que
+    logCount avança. Nada disso faz syscalls: são cópias para páginas
+    compartilhadas do arquivo, que sobrevivem à morte do processo (não a uma
+    queda da máquina).
+
+    Para restaurar basta mapear o arquivo, copiar a cópia ativa e reaplicar os
+    registros do log da mesma geração; registros de gerações antigas (de um
+    checkpoint interrompido) são ignorados.
+*/
+namespace checkpoint {
+    class Entry {
+        public:
+            bool present;
+            lobby::Player player;
+            char room[ROOM_NAME_LEN];   // o índice da sala em `player` só vale neste processo
+    };
+
+    class Record {
+        public:
+            uint64_t generation;
+            int slot;
+            Entry entry;
+    };
+
+    class Header {
+        public:
+            int magic, version;
+            int shardId, numShards, numSlots, logSize;
+            uint64_t commit;            // (geração << 1) | cópia ativa
+            int logCount;
+    };
+
+    class Store {
+        public:
+            char *base;
+            size_t size;
+            Header *header;
+            Entry *tables[2];
+            Record *log;
+            int shardId, numShards;
+            long long lastCheckpoint;
+
+            Store() : base(NULL), size(0), header(NULL), log(NULL), shardId(0), numShards(1), lastCheckpoint(0) {}
+
+            bool enabled() { return base != NULL; }
+
+            uint64_t generation() { return header->commit >> 1; }
+
+            int active() { return (int) (header->commit & 1); }
+
+            /*
+                mapeia o arquivo `path` (criando-o caso não exista); retorna verdadeiro
+                caso ele já contenha um checkpoint válido desta configuração de shards
+            */
+            bool open(const char *path, int _shardId, int _numShards) {
+                shardId = _shardId;
+                numShards = _numShards;
+                size = sizeof(Header) + 2 * FD_SETSIZE * sizeof(Entry) + CHECKPOINT_LOG_SIZE * sizeof(Record);
+
+                int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+
+                if (fd < 0 || ftruncate(fd, size) < 0) {
+                    perror("checkpoint open error");
+                    exit(1);
+                }
+
+                if ((base = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+                    perror("checkpoint mmap error");
+                    exit(1);
+                }
+
+                close(fd);
+
+                header = (Header *) base;
+                tables[0] = (Entry *) (base + sizeof(Header));
+                tables[1] = tables[0] + FD_SETSIZE;
+                log = (Record *) (tables[1] + FD_SETSIZE);
+
+                bool valid = header->magic == CHECKPOINT_MAGIC && header->version == CHECKPOINT_VERSION
+                    && header->shardId == shardId && header->numShards == numShards
+                    && header->numSlots == FD_SETSIZE && header->logSize == CHECKPOINT_LOG_SIZE
+                    && header->logCount >= 0 && header->logCount <= CHECKPOINT_LOG_SIZE;
+
+                if (!valid) {
+                    memset(base, 0, sizeof(Header));
+
+                    header->magic = CHECKPOINT_MAGIC;
+                    header->version = CHECKPOINT_VERSION;
+                    header->shardId = shardId;
+                    header->numShards = numShards;
+                    header->numSlots = FD_SETSIZE;
+                    header->logSize = CHECKPOINT_LOG_SIZE;
+                }
+
+                return valid && generation() > 0;
+            }
+
+            void apply(Entry &entry, int slot, lobby::Roster &roster, lobby::IndexSet &restored) {
+                int id = slot * numShards + shardId;
+
+                if (slot < 1 || id >= roster.capacity()) return;
+
+                if (entry.present) {
+                    roster.add(id, entry.player.address);
+
+                    lobby::Player &player = roster.at(id);
+
+                    player.playing = entry.player.playing;
+                    player.score = entry.player.score;
+                    player.session = entry.player.session;
+
+                    entry.room[ROOM_NAME_LEN - 1] = '\0';
+
+                    roster.join(id, roster.findRoom(entry.room, true));
+
+                    restored.insert(slot);
+                } else {
+                    roster.remove(id);
+
+                    restored.erase(slot);
+                }
+            }
+
+            /* copia a tabela ativa e reaplica o log; `restored` recebe os slots dos jogadores restaurados */
+            void restore(lobby::Roster &roster, lobby::IndexSet &restored) {
+                Entry *table = tables[active()];
+                uint64_t gen = generation();
+
+                for (int slot = 0; slot < FD_SETSIZE; ++slot) {
+                    if (table[slot].present) apply(table[slot], slot, roster, restored);
+                }
+
+                for (int i = 0; i < header->logCount; ++i) {
+                    if (log[i].generation == gen && log[i].slot >= 0 && log[i].slot < FD_SETSIZE) apply(log[i].entry, log[i].slot, roster, restored);
+                }
+
+                roster.changed.clear();
+            }
+
+            void fill(Entry &entry, int slot, lobby::Roster &roster) {
+                int id = slot * numShards + shardId;
+
+                entry.present = roster.has(id);
+
+                if (entry.present) {
+                    entry.player = roster.at(id);
+
+                    strcpy(entry.room, roster.roomName(id));
+                }
+            }
+
+            /* copia a tabela inteira para a cópia inativa e a torna a atual */
+            void save(lobby::Roster &roster, long long now) {
+                int next = 1 - active();
+                Entry *table = tables[next];
+
+                for (int slot = 0; slot < FD_SETSIZE; ++slot) fill(table[slot], slot, roster);
+
+                /* a tabela precisa estar completa antes do commit */
+                __atomic_store_n(&header->commit, ((generation() + 1) << 1) | next, __ATOMIC_RELEASE);
+                __atomic_store_n(&header->logCount, 0, __ATOMIC_RELEASE);
+
+                roster.changed.clear();
+
+                lastCheckpoint = now;
+            }
+
+            /* fim da iteração: registra os jogadores locais alterados, ou faz um checkpoint */
+            void journal(lobby::Roster &roster, long long now) {
+                if (now - lastCheckpoint >= CHECKPOINT_INTERVAL_MS || header->logCount + roster.changed.size > CHECKPOINT_LOG_SIZE) {
+                    save(roster, now);
+                    return;
+                }
+
+                for (int i = 0; i < roster.changed.size; ++i) {
+                    int id = roster.changed[i];
+
+                    if (id % numShards != shardId || id / numShards >= FD_SETSIZE) continue;
+
+                    Record &record = log[header->logCount];
+
+                    record.generation = generation();
+                    record.slot = id / numShards;
+
+                    fill(record.entry, record.slot, roster);
+
+                    __atomic_store_n(&header->logCount, header->logCount + 1, __ATOMIC_RELEASE);
+                }
+
+                roster.changed.clear();
+            }
+    };
+}
+
+#endif
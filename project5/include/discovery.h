@@ -0,0 +1,185 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include <socket.h>
+#include <overload.h>
+#include <log.h>
+
+#include <string>
+#include <vector>
+
+#define DISCOVERY_MAGIC 0x4c4f4259      /* "LOBY": descarta datagramas que não são sondas */
+#define DISCOVERY_TIMEOUT_MS 500        /* espera máxima por respostas */
+#define DISCOVERY_GRACE_MS 30           /* depois da primeira resposta, espera pelas outras */
+
+/*
+    Descoberta de servidores do lobby por UDP.
+
+    Cada servidor escuta sondas num socket UDP na mesma porta do TCP e
+    responde com a sua carga: jogadores conectados, capacidade, o estágio
+    de sobrecarga (ver include/overload.h) e a porta TCP. A sonda leva um
+    carimbo (us) que volta na resposta, então o cliente mede o RTT sem
+    guardar nada por candidato. A sonda tem o tamanho da resposta, para que
+    o servidor não sirva de amplificador a quem forjar o endereço de origem.
+
+    O cliente envia as sondas a todos os candidatos de uma vez (endereços
+    de broadcast incluídos) e fica com o servidor menos carregado entre os
+    que responderem; no empate, o de menor RTT. Servidores cheios ou que
+    recusam conexões são ignorados. A espera termina quando todos os
+    candidatos (sem broadcast) responderem, DISCOVERY_GRACE_MS depois da
+    primeira resposta ou em DISCOVERY_TIMEOUT_MS.
+*/
+namespace discovery {
+    typedef schema::Record<schema::Int, schema::Long, schema::Int, schema::Int, schema::Int, schema::Int> Reply;  // magic, carimbo, porta TCP, jogadores, capacidade, estágio
+    typedef schema::Record<schema::Int, schema::Long> Probe;    // magic, carimbo (completada com zeros até Reply::fixed)
+
+    /* lado servidor: socket UDP que responde às sondas */
+    class Responder {
+        public:
+            int fd, tcpPort;
+
+            Responder() : fd(-1), tcpPort(0) {}
+
+            bool enabled() { return fd >= 0; }
+
+            /* escuta na porta `port`; sem descoberta (só um aviso) caso ela esteja ocupada */
+            void open(int port) {
+                sock::SocketAddr addr(AF_INET, (int) INADDR_ANY, port);
+                int reuse = 1;
+
+                tcpPort = port;
+                fd = sock::Socket(AF_INET, SOCK_DGRAM, 0);
+
+                /* o processo que assume o lobby (handoff, reserva) escuta junto até o antigo sair */
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+                setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+
+                if (bind(fd, (struct sockaddr *) &addr.addr, sizeof(addr.addr)) < 0) {
+                    LOG_WARN("descoberta: porta UDP %d ocupada; sondas não serão respondidas", port);
+
+                    sock::Close(fd);
+                    fd = -1;
+                }
+            }
+
+            /* responde todas as sondas que chegaram (um erro de envio só perde aquela resposta) */
+            void answer(int players, int capacity, int level) {
+                char buf[Reply::fixed + 1];
+                sock::SocketAddr from(0, 0, 0);
+                int magic, n;
+                long long stamp;
+
+                while ((n = sock::TryRecvfrom(fd, buf, Reply::fixed, &from)) >= 0) {
+                    if (n < Reply::fixed || Probe::parse(buf, n, magic, stamp) < 0 || magic != DISCOVERY_MAGIC) continue;
+
+                    n = Reply::encode(buf, (int) DISCOVERY_MAGIC, stamp, tcpPort, players, capacity, level);
+
+                    sendto(fd, buf, n, 0, (struct sockaddr *) &from.addr, sizeof(from.addr));
+                }
+            }
+    };
+
+    /* um servidor que respondeu */
+    class Candidate {
+        public:
+            sock::SocketAddr addr;      // endereço TCP
+            int players, capacity, level;
+            long long rtt;
+
+            Candidate() : addr(0, 0, 0), players(0), capacity(0), level(0), rtt(0) {}
+
+            bool available() { return level < overload::Refuse && players < capacity; }
+
+            /* carga relativa, comparada sem divisão */
+            bool lighterThan(const Candidate &other) {
+                long long mine = (long long) players * other.capacity, theirs = (long long) other.players * capacity;
+
+                return mine < theirs || (mine == theirs && rtt < other.rtt);
+            }
+    };
+
+    /* termina em .255: um endereço de broadcast (o da rede ou 255.255.255.255) */
+    bool isBroadcast(sock::SocketAddr &addr) { return (ntohl(addr.addr.sin_addr.s_addr) & 0xff) == 0xff; }
+
+    /* "IP:porta" -> endereço; falso caso não haja porta */
+    bool parseCandidate(const char *text, sock::SocketAddr &addr) {
+        std::string s(text);
+        size_t colon = s.rfind(':');
+
+        if (colon == std::string::npos || colon + 1 == s.size()) return false;
+
+        addr = sock::SocketAddr(AF_INET, s.substr(0, colon).c_str(), atoi(s.c_str() + colon + 1));
+
+        return true;
+    }
+
+    /*
+        sonda os `targets` e escolhe o servidor menos carregado; falso caso nenhum disponível
+        responda a tempo. `broadcast` diz se algum alvo é de broadcast (não dá para saber
+        quantas respostas esperar)
+    */
+    bool choose(std::vector<sock::SocketAddr> &targets, bool broadcast, sock::SocketAddr &chosen) {
+        int fd = sock::Socket(AF_INET, SOCK_DGRAM, 0), on = 1, replies = 0;
+        char buf[Reply::fixed + 1];
+        Candidate best;
+        bool found = false;
+
+        setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+
+        memset(buf, 0, sizeof(buf));
+
+        long long start = sock::nowUs(), deadline = start + DISCOVERY_TIMEOUT_MS * 1000LL;
+
+        Probe::encode(buf, (int) DISCOVERY_MAGIC, start);
+
+        /* todas as sondas saem antes de esperar por qualquer resposta */
+        for (auto &target : targets) {
+            socklen_t len = sizeof(target.addr);
+
+            if (sendto(fd, buf, Reply::fixed, 0, (struct sockaddr *) &target.addr, len) < 0) perror("discovery sendto");
+        }
+
+        while (true) {
+            long long now = sock::nowUs();
+
+            if (now >= deadline || (!broadcast && replies == (int) targets.size())) break;
+
+            fd_set rset;
+            struct timeval timeout = {0, (int) (deadline - now)};
+
+            FD_ZERO(&rset);
+            FD_SET(fd, &rset);
+
+            if (sock::Select(fd + 1, &rset, &timeout) <= 0) continue;
+
+            Candidate candidate;
+            int magic, port, n;
+            long long stamp;
+
+            if ((n = sock::TryRecvfrom(fd, buf, Reply::fixed, &candidate.addr)) < 0) continue;
+
+            if (Reply::parse(buf, n, magic, stamp, port, candidate.players, candidate.capacity, candidate.level) < 0 || magic != DISCOVERY_MAGIC || stamp != start) continue;
+
+            now = sock::nowUs();
+
+            candidate.rtt = now - stamp;
+            candidate.addr.setPort(port);
+
+            /* a primeira resposta encurta a espera pelas outras */
+            if (replies++ == 0 && now + DISCOVERY_GRACE_MS * 1000LL < deadline) deadline = now + DISCOVERY_GRACE_MS * 1000LL;
+
+            if (candidate.available() && (!found || candidate.lighterThan(best))) {
+                best = candidate;
+                found = true;
+            }
+        }
+
+        sock::Close(fd);
+
+        if (found) chosen = best.addr;
+
+        return found;
+    }
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef GAME_H
+#define GAME_H
+
+#include <stdlib.h>
+
+#include <string>
+
+/*
+    Regras do jogo da velha, comuns ao cliente e ao bot do servidor.
+
+    O tabuleiro tem 9 células, linha a linha; uma jogada trafega entre os
+    jogadores como o texto "linha coluna" (de 1 a 3).
+*/
+enum PlayerId : char {
+    NoPlayer = ' ',
+    Player1 = 'X',
+    Player2 = 'O'
+};
+
+/* as 8 linhas vencedoras: 3 horizontais, 3 verticais e as 2 diagonais */
+static const int winningLines[8][3] = {
+    {0, 1, 2}, {3, 4, 5}, {6, 7, 8},
+    {0, 3, 6}, {1, 4, 7}, {2, 5, 8},
+    {0, 4, 8}, {2, 4, 6}
+};
+
+/* vencedor do tabuleiro, ou NoPlayer enquanto ninguém fechou uma linha */
+char test_board(const char *board) {
+    for (int i = 0; i < 8; ++i) {
+        const int *line = winningLines[i];
+
+        /* uma linha de células vazias também é "igual": não pode encerrar a busca */
+        if (board[line[0]] != NoPlayer && board[line[0]] == board[line[1]] && board[line[1]] == board[line[2]]) return board[line[0]];
+    }
+
+    return NoPlayer;
+}
+
+/* célula (0 a 8) da jogada "linha coluna"; -1 caso fora do tabuleiro */
+int parseMove(const char *move) {
+    char *end;
+    int line = (int) strtol(move, &end, 10) - 1;
+    int column = (int) strtol(end, NULL, 10) - 1;
+
+    if (line < 0 || line > 2 || column < 0 || column > 2) return -1;
+
+    return column + line * 3;
+}
+
+/* linha e coluna (de 0 a 2) da jogada digitada pelo usuário, separadas por `delimiter` */
+void treat_line(char sendline[], std::string delimiter, int &line, int &column) {
+    std::string s(sendline);
+    std::string token = s.substr(0, s.find(delimiter));
+
+    line = std::atoi(token.c_str()) - 1;
+
+    token = s.substr(s.find(delimiter) + 1, s.size());
+
+    column = std::atoi(token.c_str()) - 1;
+}
+
+/* texto da jogada na célula `cell`; `move` precisa de 4 bytes */
+void formatMove(int cell, char *move) {
+    move[0] = (char) ('1' + cell / 3);
+    move[1] = ' ';
+    move[2] = (char) ('1' + cell % 3);
+    move[3] = '\0';
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef HANDLERS_H
+#define HANDLERS_H
+
+#include <socket.h>
+#include <lobby.h>
+#include <shard.h>
+#include <presence.h>
+#include <bot.h>
+#include <overload.h>
+#include <latency.h>
+#include <scheduler.h>
+
+/*
+    Tratamento das mensagens de jogo do lobby: convites (NewGameMsg, AcceptMsg,
+    DenyMsg), o fim da partida (FinishGame), listas (UpdateList) e PingMsg.
+
+    Cada função trata a mensagem do cliente do slot `slot`, cujo status já foi
+    lido, sobre o estado do lobby reunido em Context. O bin/servidor.o as
+    chama do seu loop e o bin/simulador.o das suas rodadas, de modo que o
+    make check-alloc mede o mesmo código que o servidor executa.
+*/
+namespace handlers {
+    class Context {
+        public:
+            lobby::Roster &roster;
+            shard::Mesh &mesh;
+            presence::Index &followers;
+            bot::Arena &arena;
+            sched::Scheduler &workers;
+            shard::Reservations &reservations;
+            overload::Monitor &load;
+            latency::Sampler &rtts;
+            int *client;
+            bool *pendingList;              // UpdateList pedida e ainda não enviada, por slot
+            lobby::IndexSet &deferred;      // slots com trabalho adiado para o fim da iteração
+            bool &presenceDirty;            // a presença mudou: o resumo vai aos outros shards
+
+            Context(lobby::Roster &_roster, shard::Mesh &_mesh, presence::Index &_followers, bot::Arena &_arena, sched::Scheduler &_workers,
+                    shard::Reservations &_reservations, overload::Monitor &_load, latency::Sampler &_rtts, int *_client, bool *_pendingList,
+                    lobby::IndexSet &_deferred, bool &_presenceDirty)
+                : roster(_roster), mesh(_mesh), followers(_followers), arena(_arena), workers(_workers), reservations(_reservations), load(_load),
+                  rtts(_rtts), client(_client), pendingList(_pendingList), deferred(_deferred), presenceDirty(_presenceDirty) {}
+    };
+
+    /* `allowed` é falso quando o cliente passou do limite de convites */
+    void newGame(Context &ctx, int slot, bool allowed) {
+        lobby::Roster &roster = ctx.roster;
+        int sockfdcli = ctx.client[slot], idCli = ctx.mesh.playerId(slot);
+        int idPeer = -1, slotPeer;
+
+        sock::readNewGameMsg(sockfdcli, idPeer);
+
+        // matchmaking: the available player of the room with the lowest combined RTT
+        if (idPeer == BEST_PEER && allowed) idPeer = latency::bestPeer(roster, ctx.mesh, ctx.client, idCli);
+
+        slotPeer = ctx.mesh.slotOf(idPeer);
+
+        // verify if peer exists and is available (is not playing already)
+        if (!allowed) {
+            // too many invites: deny without bothering the peer
+            sock::writeDenyMsg(sockfdcli);
+        } else if (idPeer == BOT_PEER) {
+            // a match against the server: the client talks to the bot's UDP socket as if it were a peer
+            if (roster.isPlaying(idCli)) {
+                sock::writeDenyMsg(sockfdcli);
+            } else {
+                schema::Endpoint botAddress;
+                int rand1 = rand() % 2;
+
+                roster.setPlaying(idCli, true);
+
+                ctx.followers.touch(idCli);
+
+                ctx.arena.address(sockfdcli, botAddress);
+
+                sock::writeAcceptMsg(sockfdcli, botAddress, rand1);
+
+                // rand1 == 0: the client is Player1 and moves first
+                ctx.arena.start(slot, roster.endpoints[idCli], rand1 != 0, ctx.workers);
+
+                ctx.presenceDirty = true;
+            }
+        } else if (!roster.sameRoom(idCli, idPeer)) {
+            // players only see (and invite) the ones in their own room
+            sock::writeDenyMsg(sockfdcli);
+        } else if (slotPeer >= 0 && ctx.client[slotPeer] > 0 && !roster.isPlaying(idPeer) && !roster.isPlaying(idCli)) {
+            sock::writeNewGameMsg(ctx.client[slotPeer], idCli);
+        } else if (!ctx.mesh.isLocal(idPeer) && roster.has(idPeer) && !roster.isPlaying(idPeer) && !roster.isPlaying(idCli)) {
+            // the peer lives in another shard: route the invite to its owner
+            ctx.mesh.sendInvite(shard::Invite, idCli, idPeer);
+        } else { // the peer is already playing or does not exist
+            // send message to client denying game
+            sock::writeDenyMsg(sockfdcli);
+        }
+    }
+
+    void accept(Context &ctx, int slot, long long now) {
+        lobby::Roster &roster = ctx.roster;
+        int sockfdcli = ctx.client[slot], idCli = ctx.mesh.playerId(slot);
+        int idPeer = -1, slotPeer;
+
+        sock::receive<sock::msg::AcceptReply>(sockfdcli, idPeer);
+
+        slotPeer = ctx.mesh.slotOf(idPeer);
+
+        if (!ctx.mesh.isLocal(idPeer)) {
+            // the inviter lives in another shard: reserve this client and let the owner decide
+            if (roster.has(idPeer) && !roster.isPlaying(idCli) && !roster.isPlaying(idPeer)) {
+                roster.setPlaying(idCli, true);
+
+                ctx.followers.touch(idCli);
+
+                ctx.reservations.hold(slot, idPeer, now);
+
+                ctx.mesh.sendAccept(shard::Accept, idCli, idPeer, roster.at(idCli).address, 0);
+
+                ctx.presenceDirty = true;
+            }
+        } else if (slotPeer >= 0 && ctx.client[slotPeer] >= 0) { // verify if both exists
+            // verify if both are available (are not playing)
+            if (!roster.isPlaying(idCli) && !roster.isPlaying(idPeer)) {
+                // put both into playing list
+                roster.setPlaying(idCli, true);
+                roster.setPlaying(idPeer, true);
+
+                ctx.followers.touch(idCli);
+                ctx.followers.touch(idPeer);
+
+                int rand1 = rand() % 2;
+                int rand2 = (rand1 == 0) ? 1 : 0;
+
+                // send message (with address of peer) to client to start game
+                sock::writeAcceptMsg(sockfdcli, roster.endpoints[idPeer], rand1);
+
+                // send message (with address of client) to peer to start game
+                sock::writeAcceptMsg(ctx.client[slotPeer], roster.endpoints[idCli], rand2);
+
+                ctx.presenceDirty = true;
+            }
+        }
+    }
+
+    void deny(Context &ctx, int slot) {
+        int idPeer = -1, slotPeer;
+
+        sock::receive<sock::msg::DenyReply>(ctx.client[slot], idPeer);
+
+        slotPeer = ctx.mesh.slotOf(idPeer);
+
+        // send message to peer to deny game
+        if (slotPeer >= 0) sock::writeDenyMsg(ctx.client[slotPeer]);
+        else if (!ctx.mesh.isLocal(idPeer)) ctx.mesh.sendInvite(shard::Deny, ctx.mesh.playerId(slot), idPeer);
+    }
+
+    void finishGame(Context &ctx, int slot) {
+        int idCli = ctx.mesh.playerId(slot), score = 0;
+
+        ctx.roster.setPlaying(idCli, false);
+
+        if (sock::receive<sock::msg::Finish>(ctx.client[slot], score) < 0) score = 0;
+
+        // against the bot the server's own board decides the result
+        if (ctx.arena.playing(slot)) {
+            score = ctx.arena.score(slot);
+
+            ctx.arena.end(slot);
+        }
+
+        // under heavy load the points wait; the player is available right away
+        if (!ctx.load.deferScore(slot, score)) ctx.roster.addScore(idCli, score);
+
+        ctx.followers.touch(idCli);
+
+        ctx.presenceDirty = true;
+    }
+
+    /* UpdateList só é marcada aqui; a lista sai em sendList, no fim da iteração */
+    void requestList(Context &ctx, int slot) {
+        // coalesced: at most one list is sent per client, at the end of the iteration
+        ctx.pendingList[slot] = true;
+
+        ctx.deferred.insert(slot);
+    }
+
+    /* envia a lista pedida pelo slot (quem chama confere o limite de UpdateList) */
+    void sendList(Context &ctx, int slot) {
+        lobby::writeListOfClients(ctx.client[slot], ctx.mesh.playerId(slot), ctx.roster, ctx.load.listEntries());
+
+        ctx.pendingList[slot] = false;
+    }
+
+    /* PingMsg devolvido pelo cliente (o servidor os envia em latency::Sampler::sample) */
+    void ping(Context &ctx, int slot, bool allowed) {
+        long long stamp = 0;
+
+        sock::readPingMsg(ctx.client[slot], stamp);
+
+        if (allowed) ctx.rtts.answer(ctx.roster, ctx.mesh.playerId(slot), stamp);
+    }
+}
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <socket.h>
+#include <lobby.h>
+#include <presence.h>
+#include <shard.h>
+
+#include <vector>
+#include <sys/un.h>
+
+#define HANDOFF_MAGIC 0x3248424c    /* "LBH2" (fichas de sessão de 64 bits) */
+#define HANDOFF_TIMEOUT_MS 5000
+#define HANDOFF_QUIESCE_MS 2500     /* espera do processo antigo por estado que a troca não leva */
+
+/*
+    Troca do processo servidor sem derrubar os jogadores.
+
+    Com LOBBY_HANDOFF=<caminho> o servidor escuta também num socket Unix
+    nesse caminho. Um novo servidor iniciado com o mesmo LOBBY_HANDOFF se
+    conecta a ele: o processo antigo termina a iteração atual do loop e envia
+    (SCM_RIGHTS) o socket de escuta, o da malha, o da replicação, o próprio
+    socket de controle e o socket de cada cliente, junto com o estado do lobby (jogador, score,
+    se está jogando, lista pendente e quem ele segue). O novo processo
+    confirma com um byte e o antigo sai sem fechar nada do lado dos clientes:
+    as conexões continuam abertas no novo processo, e o que os clientes
+    enviaram durante a troca espera no buffer do kernel.
+
+    Caso o novo processo falhe antes de confirmar, o antigo simplesmente
+    continua servindo.
+
+    Não vão na troca as partidas contra o bot (o socket da arena e os
+    tabuleiros), os convites com vaga reservada e os jogadores restaurados do
+    checkpoint que ainda não retomaram a sessão. Enquanto houver algum deles,
+    o processo antigo adia a troca por até HANDOFF_QUIESCE_MS (menos que o
+    HANDOFF_TIMEOUT_MS do novo) e, se não acabarem, a recusa: o novo
+    processo sai e o antigo continua servindo.
+*/
+namespace handoff {
+    class Header {
+        public:
+            int magic;
+            int shardId, numShards;
+            int numSlots;
+            bool hasMesh, hasReplica;
+    };
+
+    class SlotState {
+        public:
+            int slot;
+            lobby::Player player;
+            char room[ROOM_NAME_LEN];
+            bool pendingList;
+            int numFollowing;
+            int following[MAX_FOLLOWING];
+    };
+
+    class Snapshot {
+        public:
+            Header header;
+            int listenfd, controlfd, meshfd, replicafd;
+            std::vector<SlotState> slots;
+            std::vector<int> fds;
+    };
+
+    void setTimeout(int sockfd, int ms) {
+        struct timeval tv = {ms / 1000, (ms % 1000) * 1000};
+
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    bool address(const char *path, struct sockaddr_un &addr) {
+        bzero(&addr, sizeof(addr));
+
+        addr.sun_family = AF_UNIX;
+
+        if (strlen(path) >= sizeof(addr.sun_path)) return false;
+
+        strcpy(addr.sun_path, path);
+
+        return true;
+    }
+
+    /* socket de controle do processo atual (remove um arquivo velho de um processo que já morreu) */
+    int listen(const char *path) {
+        struct sockaddr_un addr;
+        int sockfd;
+
+        if (!address(path, addr) || (sockfd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0) {
+            perror("handoff socket error");
+            exit(1);
+        }
+
+        unlink(path);
+
+        if (bind(sockfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || ::listen(sockfd, 1) < 0) {
+            perror("handoff bind error");
+            exit(1);
+        }
+
+        return sockfd;
+    }
+
+    /* conecta ao processo atual; retorna -1 caso não haja ninguém escutando em `path` */
+    int connect(const char *path) {
+        struct sockaddr_un addr;
+        int sockfd;
+
+        if (!address(path, addr) || (sockfd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0) return -1;
+
+        if (::connect(sockfd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            close(sockfd);
+            return -1;
+        }
+
+        setTimeout(sockfd, HANDOFF_TIMEOUT_MS);
+
+        return sockfd;
+    }
+
+    /* envia `len` bytes e os descritores `fds` numa única mensagem */
+    bool sendFds(int sockfd, const void *data, int len, const int *fds, int numFds) {
+        char control[CMSG_SPACE(4 * sizeof(int))];
+        struct iovec iov = {(void *) data, (size_t) len};
+        struct msghdr msg;
+
+        bzero(&msg, sizeof(msg));
+        bzero(control, sizeof(control));
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        if (numFds > 0) {
+            msg.msg_control = control;
+            msg.msg_controllen = CMSG_SPACE(numFds * sizeof(int));
+
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(numFds * sizeof(int));
+
+            memcpy(CMSG_DATA(cmsg), fds, numFds * sizeof(int));
+        }
+
+        return sendmsg(sockfd, &msg, MSG_NOSIGNAL) == len;
+    }
+
+    /* recebe uma mensagem de exatamente `len` bytes; retorna o número de descritores recebidos, ou -1 */
+    int recvFds(int sockfd, void *data, int len, int *fds, int maxFds) {
+        char control[CMSG_SPACE(4 * sizeof(int))];
+        struct iovec iov = {data, (size_t) len};
+        struct msghdr msg;
+
+        bzero(&msg, sizeof(msg));
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC) != len || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) return -1;
+
+        int numFds = 0;
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+            int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+            if (numFds + n > maxFds) return -1;
+
+            memcpy(fds + numFds, CMSG_DATA(cmsg), n * sizeof(int));
+            numFds += n;
+        }
+
+        return numFds;
+    }
+
+    /*
+        lado do processo antigo: envia os sockets e o estado de cada cliente e espera
+        a confirmação. Não aloca memória (roda no loop, depois da inicialização).
+    */
+    bool transfer(int conn, int listenfd, int controlfd, int replicafd, shard::Mesh &mesh, int *client, int maxi,
+                  lobby::Roster &roster, presence::Index &followers, bool *pendingList) {
+        Header header;
+        int fds[4] = {listenfd, controlfd}, numFds = 2;
+
+        header.magic = HANDOFF_MAGIC;
+        header.shardId = mesh.id;
+        header.numShards = mesh.count;
+        header.numSlots = 0;
+        header.hasMesh = mesh.enabled();
+        header.hasReplica = (replicafd >= 0);
+
+        if (header.hasMesh) fds[numFds++] = mesh.fd;
+        if (header.hasReplica) fds[numFds++] = replicafd;
+
+        for (int slot = 0; slot <= maxi; ++slot) {
+            if (client[slot] >= 0) ++header.numSlots;
+        }
+
+        setTimeout(conn, HANDOFF_TIMEOUT_MS);
+
+        if (!sendFds(conn, &header, sizeof(header), fds, numFds)) return false;
+
+        for (int slot = 0; slot <= maxi; ++slot) {
+            if (client[slot] < 0) continue;
+
+            SlotState state;
+            int id = mesh.playerId(slot);
+
+            state.slot = slot;
+            state.player = roster.at(id);
+            strcpy(state.room, roster.roomName(id));
+            state.pendingList = pendingList[slot];
+            state.numFollowing = 0;
+
+            for (int s = followers.headOfSlot[slot]; s >= 0 && state.numFollowing < MAX_FOLLOWING; s = followers.pool[s].nextOfSlot) {
+                state.following[state.numFollowing++] = followers.pool[s].playerId;
+            }
+
+            if (!sendFds(conn, &state, sizeof(state), &client[slot], 1)) return false;
+        }
+
+        char ack;
+
+        return read(conn, &ack, 1) == 1;
+    }
+
+    /* lado do processo novo: recebe tudo; a confirmação só é enviada depois de validar a configuração */
+    bool receive(int conn, Snapshot &snapshot) {
+        int fds[4];
+        int numFds = recvFds(conn, &snapshot.header, sizeof(Header), fds, 4);
+
+        if (numFds != 2 + snapshot.header.hasMesh + snapshot.header.hasReplica || snapshot.header.magic != HANDOFF_MAGIC || snapshot.header.numSlots < 0 || snapshot.header.numSlots > FD_SETSIZE) return false;
+
+        snapshot.listenfd = fds[0];
+        snapshot.controlfd = fds[1];
+        snapshot.meshfd = snapshot.header.hasMesh ? fds[2] : -1;
+        snapshot.replicafd = snapshot.header.hasReplica ? fds[numFds - 1] : -1;
+
+        snapshot.slots.resize(snapshot.header.numSlots);
+        snapshot.fds.resize(snapshot.header.numSlots);
+
+        for (int i = 0; i < snapshot.header.numSlots; ++i) {
+            SlotState &state = snapshot.slots[i];
+
+            if (recvFds(conn, &state, sizeof(state), &snapshot.fds[i], 1) != 1) return false;
+
+            if (state.slot < 1 || state.slot >= FD_SETSIZE || state.numFollowing < 0 || state.numFollowing > MAX_FOLLOWING) return false;
+
+            state.player.address[ADDR_LEN - 1] = '\0';
+            state.room[ROOM_NAME_LEN - 1] = '\0';
+        }
+
+        return true;
+    }
+
+    void acknowledge(int conn) {
+        char ack = 1;
+
+        if (write(conn, &ack, 1) != 1) {
+            perror("handoff ack error");
+            exit(1);
+        }
+    }
+}
+
+#endif
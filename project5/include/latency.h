@@ -0,0 +1,147 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <socket.h>
+#include <lobby.h>
+#include <shard.h>
+
+#include <stdio.h>
+#include <netinet/tcp.h>
+
+#define RTT_SAMPLE_MS 1000          /* intervalo entre duas medições de cada conexão */
+#define RTT_MAX_SAMPLE_US 10000000  /* PingMsg devolvido depois disso é descartado */
+#define RTT_UNKNOWN_US 500000       /* RTT assumido para quem ainda não foi medido, ao escolher adversários */
+
+/*
+    Medição contínua do RTT de cada conexão.
+
+    A cada RTT_SAMPLE_MS o servidor lê o RTT suavizado que o kernel mantém para
+    o socket (TCP_INFO) e envia um PingMsg com a hora atual, que o cliente
+    devolve. O RTT do PingMsg inclui o tempo que o cliente e o loop do servidor
+    levam para atender a mensagem, que é o que um jogador sente; o do kernel
+    serve enquanto o primeiro PingMsg não volta. As amostras do PingMsg são
+    suavizadas como no TCP (média móvel com peso 1/8 para a amostra nova).
+
+    Os RTTs ficam no Roster (e vão para os outros shards no resumo de
+    presença), de onde saem a lista de clientes, o relatório do SIGUSR1 e a
+    escolha de adversário: um NewGameMsg para o id -1 convida o jogador
+    disponível da mesma sala com o menor RTT somado ao de quem convida.
+*/
+namespace latency {
+    /* RTT suavizado pelo kernel para o socket `sockfd`, em microssegundos (0 caso não disponível) */
+    int tcpRtt(int sockfd) {
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+
+        if (getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) return 0;
+
+        return (int) info.tcpi_rtt;
+    }
+
+    /* incorpora uma amostra do PingMsg ao RTT suavizado `rtt` */
+    void smooth(int &rtt, int sample) {
+        rtt = (rtt == 0) ? sample : rtt + (sample - rtt) / 8;
+    }
+
+    class Sampler {
+        public:
+            long long lastSample;
+
+            Sampler() : lastSample(0) {}
+
+            bool due(long long now) { return now - lastSample >= RTT_SAMPLE_MS; }
+
+            /* mede o RTT do kernel e envia um PingMsg para cada cliente conectado */
+            void sample(int *client, int maxi, shard::Mesh &mesh, lobby::Roster &roster, long long now) {
+                long long stamp = sock::nowUs();
+
+                for (int slot = 1; slot <= maxi; ++slot) {
+                    int id = mesh.playerId(slot);
+
+                    if (client[slot] < 0 || !roster.has(id)) continue;
+
+                    roster.at(id).tcpRtt = tcpRtt(client[slot]);
+
+                    sock::writePingMsg(client[slot], stamp);
+                }
+
+                lastSample = now;
+            }
+
+            /* PingMsg devolvido pelo jogador `id` */
+            void answer(lobby::Roster &roster, int id, long long stamp) {
+                long long sample = sock::nowUs() - stamp;
+
+                /* marcas de tempo que não saíram deste processo (ou muito antigas) são ignoradas */
+                if (!roster.has(id) || sample <= 0 || sample > RTT_MAX_SAMPLE_US) return;
+
+                smooth(roster.at(id).rtt, (int) sample);
+            }
+    };
+
+    /* RTT somado de dois jogadores, usando RTT_UNKNOWN_US para quem ainda não foi medido */
+    int combined(lobby::Roster &roster, int id, int other) {
+        int a = roster.latency(id), b = roster.latency(other);
+
+        return ((a > 0) ? a : RTT_UNKNOWN_US) + ((b > 0) ? b : RTT_UNKNOWN_US);
+    }
+
+    /*
+        adversário para `id`: o jogador disponível da mesma sala com o menor RTT somado ao
+        de `id` (os jogadores locais precisam estar conectados); -1 caso não haja nenhum
+    */
+    int bestPeer(lobby::Roster &roster, shard::Mesh &mesh, int *client, int id) {
+        if (!roster.has(id)) return -1;
+
+        lobby::IndexSet &members = roster.rooms[roster.at(id).room].members;
+        int best = -1, bestRtt = 0;
+
+        for (int i = 0; i < members.size; ++i) {
+            int other = members[i];
+
+            if (other == id || !roster.isAvailable(other)) continue;
+
+            if (mesh.isLocal(other) && (mesh.slotOf(other) < 0 || client[mesh.slotOf(other)] < 0)) continue;
+
+            int rtt = combined(roster, id, other);
+
+            if (best < 0 || rtt < bestRtt) {
+                best = other;
+                bestRtt = rtt;
+            }
+        }
+
+        return best;
+    }
+
+    /* resumo dos RTTs dos jogadores locais (relatório do SIGUSR1) */
+    void report(FILE *fp, lobby::Roster &roster, shard::Mesh &mesh) {
+        long long sum = 0, tcpSum = 0;
+        int measured = 0, tcpMeasured = 0, max = 0;
+
+        for (int i = 0; i < roster.size(); ++i) {
+            lobby::Player &player = roster.at(roster.present[i]);
+
+            if (!mesh.isLocal(roster.present[i])) continue;
+
+            if (player.rtt > 0) {
+                sum += player.rtt;
+                ++measured;
+
+                if (player.rtt > max) max = player.rtt;
+            }
+
+            if (player.tcpRtt > 0) {
+                tcpSum += player.tcpRtt;
+                ++tcpMeasured;
+            }
+        }
+
+        fprintf(fp, "rtt dos jogadores locais (ms)\n");
+        fprintf(fp, "  PingMsg  %d medidos, média %.3f, máximo %.3f\n", measured, measured ? sum / 1000.0 / measured : 0.0, max / 1000.0);
+        fprintf(fp, "  kernel   %d medidos, média %.3f\n", tcpMeasured, tcpMeasured ? tcpSum / 1000.0 / tcpMeasured : 0.0);
+        fflush(fp);
+    }
+}
+
+#endif
@@ -0,0 +1,277 @@
+#ifndef LOBBY_H
+#define LOBBY_H
+
+#include <socket.h>
+
+#include <vector>
+
+#define MAX_ROOMS 64    /* salas simultâneas por shard (a sala 0 é o lobby principal) */
+
+/*
+    Tabelas do lobby com memória reservada na inicialização.
+
+    Os ids dos jogadores são limitados (slot * numShards + shardId, com slot
+    menor que FD_SETSIZE), então as tabelas são vetores indexados pelo id,
+    alocados uma única vez. Entrar, sair, começar e terminar jogos não
+    aloca memória no heap, ao contrário dos std::map/std::set de antes.
+
+    Os jogadores são divididos em salas: a lista de clientes, os convites e
+    os anúncios ficam restritos à sala, então o custo de cada evento cresce
+    com o tamanho da sala, e não com o do lobby. Todo jogador começa na sala
+    0 (o lobby principal, de nome ""); as outras são criadas quando alguém
+    entra nelas e liberadas quando ficam vazias.
+*/
+namespace lobby {
+    /*
+        Conjunto de inteiros em [0, capacidade) com inserção, remoção e teste
+        em O(1) e iteração proporcional ao número de elementos
+        (vetor denso + vetor de posições)
+    */
+    class IndexSet {
+        public:
+            std::vector<int> dense, pos;
+            int size;
+
+            IndexSet() : size(0) {}
+
+            void init(int capacity) {
+                dense.assign(capacity, 0);
+                pos.assign(capacity, -1);
+                size = 0;
+            }
+
+            bool has(int value) { return value >= 0 && value < (int) pos.size() && pos[value] >= 0; }
+
+            void insert(int value) {
+                if (value < 0 || value >= (int) pos.size() || pos[value] >= 0) return;
+
+                pos[value] = size;
+                dense[size++] = value;
+            }
+
+            void erase(int value) {
+                if (!has(value)) return;
+
+                /* move o último elemento para o lugar do removido */
+                int last = dense[--size];
+
+                dense[pos[value]] = last;
+                pos[last] = pos[value];
+                pos[value] = -1;
+            }
+
+            void clear() {
+                for (int i = 0; i < size; ++i) pos[dense[i]] = -1;
+
+                size = 0;
+            }
+
+            bool empty() { return size == 0; }
+
+            int operator[](int i) { return dense[i]; }
+    };
+
+    class Player {
+        public:
+            bool playing;
+            int score;
+            long long session;  // ficha para retomar a sessão depois de um reinício
+            int room;
+            int rtt, tcpRtt;    // RTT em microssegundos medido por PingMsg e pelo kernel (0 = ainda não medido)
+            char address[ADDR_LEN];
+    };
+
+    class Room {
+        public:
+            char name[ROOM_NAME_LEN];
+            IndexSet members;
+    };
+
+    class Roster {
+        public:
+            std::vector<Player> players;
+            IndexSet present;
+            IndexSet changed;   // ids alterados desde o último registro no checkpoint
+            std::vector<Room> rooms;
+            std::vector<schema::Endpoint> endpoints;    // address de cada jogador no formato binário (AcceptMsg, UpdateList)
+            std::vector<char> listBuffer;   // UpdateList codificado (cabe a sala mais cheia possível)
+
+            void init(int capacity) {
+                players.assign(capacity, Player());
+                endpoints.assign(capacity, schema::Endpoint());
+                listBuffer.assign(1 + sock::msg::ListSize::maxSize + sock::msg::ListHeader::maxSize + capacity * sock::msg::ClientEntry::maxSize, 0);
+                present.init(capacity);
+                changed.init(capacity);
+
+                rooms.assign(MAX_ROOMS, Room());
+
+                for (auto &room : rooms) {
+                    room.name[0] = '\0';
+                    room.members.init(capacity);
+                }
+            }
+
+            int capacity() { return (int) players.size(); }
+
+            bool has(int id) { return present.has(id); }
+
+            Player &at(int id) { return players[id]; }
+
+            int size() { return present.size; }
+
+            bool add(int id, const char *address) {
+                if (id < 0 || id >= capacity()) return false;
+
+                Player &player = players[id];
+
+                if (has(id)) rooms[player.room].members.erase(id);
+
+                player.playing = false;
+                player.score = 0;
+                player.session = 0;
+                player.room = 0;
+                player.rtt = 0;
+                player.tcpRtt = 0;
+
+                rooms[0].members.insert(id);
+
+                strncpy(player.address, address, ADDR_LEN - 1);
+                player.address[ADDR_LEN - 1] = '\0';
+
+                /* convertido uma vez aqui, e não a cada lista enviada */
+                if (!sock::parseEndpoint(player.address, endpoints[id])) endpoints[id].family = 4;
+
+                present.insert(id);
+                changed.insert(id);
+
+                return true;
+            }
+
+            void remove(int id) {
+                if (!has(id)) return;
+
+                rooms[players[id].room].members.erase(id);
+
+                present.erase(id);
+                changed.insert(id);
+            }
+
+            /* índice da sala `name`, criando-a caso `create`; -1 caso não exista (ou não haja sala livre) */
+            int findRoom(const char *name, bool create) {
+                int unused = -1;
+
+                if (name[0] == '\0') return 0;
+
+                for (int r = 1; r < MAX_ROOMS; ++r) {
+                    if (rooms[r].members.empty()) {
+                        if (unused < 0) unused = r;
+                    } else if (strcmp(rooms[r].name, name) == 0) {
+                        return r;
+                    }
+                }
+
+                if (!create || unused < 0) return -1;
+
+                snprintf(rooms[unused].name, ROOM_NAME_LEN, "%s", name);
+
+                return unused;
+            }
+
+            /* move o jogador para a sala `room` (uma sala sem membros fica livre para outro nome) */
+            void join(int id, int room) {
+                if (!has(id) || room < 0 || room >= MAX_ROOMS || players[id].room == room) return;
+
+                rooms[players[id].room].members.erase(id);
+                rooms[room].members.insert(id);
+
+                players[id].room = room;
+                changed.insert(id);
+            }
+
+            const char *roomName(int id) { return has(id) ? rooms[players[id].room].name : ""; }
+
+            bool sameRoom(int id, int other) { return has(id) && has(other) && players[id].room == players[other].room; }
+
+            /* melhor estimativa do RTT do jogador até o servidor: a do PingMsg, senão a do kernel */
+            int latency(int id) {
+                if (!has(id)) return 0;
+
+                return (players[id].rtt > 0) ? players[id].rtt : players[id].tcpRtt;
+            }
+
+            bool isPlaying(int id) { return has(id) && players[id].playing; }
+
+            /* disponível = conectado e fora de jogo */
+            bool isAvailable(int id) { return has(id) && !players[id].playing; }
+
+            void setPlaying(int id, bool playing) {
+                if (has(id)) {
+                    players[id].playing = playing;
+                    changed.insert(id);
+                }
+            }
+
+            void addScore(int id, int delta) {
+                if (has(id)) {
+                    players[id].score += delta;
+                    changed.insert(id);
+                }
+            }
+    };
+
+    /* entra numa lista resumida: o próprio cliente e os jogadores disponíveis */
+    bool inSummary(Roster &roster, int id, int idCli) { return id == idCli || !roster.at(id).playing; }
+
+    /*
+        a lista inteira é codificada no buffer reservado do Roster e enviada com uma única escrita;
+        com `maxEntries` > 0 ela é resumida (ver include/overload.h): o cliente e até
+        `maxEntries` jogadores disponíveis
+    */
+    void writeListOfClients(int sockfd, int idCli, Roster &roster, int maxEntries = 0) {
+        if (sockfd >= 0) {
+            char *buf = &roster.listBuffer[0];
+
+            /* só os jogadores da sala do cliente */
+            IndexSet &members = roster.rooms[roster.has(idCli) ? roster.at(idCli).room : 0].members;
+            int num_clis = members.size, others = 0;
+
+            if (maxEntries > 0) {
+                num_clis = 0;
+
+                for (int i = 0; i < members.size; ++i) {
+                    if (members[i] == idCli) ++num_clis;
+                    else if (inSummary(roster, members[i], idCli) && others < maxEntries) ++others;
+                }
+
+                num_clis += others;
+                others = 0;
+            }
+
+            buf[0] = sock::UpdateList;
+
+            /* o tamanho só é conhecido depois de codificar a lista: o espaço fica reservado */
+            int start = 1 + sock::msg::ListSize::maxSize;
+            int len = start + sock::msg::ListHeader::encode(buf + start, idCli, num_clis);
+
+            for (int i = 0; i < members.size; ++i) {
+                int id = members[i];
+                Player &cli = roster.at(id);
+                int available = cli.playing ? 0 : 1;
+
+                if (maxEntries > 0 && id != idCli) {
+                    if (!inSummary(roster, id, idCli) || others == maxEntries) continue;
+
+                    ++others;
+                }
+
+                len += sock::msg::ClientEntry::encode(buf + len, id * 2 + available, cli.score, roster.latency(id), roster.endpoints[id]);
+            }
+
+            sock::msg::ListSize::encode(buf + 1, len - start);
+
+            sock::Write(sockfd, buf, len);
+        }
+    }
+}
+
+#endif
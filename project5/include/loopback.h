@@ -0,0 +1,188 @@
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#include <socket.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define LOOPBACK_RING_SIZE 4096     /* bytes de cada sentido de uma conexão (potência de 2) */
+
+/*
+    Conexões em memória para o sock:: (ver sock::Transport).
+
+    Uma conexão tem dois anéis de bytes, um por sentido, cada um com um único
+    produtor e um único consumidor: o produtor só escreve `tail` e o
+    consumidor só escreve `head`, então nenhum lock é necessário, e os dois
+    lados podem estar em threads diferentes. Os descritores são pares como os
+    de socketpair (VIRTUAL_FD_BASE + 2 * conexão + lado) e passam por
+    sock::Read/Write/Writev/Close e por todo o protocolo (send/receive, listas,
+    ...) sem nenhuma syscall.
+
+    Sem select: quem dirige as conexões numa única thread consulta
+    readable() antes de ler, pois Read espera (cedendo a CPU) até haver bytes
+    ou o outro lado fechar, e Write espera haver espaço no anel. Tudo é
+    reservado em init(), e um processo comporta tantas conexões quanto a
+    memória (2 * ringSize bytes cada), sem o limite de descritores do kernel.
+*/
+namespace loopback {
+    class Ring {
+        public:
+            std::vector<char> buf;
+            unsigned mask;
+            std::atomic<unsigned> head, tail;   // consumidor e produtor; a diferença é o que há para ler
+            std::atomic<bool> writerClosed, readerClosed;
+
+            Ring() : mask(0), head(0), tail(0), writerClosed(false), readerClosed(false) {}
+
+            void init(int capacity) {
+                buf.assign(capacity, 0);
+                mask = capacity - 1;
+            }
+
+            int size() { return (int) (tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed)); }
+
+            /* produtor: copia até `len` bytes; retorna quantos couberam */
+            int write(const char *data, int len) {
+                unsigned t = tail.load(std::memory_order_relaxed);
+                int space = (int) buf.size() - (int) (t - head.load(std::memory_order_acquire));
+                int n = (len < space) ? len : space;
+                int first = (int) buf.size() - (int) (t & mask);
+
+                if (first > n) first = n;
+
+                memcpy(&buf[t & mask], data, first);
+                memcpy(&buf[0], data + first, n - first);
+
+                tail.store(t + n, std::memory_order_release);
+
+                return n;
+            }
+
+            /* consumidor: copia até `len` bytes; retorna quantos havia */
+            int read(char *data, int len) {
+                unsigned h = head.load(std::memory_order_relaxed);
+                int avail = (int) (tail.load(std::memory_order_acquire) - h);
+                int n = (len < avail) ? len : avail;
+                int first = (int) buf.size() - (int) (h & mask);
+
+                if (first > n) first = n;
+
+                memcpy(data, &buf[h & mask], first);
+                memcpy(data + first, &buf[0], n - first);
+
+                head.store(h + n, std::memory_order_release);
+
+                return n;
+            }
+    };
+
+    /* rings[lado] leva os bytes escritos pelo descritor desse lado */
+    class Connection {
+        public:
+            Ring rings[2];
+    };
+
+    class Network {
+        public:
+            std::vector<Connection> connections;
+            int used;
+
+            Network() : used(0) {}
+
+            /* reserva `maxConnections` conexões com anéis de `ringSize` bytes (potência de 2) */
+            void init(int maxConnections, int ringSize = LOOPBACK_RING_SIZE) {
+                if (ringSize <= 0 || (ringSize & (ringSize - 1)) != 0) {
+                    perror("loopback ring size must be a power of 2");
+                    exit(1);
+                }
+
+                std::vector<Connection> reserved(maxConnections);
+
+                connections.swap(reserved);
+
+                for (auto &connection : connections) {
+                    connection.rings[0].init(ringSize);
+                    connection.rings[1].init(ringSize);
+                }
+
+                used = 0;
+            }
+
+            bool owns(int fd) { return fd >= VIRTUAL_FD_BASE && (fd - VIRTUAL_FD_BASE) / 2 < used; }
+
+            /* anel em que `fd` escreve */
+            Ring &output(int fd) { return connections[(fd - VIRTUAL_FD_BASE) / 2].rings[(fd - VIRTUAL_FD_BASE) % 2]; }
+
+            /* anel de que `fd` lê */
+            Ring &input(int fd) { return connections[(fd - VIRTUAL_FD_BASE) / 2].rings[1 - (fd - VIRTUAL_FD_BASE) % 2]; }
+
+            /* nova conexão, como socketpair; falso caso as reservadas tenham acabado */
+            bool pair(int fds[2]) {
+                if (used >= (int) connections.size()) return false;
+
+                fds[0] = VIRTUAL_FD_BASE + 2 * used;
+                fds[1] = fds[0] + 1;
+
+                ++used;
+
+                return true;
+            }
+
+            /* bytes à espera de leitura em `fd` */
+            int readable(int fd) { return owns(fd) ? input(fd).size() : 0; }
+
+            /* o outro lado fechou e não há mais nada a ler */
+            bool eof(int fd) { return owns(fd) && input(fd).writerClosed && input(fd).size() == 0; }
+    };
+
+    Network network;
+
+    int read(int fd, char *buf, int len) {
+        if (!network.owns(fd)) return 0;
+
+        Ring &ring = network.input(fd);
+
+        while (true) {
+            /* lê o fechamento antes do anel: bytes escritos antes de fechar ainda são entregues */
+            bool closed = ring.writerClosed;
+            int n = ring.read(buf, len);
+
+            if (n > 0 || closed || len == 0) return n;
+
+            std::this_thread::yield();
+        }
+    }
+
+    int write(int fd, const char *buf, int len, bool block) {
+        if (!network.owns(fd)) return -1;
+
+        Ring &ring = network.output(fd);
+        int n = 0;
+
+        do {
+            if (ring.readerClosed) return -1;
+
+            n += ring.write(buf + n, len - n);
+
+            if (n < len && block) std::this_thread::yield();
+        } while (n < len && block);
+
+        return n;
+    }
+
+    void close(int fd) {
+        if (!network.owns(fd)) return;
+
+        network.output(fd).writerClosed = true;
+        network.input(fd).readerClosed = true;
+    }
+
+    sock::Transport transport = {loopback::read, loopback::write, loopback::close};
+
+    /* passa a tratar os descritores virtuais no sock:: */
+    void enable() { sock::transport = &transport; }
+}
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include <socket.h>
+#include <lobby.h>
+#include <log.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#define OVERLOAD_LAG_MS "5,10,20,40"        /* atraso do loop que liga cada estágio (LOBBY_OVERLOAD_LAG_MS) */
+#define OVERLOAD_DEPTH "64,128,256,512"     /* fila que liga cada estágio (LOBBY_OVERLOAD_DEPTH) */
+#define OVERLOAD_HOLD_MS 1000               /* tempo abaixo do limite antes de descer um estágio */
+#define OVERLOAD_COALESCE_MS 100            /* intervalo entre envios de listas e presença a partir do estágio Coalesce */
+#define OVERLOAD_LIST_ENTRIES 32            /* jogadores de uma lista resumida, além do próprio cliente */
+
+/*
+    Degradação do lobby sob carga.
+
+    A cada iteração o loop informa quanto tempo levou do retorno do select
+    até o fim da iteração (o atraso que todos os outros clientes sofreram) e
+    o tamanho da fila: descritores prontos mais conexões com trabalho adiado.
+    As duas medidas são suavizadas (média móvel exponencial, peso 1/8) e
+    comparadas com os limites de cada estágio; o estágio sobe assim que um
+    limite é passado e desce um por vez, depois de OVERLOAD_HOLD_MS abaixo
+    dele. Cada estágio inclui os anteriores:
+
+        Coalesce        listas, presença e o resumo para os outros shards
+                        saem no máximo a cada OVERLOAD_COALESCE_MS
+        Summary         as listas trazem só o cliente e até
+                        OVERLOAD_LIST_ENTRIES jogadores disponíveis
+        DeferScores     os pontos das partidas terminadas ficam guardados
+                        e entram no placar quando a carga baixar
+        Refuse          novas conexões são aceitas e fechadas em seguida
+
+    Convites, respostas e o início das partidas (NewGameMsg, AcceptMsg,
+    DenyMsg) e as jogadas nunca são adiados. Um limite 0 desliga aquela
+    medida para o estágio.
+*/
+namespace overload {
+    enum Level {
+        Normal,
+        Coalesce,
+        Summary,
+        DeferScores,
+        Refuse,
+        NUM_LEVELS
+    };
+
+    const char *levelNames[NUM_LEVELS] = {"normal", "coalesce", "summary", "defer-scores", "refuse"};
+
+    /* "a,b,c,d" -> limits[Coalesce..Refuse], multiplicados por `scale`; valores ausentes mantêm o padrão */
+    void parseLimits(const char *text, long long *limits, long long scale) {
+        char *end;
+
+        for (int level = Coalesce; level < NUM_LEVELS && text != NULL && *text != '\0'; ++level) {
+            long long value = strtoll(text, &end, 10);
+
+            if (end == text) break;
+
+            limits[level] = value * scale;
+
+            text = (*end == ',') ? end + 1 : end;
+        }
+    }
+
+    class Monitor {
+        public:
+            Level level;
+            long long lagLimit[NUM_LEVELS], depthLimit[NUM_LEVELS];    // us e conexões; índice 0 não é usado
+            long long lagAvg, depthAvg;     // médias com 3 bits de fração
+            long long lagMax, depthMax;     // desde o último relatório
+            long long belowSince, lastFlush, levelSince;
+            long long timeAt[NUM_LEVELS];   // ms em cada estágio
+            long long summarized, refused, deferredPoints;
+
+            /* pontos guardados no estágio DeferScores, por slot */
+            std::vector<int> points;
+            lobby::IndexSet withPoints;
+
+            Monitor() : level(Normal), lagAvg(0), depthAvg(0), lagMax(0), depthMax(0), belowSince(-1), lastFlush(0), levelSince(0),
+                        summarized(0), refused(0), deferredPoints(0) {
+                for (int i = 0; i < NUM_LEVELS; ++i) {
+                    lagLimit[i] = depthLimit[i] = 0;
+                    timeAt[i] = 0;
+                }
+            }
+
+            void init(int numSlots, long long nowMs) {
+                parseLimits(OVERLOAD_LAG_MS, lagLimit, 1000);
+                parseLimits(OVERLOAD_DEPTH, depthLimit, 1);
+
+                parseLimits(getenv("LOBBY_OVERLOAD_LAG_MS"), lagLimit, 1000);
+                parseLimits(getenv("LOBBY_OVERLOAD_DEPTH"), depthLimit, 1);
+
+                points.assign(numSlots, 0);
+                withPoints.init(numSlots);
+
+                levelSince = nowMs;
+            }
+
+            /* estágio que as médias atuais pedem */
+            Level target() {
+                Level wanted = Normal;
+
+                for (int l = Coalesce; l < NUM_LEVELS; ++l) {
+                    if ((lagLimit[l] > 0 && lagAvg / 8 >= lagLimit[l]) || (depthLimit[l] > 0 && depthAvg / 8 >= depthLimit[l])) wanted = (Level) l;
+                }
+
+                return wanted;
+            }
+
+            /* fim de uma iteração: `lagUs` de trabalho, `depth` itens na fila */
+            void update(long long lagUs, int depth, long long nowMs) {
+                lagAvg += lagUs - lagAvg / 8;
+                depthAvg += depth - depthAvg / 8;
+
+                if (lagUs > lagMax) lagMax = lagUs;
+                if (depth > depthMax) depthMax = depth;
+
+                Level wanted = target();
+
+                if (wanted > level) {
+                    enter(wanted, nowMs);
+                } else if (wanted < level) {
+                    /* desce um estágio de cada vez, depois de OVERLOAD_HOLD_MS sem precisar dele */
+                    if (belowSince < 0) belowSince = nowMs;
+                    else if (nowMs - belowSince >= OVERLOAD_HOLD_MS) enter((Level) (level - 1), nowMs);
+                } else {
+                    belowSince = -1;
+                }
+            }
+
+            void enter(Level next, long long nowMs) {
+                timeAt[level] += nowMs - levelSince;
+
+                if (next > level) LOG_WARN("sobrecarga: estágio %s (atraso %lld us, fila %lld)", levelNames[next], lagAvg / 8, depthAvg / 8);
+                else LOG_INFO("sobrecarga: estágio %s", levelNames[next]);
+
+                level = next;
+                levelSince = nowMs;
+                belowSince = -1;
+            }
+
+            bool shedding(Level l) { return level >= l; }
+
+            /* verdadeiro quando listas e presença podem ser enviadas nesta iteração */
+            bool flushDue(long long nowMs) {
+                if (level < Coalesce) return true;
+
+                if (nowMs - lastFlush < OVERLOAD_COALESCE_MS) return false;
+
+                lastFlush = nowMs;
+
+                return true;
+            }
+
+            /* número de jogadores de uma lista: 0 = a sala inteira */
+            int listEntries() {
+                if (level < Summary) return 0;
+
+                ++summarized;
+
+                return OVERLOAD_LIST_ENTRIES;
+            }
+
+            /* guarda `score` pontos do slot; falso fora do estágio DeferScores (os pontos entram já) */
+            bool deferScore(int slot, int score) {
+                if (level < DeferScores) return false;
+
+                points[slot] += score;
+                withPoints.insert(slot);
+
+                ++deferredPoints;
+
+                return true;
+            }
+
+            /* esquece os pontos guardados de um slot que saiu */
+            void drop(int slot) {
+                points[slot] = 0;
+                withPoints.erase(slot);
+            }
+
+            /* entrega os pontos guardados a `apply(slot, pontos)`; `force` ignora o estágio (troca de processo) */
+            template <typename Apply>
+            void releaseScores(Apply apply, bool force = false) {
+                if (withPoints.empty() || (level >= DeferScores && !force)) return;
+
+                for (int k = 0; k < withPoints.size; ++k) {
+                    int slot = withPoints[k];
+
+                    apply(slot, points[slot]);
+
+                    points[slot] = 0;
+                }
+
+                withPoints.clear();
+            }
+
+            void report(FILE *fp, long long nowMs) {
+                fprintf(fp, "sobrecarga: estágio %s, atraso médio %.3f ms (máximo %.3f), fila média %lld (máxima %lld)\n",
+                        levelNames[level], lagAvg / 8 / 1000.0, lagMax / 1000.0, depthAvg / 8, depthMax);
+
+                fprintf(fp, " ");
+
+                for (int l = 0; l < NUM_LEVELS; ++l) {
+                    long long ms = timeAt[l] + ((l == level) ? nowMs - levelSince : 0);
+
+                    fprintf(fp, " %s %.1f s", levelNames[l], ms / 1000.0);
+                }
+
+                fprintf(fp, "\n  %lld listas resumidas, %lld placares adiados, %lld conexões recusadas\n", summarized, deferredPoints, refused);
+                fflush(fp);
+
+                lagMax = depthMax = 0;
+            }
+    };
+}
+
+#endif
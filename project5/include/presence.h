@@ -0,0 +1,281 @@
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <socket.h>
+#include <lobby.h>
+
+#include <vector>
+
+#define MAX_FOLLOWING 64    /* jogadores seguidos por conexão */
+
+/*
+    Assinaturas de presença: cada cliente escolhe quais jogadores quer seguir
+    e o servidor só o avisa sobre mudanças (disponível/jogando/saiu, score)
+    desses jogadores.
+
+    O índice é invertido (jogador -> assinantes), então o custo de uma mudança
+    é proporcional ao número de seguidores do jogador, e não ao tamanho do lobby.
+    Os assinantes são identificados pelo slot da conexão no vetor client[].
+
+    Cada assinatura é um nó de um pool reservado na inicialização, ligado ao
+    mesmo tempo na lista de assinantes do jogador e na lista de assinaturas
+    da conexão; assinar, cancelar e desconectar não alocam memória.
+*/
+namespace presence {
+    class Subscription {
+        public:
+            int slot, playerId;
+            int nextOfPlayer, prevOfPlayer;
+            int nextOfSlot, prevOfSlot;
+    };
+
+    class Index {
+        public:
+            std::vector<Subscription> pool;
+            int freeList;
+
+            std::vector<int> headOfPlayer, headOfSlot, countOfSlot;
+
+            /* último estado publicado de cada jogador seguido */
+            std::vector<char> published;
+            std::vector<sock::PresenceStatus> status;
+            std::vector<int> score;
+
+            lobby::IndexSet watched;    // jogadores com pelo menos um assinante
+            lobby::IndexSet touched;    // jogadores seguidos que podem ter mudado
+            lobby::IndexSet initial;    // assinaturas novas que ainda não receberam o estado atual
+
+            void init(int numPlayers, int numSlots) {
+                int numSubs = numSlots * MAX_FOLLOWING;
+
+                pool.assign(numSubs, Subscription());
+
+                for (int i = 0; i < numSubs; ++i) pool[i].nextOfSlot = i + 1;
+
+                pool[numSubs - 1].nextOfSlot = -1;
+                freeList = 0;
+
+                headOfPlayer.assign(numPlayers, -1);
+                headOfSlot.assign(numSlots, -1);
+                countOfSlot.assign(numSlots, 0);
+
+                published.assign(numPlayers, 0);
+                status.assign(numPlayers, sock::PlayerLeft);
+                score.assign(numPlayers, 0);
+
+                watched.init(numPlayers);
+                touched.init(numPlayers);
+                initial.init(numSubs);
+            }
+
+            int find(int slot, int playerId) {
+                for (int s = headOfSlot[slot]; s >= 0; s = pool[s].nextOfSlot) {
+                    if (pool[s].playerId == playerId) return s;
+                }
+
+                return -1;
+            }
+
+            /* retorna falso caso o id seja inválido ou a conexão já siga MAX_FOLLOWING jogadores */
+            bool subscribe(int slot, int playerId) {
+                if (playerId < 0 || playerId >= (int) headOfPlayer.size()) return false;
+
+                if (find(slot, playerId) >= 0) return true;
+
+                if (countOfSlot[slot] >= MAX_FOLLOWING || freeList < 0) return false;
+
+                int s = freeList;
+                Subscription &sub = pool[s];
+
+                freeList = sub.nextOfSlot;
+
+                sub.slot = slot;
+                sub.playerId = playerId;
+
+                sub.prevOfPlayer = -1;
+                sub.nextOfPlayer = headOfPlayer[playerId];
+                if (sub.nextOfPlayer >= 0) pool[sub.nextOfPlayer].prevOfPlayer = s;
+                headOfPlayer[playerId] = s;
+
+                sub.prevOfSlot = -1;
+                sub.nextOfSlot = headOfSlot[slot];
+                if (sub.nextOfSlot >= 0) pool[sub.nextOfSlot].prevOfSlot = s;
+                headOfSlot[slot] = s;
+
+                ++countOfSlot[slot];
+
+                if (!watched.has(playerId)) {
+                    watched.insert(playerId);
+                    published[playerId] = 0;
+                }
+
+                initial.insert(s);
+
+                return true;
+            }
+
+            void release(int s) {
+                Subscription &sub = pool[s];
+
+                if (sub.prevOfPlayer >= 0) pool[sub.prevOfPlayer].nextOfPlayer = sub.nextOfPlayer;
+                else headOfPlayer[sub.playerId] = sub.nextOfPlayer;
+                if (sub.nextOfPlayer >= 0) pool[sub.nextOfPlayer].prevOfPlayer = sub.prevOfPlayer;
+
+                if (sub.prevOfSlot >= 0) pool[sub.prevOfSlot].nextOfSlot = sub.nextOfSlot;
+                else headOfSlot[sub.slot] = sub.nextOfSlot;
+                if (sub.nextOfSlot >= 0) pool[sub.nextOfSlot].prevOfSlot = sub.prevOfSlot;
+
+                --countOfSlot[sub.slot];
+
+                if (headOfPlayer[sub.playerId] < 0) {
+                    watched.erase(sub.playerId);
+                    touched.erase(sub.playerId);
+                }
+
+                initial.erase(s);
+
+                sub.nextOfSlot = freeList;
+                freeList = s;
+            }
+
+            void unsubscribe(int slot, int playerId) {
+                int s = find(slot, playerId);
+
+                if (s >= 0) release(s);
+            }
+
+            /* o assinante se desconectou: remove todas as suas assinaturas */
+            void drop(int slot) {
+                while (headOfSlot[slot] >= 0) release(headOfSlot[slot]);
+            }
+
+            /*
+                o jogador saiu: avisa os assinantes já e desfaz as assinaturas, pois o id
+                (derivado do slot) pode ser dado ao próximo cliente aceito naquele slot
+            */
+            void leave(int playerId, int *client) {
+                if (playerId < 0 || playerId >= (int) headOfPlayer.size()) return;
+
+                while (headOfPlayer[playerId] >= 0) {
+                    int s = headOfPlayer[playerId];
+
+                    sock::writePresenceMsg(client[pool[s].slot], playerId, sock::PlayerLeft, 0, "");
+
+                    release(s);
+                }
+            }
+
+            /* marca uma mudança local; jogadores que ninguém segue são ignorados */
+            void touch(int playerId) {
+                if (watched.has(playerId)) touched.insert(playerId);
+            }
+
+            /* depois de aplicar presença vinda de outro shard não se sabe o que mudou */
+            void touchAll() {
+                for (int i = 0; i < watched.size; ++i) touched.insert(watched[i]);
+            }
+
+            /*
+                depois de uma troca de processo os clientes já conhecem o estado dos
+                jogadores locais: marca-o como publicado em vez de reenviá-lo. Os
+                jogadores de outros shards são publicados quando o resumo deles chegar.
+            */
+            void settle(lobby::Roster &roster) {
+                const char *address;
+
+                for (int i = 0; i < initial.size; ++i) {
+                    Subscription &sub = pool[initial[i]];
+
+                    if (!roster.has(sub.playerId)) continue;
+
+                    published[sub.playerId] = 1;
+                    current(sub.playerId, roster, status[sub.playerId], score[sub.playerId], address);
+                }
+
+                initial.clear();
+            }
+
+            void current(int playerId, lobby::Roster &roster, sock::PresenceStatus &st, int &sc, const char *&address) {
+                st = sock::PlayerLeft;
+                sc = 0;
+                address = "";
+
+                if (roster.has(playerId)) {
+                    lobby::Player &player = roster.at(playerId);
+
+                    st = player.playing ? sock::PlayerPlaying : sock::PlayerAvailable;
+                    sc = player.score;
+                    address = player.address;
+                }
+            }
+
+            /*
+                envia um PresenceMsg para os assinantes de cada jogador tocado cujo
+                estado mudou desde a última publicação, e o estado atual para quem
+                acabou de assinar. As assinaturas não atravessam salas: quem seguia
+                um jogador que foi para outra sala (`idOf(slot)` é o id do assinante)
+                recebe PlayerLeft e deixa de segui-lo, assim como os seguidores de
+                quem saiu do lobby
+            */
+            template <typename IdOf>
+            void publish(int *client, lobby::Roster &roster, IdOf idOf) {
+                sock::PresenceStatus st;
+                int sc;
+                const char *address;
+
+                /* de trás para frente: release() tira de `touched` o jogador sem assinantes */
+                for (int i = touched.size - 1; i >= 0; --i) {
+                    int playerId = touched[i];
+
+                    current(playerId, roster, st, sc, address);
+
+                    if (st != sock::PlayerLeft) {
+                        for (int s = headOfPlayer[playerId], next; s >= 0; s = next) {
+                            next = pool[s].nextOfPlayer;
+
+                            if (roster.sameRoom(playerId, idOf(pool[s].slot))) continue;
+
+                            sock::writePresenceMsg(client[pool[s].slot], playerId, sock::PlayerLeft, 0, "");
+
+                            release(s);
+                        }
+                    }
+
+                    if (published[playerId] && status[playerId] == st && score[playerId] == sc) continue;
+
+                    published[playerId] = 1;
+                    status[playerId] = st;
+                    score[playerId] = sc;
+
+                    for (int s = headOfPlayer[playerId]; s >= 0; s = pool[s].nextOfPlayer) {
+                        sock::writePresenceMsg(client[pool[s].slot], playerId, st, sc, address);
+
+                        initial.erase(s);
+                    }
+
+                    if (st == sock::PlayerLeft) {
+                        while (headOfPlayer[playerId] >= 0) release(headOfPlayer[playerId]);
+                    }
+                }
+
+                for (int i = 0; i < initial.size; ++i) {
+                    Subscription &sub = pool[initial[i]];
+
+                    current(sub.playerId, roster, st, sc, address);
+
+                    if (!published[sub.playerId]) {
+                        published[sub.playerId] = 1;
+                        status[sub.playerId] = st;
+                        score[sub.playerId] = sc;
+                    }
+
+                    sock::writePresenceMsg(client[sub.slot], sub.playerId, st, sc, address);
+                }
+
+                touched.clear();
+                initial.clear();
+            }
+    };
+}
+
+#endif
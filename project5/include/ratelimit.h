@@ -0,0 +1,97 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <socket.h>
+
+/*
+    Token bucket: cada requisição consome uma ficha; as fichas são repostas
+    a `rate` por segundo até o limite `burst`. Permite rajadas curtas, mas
+    limita a taxa média de um cliente.
+*/
+namespace ratelimit {
+    class TokenBucket {
+        public:
+            double tokens, rate, burst;
+            long long last;
+
+            TokenBucket(double _rate = 1, double _burst = 1) {
+                reset(_rate, _burst);
+            }
+
+            void reset(double _rate, double _burst) {
+                rate = _rate;
+                burst = _burst;
+                tokens = _burst;
+                last = -1;
+            }
+
+            void refill(long long nowMs) {
+                if (last >= 0 && nowMs > last) {
+                    tokens += (nowMs - last) * rate / 1000.0;
+
+                    if (tokens > burst) tokens = burst;
+                }
+
+                last = nowMs;
+            }
+
+            /* retorna verdadeiro (e consome as fichas) caso a requisição esteja dentro do limite */
+            bool take(long long nowMs, double cost = 1) {
+                refill(nowMs);
+
+                if (tokens < cost) return false;
+
+                tokens -= cost;
+
+                return true;
+            }
+
+            /* igual ao take, mas sem consumir a ficha */
+            bool ready(long long nowMs, double cost = 1) {
+                refill(nowMs);
+
+                return tokens >= cost;
+            }
+    };
+
+    /* limite de uma classe de requisições; rate = 0 significa sem limite */
+    struct Rule {
+        double rate, burst;
+    };
+
+    /*
+        Limites de uma conexão: um orçamento total de requisições e um por
+        tipo de mensagem (indexado pelo MessageStatus)
+    */
+    class ClientLimits {
+        public:
+            TokenBucket total;
+            TokenBucket byType[NUM_MSG_TYPES];
+            bool limited[NUM_MSG_TYPES];
+            bool throttled;
+
+            ClientLimits() : throttled(false) {
+                for (int i = 0; i < NUM_MSG_TYPES; ++i) limited[i] = false;
+            }
+
+            void reset(Rule totalRule, const Rule *rules, int numRules) {
+                total.reset(totalRule.rate, totalRule.burst);
+
+                for (int i = 0; i < NUM_MSG_TYPES; ++i) {
+                    limited[i] = (i < numRules && rules[i].rate > 0);
+
+                    if (limited[i]) byType[i].reset(rules[i].rate, rules[i].burst);
+                }
+
+                throttled = false;
+            }
+
+            bool allow(int type, long long nowMs) {
+                if (type < 0 || type >= NUM_MSG_TYPES || !limited[type]) return true;
+
+                return byType[type].take(nowMs);
+            }
+    };
+}
+
+#endif
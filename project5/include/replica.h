@@ -0,0 +1,258 @@
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <socket.h>
+#include <lobby.h>
+#include <checkpoint.h>
+
+#include <vector>
+#include <fcntl.h>
+
+#define REPLICA_MAGIC 0x3152424c        /* "LBR1" */
+#define REPLICA_BUFFER (2 * FD_SETSIZE * (int) sizeof(replica::Record))
+#define REPLICA_RETRY_MS 10             /* espera antes de conferir se o primário ainda existe */
+
+/*
+    Replicação do lobby para um processo reserva (standby).
+
+    O primário (LOBBY_REPLICATE=<porta>) escuta em 127.0.0.1:<porta> e mantém
+    um reserva por vez (o último a conectar). Ao conectar, o reserva recebe a
+    tabela inteira dos jogadores locais (um Record por slot); depois, no fim de cada
+    iteração do loop, o primário acrescenta ao buffer um Record para cada
+    jogador local alterado (entrada, saída, início/fim de jogo, score) e o
+    envia com um único send não bloqueante. Os handlers nunca esperam pelo
+    reserva: caso ele fique para trás e o buffer encha, as alterações são
+    descartadas e a tabela inteira é reenviada assim que houver espaço (os
+    registros são o estado atual do slot, então reaplicá-los é inofensivo).
+
+    O reserva (LOBBY_STANDBY=<porta>) só aplica os registros numa tabela. Quando
+    a conexão cai ele tenta reconectar uma vez: caso alguém ainda escute na
+    porta (o primário trocou de processo, ver handoff.h) ele continua como
+    reserva; caso contrário o primário morreu e o reserva assume a porta dos
+    clientes, com os jogadores da tabela esperando a retomada da sessão,
+    como depois de restaurar um checkpoint.
+*/
+namespace replica {
+    class Header {
+        public:
+            int magic;
+            int shardId, numShards, numSlots;
+    };
+
+    /* estado atual de um slot local */
+    class Record {
+        public:
+            int slot;
+            checkpoint::Entry entry;
+    };
+
+    void fill(Record &record, int slot, int shardId, int numShards, lobby::Roster &roster) {
+        int id = slot * numShards + shardId;
+
+        record.slot = slot;
+        record.entry.present = roster.has(id);
+
+        if (record.entry.present) {
+            record.entry.player = roster.at(id);
+
+            strcpy(record.entry.room, roster.roomName(id));
+        }
+    }
+
+    class Primary {
+        public:
+            int listenfd, fd;
+            int shardId, numShards;
+            std::vector<char> buffer;
+            int head, tail;             // bytes enviados e bytes no buffer
+            bool resync;                // a tabela inteira precisa ser (re)enviada
+
+            Primary() : listenfd(-1), fd(-1), shardId(0), numShards(1), head(0), tail(0), resync(false) {}
+
+            bool enabled() { return listenfd >= 0; }
+
+            bool connected() { return fd >= 0; }
+
+            bool pending() { return connected() && (head < tail || resync); }
+
+            /* escuta em 127.0.0.1:`port` (ou, caso `sockfd` seja dado, herda o socket de outro processo) */
+            void open(int port, int _shardId, int _numShards, int sockfd = -1) {
+                shardId = _shardId;
+                numShards = _numShards;
+
+                buffer.assign(REPLICA_BUFFER, 0);
+
+                if (sockfd >= 0) {
+                    listenfd = sockfd;
+                    return;
+                }
+
+                sock::SocketAddr addr(AF_INET, (int) INADDR_LOOPBACK, port);
+                int reuse = 1;
+
+                listenfd = sock::Socket(AF_INET, SOCK_STREAM, 0);
+
+                setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+                sock::Bind(listenfd, &addr);
+
+                sock::Listen(listenfd, 1);
+            }
+
+            /*
+                aceita um reserva, que substitui o anterior (o reserva nunca escreve no socket,
+                então um reserva morto só é percebido quando o envio falha)
+            */
+            void accept() {
+                int conn = ::accept(listenfd, NULL, NULL);
+
+                if (conn < 0) return;
+
+                drop();
+
+                fcntl(conn, F_SETFL, fcntl(conn, F_GETFL, 0) | O_NONBLOCK);
+
+                fd = conn;
+                head = tail = 0;
+
+                Header header;
+
+                header.magic = REPLICA_MAGIC;
+                header.shardId = shardId;
+                header.numShards = numShards;
+                header.numSlots = FD_SETSIZE;
+
+                append(&header, sizeof(header));
+
+                resync = true;
+            }
+
+            void drop() {
+                if (fd >= 0) sock::Close(fd);
+
+                fd = -1;
+                head = tail = 0;
+                resync = false;
+            }
+
+            bool append(const void *data, int len) {
+                if (tail + len > (int) buffer.size() && head > 0) {
+                    memmove(&buffer[0], &buffer[head], tail - head);
+
+                    tail -= head;
+                    head = 0;
+                }
+
+                if (tail + len > (int) buffer.size()) return false;
+
+                memcpy(&buffer[tail], data, len);
+                tail += len;
+
+                return true;
+            }
+
+            /* fim da iteração: acrescenta ao buffer os jogadores locais alterados (sem limpar roster.changed) */
+            void queue(lobby::Roster &roster) {
+                if (!connected()) return;
+
+                Record record;
+
+                /* a tabela inteira será enviada depois, com o estado mais recente */
+                for (int i = 0; i < roster.changed.size && !resync; ++i) {
+                    int id = roster.changed[i];
+
+                    if (id % numShards != shardId || id / numShards >= FD_SETSIZE) continue;
+
+                    fill(record, id / numShards, shardId, numShards, roster);
+
+                    if (!append(&record, sizeof(record))) resync = true;
+                }
+
+                if (resync && (int) buffer.size() - (tail - head) >= FD_SETSIZE * (int) sizeof(Record)) {
+                    for (int slot = 0; slot < FD_SETSIZE; ++slot) {
+                        fill(record, slot, shardId, numShards, roster);
+                        append(&record, sizeof(record));
+                    }
+
+                    resync = false;
+                }
+            }
+
+            /* envia o que couber no socket, sem bloquear */
+            void flush() {
+                if (!connected() || head == tail) return;
+
+                int n = send(fd, &buffer[head], tail - head, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+                if (n < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) drop();
+                    return;
+                }
+
+                head += n;
+
+                if (head == tail) head = tail = 0;
+            }
+    };
+
+    bool readAll(int sockfd, void *data, int len) {
+        for (int off = 0, n; off < len; off += n) {
+            if ((n = read(sockfd, (char *) data + off, len - off)) <= 0) return false;
+        }
+
+        return true;
+    }
+
+    int connect(int port) {
+        sock::SocketAddr addr(AF_INET, (int) INADDR_LOOPBACK, port);
+        int sockfd = sock::Socket(AF_INET, SOCK_STREAM, 0);
+
+        if (::connect(sockfd, (struct sockaddr *) &addr.addr, sizeof(addr.addr)) < 0) {
+            sock::Close(sockfd);
+            return -1;
+        }
+
+        return sockfd;
+    }
+
+    /*
+        lado do reserva: aplica os registros do primário em `table` (indexada pelo slot)
+        até ele deixar de existir; retorna o número de conexões ao primário
+    */
+    int follow(int port, int shardId, int numShards, std::vector<checkpoint::Entry> &table) {
+        int sockfd, connections = 0;
+
+        table.assign(FD_SETSIZE, checkpoint::Entry());
+
+        while ((sockfd = connect(port)) >= 0) {
+            Header header;
+            Record record;
+
+            if (readAll(sockfd, &header, sizeof(header))) {
+                if (header.magic != REPLICA_MAGIC || header.shardId != shardId || header.numShards != numShards || header.numSlots != FD_SETSIZE) {
+                    fprintf(stderr, "replica: configuração de shards diferente da do primário\n");
+                    exit(1);
+                }
+
+                ++connections;
+
+                while (readAll(sockfd, &record, sizeof(record))) {
+                    if (record.slot < 0 || record.slot >= FD_SETSIZE) continue;
+
+                    record.entry.player.address[ADDR_LEN - 1] = '\0';
+                    record.entry.room[ROOM_NAME_LEN - 1] = '\0';
+
+                    table[record.slot] = record.entry;
+                }
+            }
+
+            sock::Close(sockfd);
+
+            usleep(REPLICA_RETRY_MS * 1000);
+        }
+
+        return connections;
+    }
+}
+
+#endif
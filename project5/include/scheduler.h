@@ -0,0 +1,307 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define SCHED_MAX_WORKERS 64
+#define SCHED_MAX_IN_FLIGHT 1024    /* tarefas submetidas e ainda não entregues ao loop */
+#define SCHED_TASK_DATA 48          /* bytes de entrada/saída de uma tarefa */
+#define SCHED_IDLE_MS 50            /* espera de um worker sem tarefas antes de tentar roubar de novo */
+
+/*
+    Escalonador de tarefas com roubo de trabalho (LOBBY_WORKERS=<n>).
+
+    O loop do servidor submete tarefas de CPU (jogadas do bot, ...) e continua
+    atendendo a rede. Cada worker tem o seu deque: as tarefas submetidas são
+    distribuídas entre os deques em rodízio, o dono tira do fim (a mais
+    recente, ainda quente no cache) e um worker sem trabalho rouba metade
+    das tarefas do início do deque de outro, de uma vez. Cada deque tem o seu
+    lock, disputado só quando há roubo ou submissão.
+
+    O resultado fica na própria tarefa, que volta ao loop por uma fila de
+    conclusão; um byte num pipe (incluído no select) avisa o loop quando a
+    fila deixa de estar vazia, e drain() entrega as tarefas concluídas na
+    thread do loop.
+
+    Tudo é reservado em start(): nenhuma fila cresce, e no máximo
+    SCHED_MAX_IN_FLIGHT tarefas estão em andamento (submit() recusa as
+    demais), o que garante que nem os deques nem a fila de conclusão enchem.
+    Sem workers (o padrão) submit() sempre recusa e quem submete executa a
+    tarefa na hora.
+*/
+namespace sched {
+    /* chamada no início de cada worker (ex.: para tirá-lo da contagem de alocações) */
+    void (*onThreadStart)() = NULL;
+
+    class Task {
+        public:
+            void (*run)(Task &task);
+            int owner;                      // quem espera o resultado (slot do cliente, ...)
+            int tag;                        // geração de quem submeteu, para descartar resultados antigos
+            char data[SCHED_TASK_DATA];     // entrada e saída da tarefa
+    };
+
+    /* fila circular de tarefas com capacidade fixa, protegida por um lock */
+    class Deque {
+        public:
+            std::mutex lock;
+            std::vector<Task> tasks;
+            unsigned head, tail;            // início (roubo) e fim (dono) da fila
+
+            Deque() : head(0), tail(0) {}
+
+            void init(int capacity) { tasks.assign(capacity, Task()); }
+
+            int size() { return (int) (tail - head); }
+
+            void pushBack(const Task &task) {
+                std::lock_guard<std::mutex> guard(lock);
+
+                tasks[tail++ % tasks.size()] = task;
+            }
+
+            bool popBack(Task &task) {
+                std::lock_guard<std::mutex> guard(lock);
+
+                if (tail == head) return false;
+
+                task = tasks[--tail % tasks.size()];
+
+                return true;
+            }
+
+            bool popFront(Task &task) {
+                std::lock_guard<std::mutex> guard(lock);
+
+                if (tail == head) return false;
+
+                task = tasks[head++ % tasks.size()];
+
+                return true;
+            }
+
+            /* tira do início metade das tarefas (arredondada para cima) para `loot`; retorna quantas */
+            int stealHalf(Task *loot) {
+                std::lock_guard<std::mutex> guard(lock);
+
+                int n = (size() + 1) / 2;
+
+                for (int i = 0; i < n; ++i) loot[i] = tasks[head++ % tasks.size()];
+
+                return n;
+            }
+    };
+
+    class Scheduler {
+        public:
+            int numWorkers;
+            Deque deques[SCHED_MAX_WORKERS];
+            Deque completed;
+            std::vector<std::thread> threads;
+            int wakefd[2];                  // pipe que acorda o select do loop
+            unsigned next;                  // próximo deque do rodízio de submissões
+            int inFlight;                   // só o loop mexe: submetidas e ainda não entregues
+
+            std::mutex idleLock;
+            std::condition_variable idle;
+            std::atomic<int> queued;        // tarefas nos deques
+            std::atomic<bool> running;
+
+            std::atomic<long long> executed, stolen, steals;
+            long long inlined;
+
+            Scheduler() : numWorkers(0), next(0), inFlight(0), queued(0), running(false), executed(0), stolen(0), steals(0), inlined(0) {
+                wakefd[0] = wakefd[1] = -1;
+            }
+
+            bool enabled() { return numWorkers > 0; }
+
+            /* descritor a incluir no select do loop (-1 sem workers) */
+            int fd() { return wakefd[0]; }
+
+            void start(int workers) {
+                if (workers <= 0) return;
+
+                if (workers > SCHED_MAX_WORKERS) workers = SCHED_MAX_WORKERS;
+
+                if (pipe(wakefd) < 0) {
+                    perror("scheduler pipe error");
+                    exit(1);
+                }
+
+                fcntl(wakefd[0], F_SETFL, fcntl(wakefd[0], F_GETFL, 0) | O_NONBLOCK);
+                fcntl(wakefd[1], F_SETFL, fcntl(wakefd[1], F_GETFL, 0) | O_NONBLOCK);
+
+                numWorkers = workers;
+
+                for (int i = 0; i < numWorkers; ++i) deques[i].init(SCHED_MAX_IN_FLIGHT);
+
+                completed.init(SCHED_MAX_IN_FLIGHT);
+
+                running = true;
+
+                for (int i = 0; i < numWorkers; ++i) threads.push_back(std::thread(&Scheduler::work, this, i));
+            }
+
+            /* loop: entrega a tarefa a um worker; falso caso não haja workers ou já haja tarefas demais */
+            bool submit(const Task &task) {
+                if (!enabled() || inFlight >= SCHED_MAX_IN_FLIGHT) return false;
+
+                ++inFlight;
+
+                deques[next++ % numWorkers].pushBack(task);
+
+                {
+                    std::lock_guard<std::mutex> guard(idleLock);
+
+                    ++queued;
+                }
+
+                idle.notify_one();
+
+                return true;
+            }
+
+            /* loop: passa as tarefas concluídas para `handle`; retorna quantas foram entregues */
+            template <typename Handler>
+            int drain(Handler handle) {
+                char buf[64];
+                Task task;
+                int n = 0;
+
+                if (!enabled()) return 0;
+
+                /* esvazia o pipe antes da fila: um aviso que chegue depois corresponde a uma tarefa nova */
+                while (read(wakefd[0], buf, sizeof(buf)) > 0) {}
+
+                while (completed.popFront(task)) {
+                    --inFlight;
+                    ++n;
+
+                    handle(task);
+                }
+
+                return n;
+            }
+
+            /* executa a tarefa na thread atual (sem workers, ou com tarefas demais em andamento) */
+            void runInline(Task &task) {
+                task.run(task);
+
+                ++inlined;
+            }
+
+            void stop() {
+                if (!enabled()) return;
+
+                {
+                    std::lock_guard<std::mutex> guard(idleLock);
+
+                    running = false;
+                }
+
+                idle.notify_all();
+
+                for (auto &thread : threads) thread.join();
+
+                close(wakefd[0]);
+                close(wakefd[1]);
+
+                numWorkers = 0;
+            }
+
+            void report(FILE *fp) {
+                fprintf(fp, "tarefas: %d workers, %lld executadas (%lld roubadas em %lld roubos), %lld no loop\n",
+                        numWorkers, (long long) executed, (long long) stolen, (long long) steals, inlined);
+                fflush(fp);
+            }
+
+        private:
+            void complete(Task &task) {
+                bool wasEmpty;
+
+                {
+                    std::lock_guard<std::mutex> guard(completed.lock);
+
+                    wasEmpty = (completed.tail == completed.head);
+
+                    completed.tasks[completed.tail++ % completed.tasks.size()] = task;
+                }
+
+                ++executed;
+
+                if (wasEmpty) {
+                    char byte = 1;
+
+                    /* o pipe cheio já acorda o loop: o byte pode ser perdido */
+                    if (write(wakefd[1], &byte, 1) < 0) {}
+                }
+            }
+
+            /* rouba metade do deque de outro worker, a partir de um escolhido ao acaso */
+            bool steal(int me, Task *loot, unsigned &seed, Task &task) {
+                seed = seed * 1103515245 + 12345;
+
+                for (int k = 0, start = (int) ((seed >> 16) % numWorkers); k < numWorkers; ++k) {
+                    int victim = (start + k) % numWorkers;
+
+                    if (victim == me) continue;
+
+                    int n = deques[victim].stealHalf(loot);
+
+                    if (n == 0) continue;
+
+                    /* executa a primeira; as demais vão para o próprio deque (e podem ser roubadas de novo) */
+                    task = loot[0];
+
+                    for (int i = 1; i < n; ++i) deques[me].pushBack(loot[i]);
+
+                    --queued;
+
+                    stolen += n;
+                    ++steals;
+
+                    return true;
+                }
+
+                return false;
+            }
+
+            void work(int me) {
+                Task loot[SCHED_MAX_IN_FLIGHT / 2 + 1];     // na pilha: o worker não aloca nada
+                unsigned seed = me + 1;
+                Task task;
+
+                if (onThreadStart != NULL) onThreadStart();
+
+                while (running) {
+                    if (deques[me].popBack(task)) {
+                        --queued;
+                    } else if (!steal(me, loot, seed, task)) {
+                        std::unique_lock<std::mutex> guard(idleLock);
+
+                        idle.wait_for(guard, std::chrono::milliseconds(SCHED_IDLE_MS), [this] { return queued > 0 || !running; });
+
+                        continue;
+                    }
+
+                    task.run(task);
+
+                    complete(task);
+                }
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,407 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <string.h>
+
+#include <string>
+
+#define SCHEMA_MAX_FIELD (1 << 20)  /* maior tamanho aceito num campo de tamanho variável (sanidade) */
+
+/*
+    Descrição das mensagens do protocolo em tempo de compilação.
+
+    Uma mensagem é declarada uma única vez como a lista dos seus campos,
+
+        typedef schema::Message<sock::AcceptMsg, schema::Int, schema::String<ADDR_LEN - 1>> Accept;
+
+    e os templates geram a partir dela o codificador (todos os campos num
+    único buffer, escrito com uma única syscall), o decodificador, o tamanho
+    fixo (Message::fixed, -1 caso haja campo variável) e o tamanho máximo
+    (Message::maxSize, usado para dimensionar o buffer na pilha). O formato
+    no fio é o de sempre: campos na ordem declarada, na ordem de bytes da
+    máquina, strings e listas precedidas do seu tamanho (int). As mensagens
+    que dominam o tráfego (lista de clientes, AcceptMsg) usam os campos
+    compactos: VarInt/ZigZag (base 128) e Address (endereço binário).
+
+    Todo tipo de campo F fornece:
+
+        F::fixed                    tamanho em bytes, ou -1 caso variável
+        F::maxSize                  tamanho máximo em bytes, ou -1 caso ilimitado
+        F::need(buf, have)          bytes que o campo ocupa, sabendo que `buf` tem `have`
+                                    bytes dele; pode ser maior que `have` (faltam bytes)
+                                    e é -1 caso o campo seja inválido
+        F::encode(buf, valor)       retorna o número de bytes escritos
+        F::decode(buf, valor)       retorna o número de bytes lidos, ou -1 caso o valor
+                                    não caiba no destino
+
+    need() é o que permite ler uma mensagem do socket sem conhecer o seu
+    tamanho: lê-se o que need() pede até que ele pare de crescer.
+*/
+namespace schema {
+    /* string a codificar */
+    struct Text {
+        const char *data;
+        int len;
+
+        Text(const char *str) : data(str), len((int) strlen(str)) {}
+
+        Text(const char *str, int size) : data(str), len(size) {}
+    };
+
+    /* destino de uma string decodificada: `data` precisa de espaço para o maior valor mais o '\0' */
+    struct TextBuffer {
+        char *data;
+        int len;
+
+        TextBuffer(char *buf) : data(buf), len(0) {}
+    };
+
+    /* lista de ints a codificar */
+    struct Ints {
+        const int *data;
+        int count;
+
+        Ints(const int *values, int num) : data(values), count(num) {}
+    };
+
+    /* destino de uma lista de ints decodificada: `data` precisa de espaço para o maior valor */
+    struct IntBuffer {
+        int *data;
+        int count;
+
+        IntBuffer(int *buf) : data(buf), count(0) {}
+    };
+
+    /* endereço IPv4 ou IPv6 e porta, como no fio (endereço e porta na ordem da rede) */
+    struct Endpoint {
+        unsigned char family;       // 4 ou 6
+        unsigned char addr[16];
+        unsigned short port;
+    };
+
+    /* tamanho (int) que precede strings e listas; -1 caso inválido */
+    inline int lengthAt(const char *buf) {
+        int len;
+
+        memcpy(&len, buf, sizeof(len));
+
+        return (len < 0 || len > SCHEMA_MAX_FIELD) ? -1 : len;
+    }
+
+    template <typename T>
+    struct Scalar {
+        static const int fixed = sizeof(T);
+        static const int maxSize = sizeof(T);
+
+        static int need(const char *, int) { return sizeof(T); }
+
+        static int encode(char *buf, const T &value) {
+            memcpy(buf, &value, sizeof(T));
+            return sizeof(T);
+        }
+
+        static int decode(const char *buf, T &value) {
+            memcpy(&value, buf, sizeof(T));
+            return sizeof(T);
+        }
+    };
+
+    typedef Scalar<int> Int;
+    typedef Scalar<long long> Long;
+    typedef Scalar<bool> Bool;
+
+    /* tamanho (int) seguido de até N bytes */
+    template <int N>
+    struct String {
+        static const int fixed = -1;
+        static const int maxSize = sizeof(int) + N;
+
+        static int need(const char *buf, int have) {
+            if (have < (int) sizeof(int)) return sizeof(int);
+
+            int len = lengthAt(buf);
+
+            return (len < 0) ? -1 : (int) sizeof(int) + len;
+        }
+
+        /* textos maiores que N são truncados: o buffer de quem codifica comporta só maxSize bytes */
+        static int encode(char *buf, const Text &text) {
+            int len = (text.len < 0) ? 0 : (text.len > N) ? N : text.len;
+
+            memcpy(buf, &len, sizeof(int));
+            memcpy(buf + sizeof(int), text.data, len);
+            return sizeof(int) + len;
+        }
+
+        static int decode(const char *buf, TextBuffer &text) {
+            int len = lengthAt(buf);
+
+            if (len < 0 || len > N) return -1;
+
+            memcpy(text.data, buf + sizeof(int), len);
+            text.data[len] = '\0';
+            text.len = len;
+
+            return sizeof(int) + len;
+        }
+
+        static int decode(const char *buf, std::string &text) {
+            int len = lengthAt(buf);
+
+            if (len < 0 || len > N) return -1;
+
+            text.assign(buf + sizeof(int), len);
+
+            return sizeof(int) + len;
+        }
+    };
+
+    /* número de ints (int) seguido de até N ints */
+    template <int N>
+    struct IntArray {
+        static const int fixed = -1;
+        static const int maxSize = sizeof(int) * (1 + N);
+
+        static int need(const char *buf, int have) {
+            if (have < (int) sizeof(int)) return sizeof(int);
+
+            int count = lengthAt(buf);
+
+            return (count < 0) ? -1 : (int) sizeof(int) * (1 + count);
+        }
+
+        /* listas maiores que N são truncadas, como em String */
+        static int encode(char *buf, const Ints &ints) {
+            int count = (ints.count < 0) ? 0 : (ints.count > N) ? N : ints.count;
+
+            memcpy(buf, &count, sizeof(int));
+            memcpy(buf + sizeof(int), ints.data, count * sizeof(int));
+            return sizeof(int) * (1 + count);
+        }
+
+        static int decode(const char *buf, IntBuffer &ints) {
+            int count = lengthAt(buf);
+
+            if (count < 0 || count > N) return -1;
+
+            memcpy(ints.data, buf + sizeof(int), count * sizeof(int));
+            ints.count = count;
+
+            return sizeof(int) * (1 + count);
+        }
+    };
+
+    /* inteiro não negativo em base 128 (1 byte até 127, no máximo 5); o bit alto de cada byte indica que há mais */
+    struct VarInt {
+        static const int fixed = -1;
+        static const int maxSize = 5;
+
+        static int need(const char *buf, int have) {
+            for (int i = 0; i < have && i < maxSize; ++i) {
+                if (!(buf[i] & 0x80)) return i + 1;
+            }
+
+            return (have >= maxSize) ? -1 : have + 1;
+        }
+
+        static int encode(char *buf, const int &value) {
+            unsigned v = (unsigned) value;
+            int n = 0;
+
+            for (; v >= 0x80; v >>= 7) buf[n++] = (char) (v | 0x80);
+
+            buf[n++] = (char) v;
+
+            return n;
+        }
+
+        static int decode(const char *buf, int &value) {
+            unsigned v = 0;
+            int n = 0;
+
+            do {
+                v |= (unsigned) (buf[n] & 0x7f) << (7 * n);
+            } while (buf[n++] & 0x80);
+
+            value = (int) v;
+
+            return n;
+        }
+    };
+
+    /* inteiro com sinal em base 128: 0, -1, 1, -2, ... viram 0, 1, 2, 3, ... (zigzag) */
+    struct ZigZag {
+        static const int fixed = -1;
+        static const int maxSize = VarInt::maxSize;
+
+        static int need(const char *buf, int have) { return VarInt::need(buf, have); }
+
+        static int encode(char *buf, const int &value) {
+            return VarInt::encode(buf, (int) (((unsigned) value << 1) ^ (unsigned) (value >> 31)));
+        }
+
+        static int decode(const char *buf, int &value) {
+            int v, n = VarInt::decode(buf, v);
+
+            value = (int) (((unsigned) v >> 1) ^ -((unsigned) v & 1));
+
+            return n;
+        }
+    };
+
+    /* família (1 byte), endereço (4 ou 16 bytes) e porta (2 bytes) */
+    struct Address {
+        static const int fixed = -1;
+        static const int maxSize = 1 + 16 + 2;
+
+        static int size(unsigned char family) { return (family == 6) ? 1 + 16 + 2 : 1 + 4 + 2; }
+
+        static int need(const char *buf, int have) {
+            if (have < 1) return 1;
+
+            return (buf[0] == 4 || buf[0] == 6) ? size(buf[0]) : -1;
+        }
+
+        static int encode(char *buf, const Endpoint &endpoint) {
+            int len = (endpoint.family == 6) ? 16 : 4;
+
+            buf[0] = (endpoint.family == 6) ? 6 : 4;
+            memcpy(buf + 1, endpoint.addr, len);
+            memcpy(buf + 1 + len, &endpoint.port, sizeof(endpoint.port));
+
+            return 1 + len + sizeof(endpoint.port);
+        }
+
+        static int decode(const char *buf, Endpoint &endpoint) {
+            int len = (buf[0] == 6) ? 16 : 4;
+
+            memset(&endpoint, 0, sizeof(endpoint));
+
+            endpoint.family = buf[0];
+            memcpy(endpoint.addr, buf + 1, len);
+            memcpy(&endpoint.port, buf + 1 + len, sizeof(endpoint.port));
+
+            return 1 + len + sizeof(endpoint.port);
+        }
+    };
+
+    /*
+        tamanho (int) seguido de bytes com formato próprio (os registros de uma lista,
+        por exemplo). Só é medido: quem lê recebe o tamanho, lê os bytes de uma vez e
+        os decodifica com Record::parse.
+    */
+    struct Bytes {
+        static const int fixed = -1;
+        static const int maxSize = -1;
+
+        static int need(const char *buf, int have) {
+            if (have < (int) sizeof(int)) return sizeof(int);
+
+            int len = lengthAt(buf);
+
+            return (len < 0) ? -1 : (int) sizeof(int) + len;
+        }
+    };
+
+    /* sequência de campos, sem o status */
+    template <typename... F>
+    struct Fields;
+
+    template <>
+    struct Fields<> {
+        static const int fixed = 0;
+        static const int maxSize = 0;
+
+        static int need(const char *, int, int off) { return off; }
+
+        static int encode(char *) { return 0; }
+
+        static int decode(const char *) { return 0; }
+    };
+
+    template <typename F, typename... Rest>
+    struct Fields<F, Rest...> {
+        typedef Fields<Rest...> Tail;
+
+        static const int fixed = (F::fixed < 0 || Tail::fixed < 0) ? -1 : F::fixed + Tail::fixed;
+        static const int maxSize = (F::maxSize < 0 || Tail::maxSize < 0) ? -1 : F::maxSize + Tail::maxSize;
+
+        /* `off` é onde este campo começa em `buf` */
+        static int need(const char *buf, int have, int off) {
+            int n = F::need(buf + off, have - off);
+
+            if (n < 0) return -1;
+
+            /* o campo ainda não chegou inteiro: os seguintes não podem ser medidos */
+            if (off + n > have) return off + n;
+
+            return Tail::need(buf, have, off + n);
+        }
+
+        template <typename V, typename... Vs>
+        static int encode(char *buf, const V &value, const Vs &... values) {
+            int n = F::encode(buf, value);
+
+            return n + Tail::encode(buf + n, values...);
+        }
+
+        template <typename V, typename... Vs>
+        static int decode(const char *buf, V &value, Vs &... values) {
+            int n = F::decode(buf, value), m;
+
+            if (n < 0 || (m = Tail::decode(buf + n, values...)) < 0) return -1;
+
+            return n + m;
+        }
+    };
+
+    /* registro: os campos sem status */
+    template <typename... F>
+    struct Record : Fields<F...> {
+        typedef Record Body;
+
+        static int need(const char *buf, int have) { return Fields<F...>::need(buf, have, 0); }
+
+        /* decodifica o registro no início de `buf`, que tem `len` bytes; retorna o tamanho, ou -1 caso não caiba */
+        template <typename... V>
+        static int parse(const char *buf, int len, V &... values) {
+            int n = need(buf, len);
+
+            if (n < 0 || n > len) return -1;
+
+            return Fields<F...>::decode(buf, values...);
+        }
+    };
+
+    template <char S, typename... F>
+    struct Message {
+        typedef Record<F...> Body;
+
+        static const char status = S;
+        static const int fixed = (Body::fixed < 0) ? -1 : 1 + Body::fixed;
+        static const int maxSize = (Body::maxSize < 0) ? -1 : 1 + Body::maxSize;
+
+        /* codifica status e campos em `buf` (com pelo menos maxSize bytes); retorna o tamanho */
+        template <typename... V>
+        static int encode(char *buf, const V &... values) {
+            buf[0] = S;
+
+            return 1 + Body::encode(buf + 1, values...);
+        }
+
+        /* tamanho da mensagem no início de `buf`; 0 caso ela ainda esteja incompleta, -1 caso seja inválida */
+        static int measure(const char *buf, int len) {
+            if (len < 1) return 0;
+
+            if (buf[0] != S) return -1;
+
+            int n = Body::need(buf + 1, len - 1);
+
+            if (n < 0) return -1;
+
+            return (1 + n <= len) ? 1 + n : 0;
+        }
+    };
+}
+
+#endif
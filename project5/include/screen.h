@@ -0,0 +1,129 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <string>
+#include <vector>
+
+/*
+    Desenho incremental da tela do cliente.
+
+    A tela é montada como um vetor de linhas (um quadro) e comparada com o
+    quadro anterior: só as linhas que mudaram são reescritas (posicionando o
+    cursor na linha e apagando o resto dela), tudo num único write. Cada
+    linha é cortada na largura do terminal, para que uma linha do quadro
+    seja sempre uma linha da tela; quem monta o quadro usa rows() para
+    mostrar só o que cabe.
+
+    Qualquer outra escrita que apague a tela (jogo, convites, ...) precisa
+    chamar invalidate(), e o próximo quadro é desenhado inteiro.
+*/
+namespace screen {
+    /* número de caracteres (não de bytes) de uma string UTF-8 */
+    int width(const std::string &line) {
+        int n = 0;
+
+        for (size_t i = 0; i < line.size(); ++i) {
+            if ((line[i] & 0xC0) != 0x80) ++n;
+        }
+
+        return n;
+    }
+
+    /* corta `line` em `cols` caracteres, sem quebrar um caractere UTF-8 */
+    void fit(std::string &line, int cols) {
+        int n = 0;
+
+        for (size_t i = 0; i < line.size(); ++i) {
+            if ((line[i] & 0xC0) != 0x80 && ++n > cols) {
+                line.resize(i);
+                return;
+            }
+        }
+    }
+
+    class Renderer {
+        public:
+            std::vector<std::string> previous;
+            std::string out;
+            bool valid;
+            int numRows, numCols;
+
+            Renderer() : valid(false), numRows(24), numCols(80) {}
+
+            void invalidate() { valid = false; }
+
+            /* tamanho do terminal (24x80 quando a saída não é um terminal); mudou = redesenho completo */
+            void measure() {
+                struct winsize ws;
+
+                if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) < 0 || ws.ws_row == 0 || ws.ws_col == 0) return;
+
+                if (ws.ws_row != numRows || ws.ws_col != numCols) valid = false;
+
+                numRows = ws.ws_row;
+                numCols = ws.ws_col;
+            }
+
+            int rows() { return numRows; }
+
+            void moveTo(int row, int col) {
+                char seq[32];
+
+                snprintf(seq, sizeof(seq), "\033[%d;%dH", row, col);
+
+                out += seq;
+            }
+
+            /* desenha `frame` (que é cortado na largura do terminal) e deixa o cursor no fim da última linha */
+            void render(std::vector<std::string> &frame) {
+                out.clear();
+
+                if (!valid) {
+                    out += "\033[H\033[2J";
+                    previous.clear();
+                }
+
+                for (size_t i = 0; i < frame.size(); ++i) {
+                    fit(frame[i], numCols);
+
+                    /* a última linha é o prompt, onde o terminal ecoa o que é digitado: sempre reescrita */
+                    if (i + 1 < frame.size() && i < previous.size() && previous[i] == frame[i]) continue;
+
+                    moveTo(i + 1, 1);
+
+                    out += frame[i];
+                    out += "\033[K";
+                }
+
+                /* linhas que sobraram do quadro anterior */
+                for (size_t i = frame.size(); i < previous.size(); ++i) {
+                    moveTo(i + 1, 1);
+
+                    out += "\033[K";
+                }
+
+                if (!frame.empty()) moveTo(frame.size(), width(frame.back()) + 1);
+
+                /* o que foi escrito com printf antes precisa sair antes deste quadro */
+                fflush(stdout);
+
+                for (size_t off = 0; off < out.size(); ) {
+                    ssize_t n = write(STDOUT_FILENO, out.data() + off, out.size() - off);
+
+                    if (n <= 0) break;
+
+                    off += n;
+                }
+
+                previous = frame;
+                valid = true;
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <socket.h>
+#include <lobby.h>
+
+#include <string>
+#include <vector>
+
+#define MAX_SHARDS 16
+#define MAX_DATAGRAM 60000
+#define GOSSIP_INTERVAL_MS 200
+#define SHARD_TIMEOUT_MS 3000
+#define ACCEPT_TIMEOUT_MS 2000      /* espera pelo AcceptAck (ou Abort) antes de liberar quem aceitou */
+
+/* tipo (1) + shardId (4) + seq (4) + parte (4) */
+#define PRESENCE_COUNT_OFFSET 13
+/* id (4) + score (4) + RTT (4) + disponível (1) + tamanho do endereço (4) + tamanho do nome da sala (4) */
+#define PRESENCE_ENTRY_SIZE 21
+
+/*
+    Lobby particionado horizontalmente entre vários processos servidor (shards).
+
+    Cada shard é dono dos jogadores conectados a ele. O id global de um jogador
+    é `slot * numShards + shardId`, onde `slot` é o índice do cliente no vetor
+    client[] do shard dono; assim qualquer shard sabe quem é o dono de um id
+    sem consultar ninguém. Com um único shard (numShards = 1) os ids são os
+    próprios slots, exatamente como no servidor original.
+
+    Os shards conversam por um socket UDP (a "malha"): periodicamente cada um
+    envia um resumo de presença (id, score, RTT, disponibilidade, endereço e
+    sala dos seus jogadores) para os demais, e os convites (NewGameMsg/AcceptMsg/
+    DenyMsg) entre jogadores de shards diferentes são roteados para o shard
+    dono.
+*/
+namespace shard {
+    enum MeshMsg : char {
+        Presence,   // resumo dos jogadores de um shard
+        Invite,     // NewGameMsg para um jogador de outro shard
+        Accept,     // AcceptMsg para o shard dono de quem convidou
+        AcceptAck,  // o jogo foi aceito: resposta para o shard de quem aceitou
+        Abort,      // o jogo não pôde começar: libera a reserva de quem aceitou
+        Deny,       // DenyMsg para um jogador de outro shard
+        Broadcast   // anúncio feito por um jogador de outro shard
+    };
+
+    class Packet {
+        public:
+            char buf[MAX_DATAGRAM + 1];
+            int len, pos;
+
+            Packet() : len(0), pos(0) {}
+
+            template <typename T>
+            void put(const T &value) {
+                memcpy(buf + len, &value, sizeof(value));
+                len += sizeof(value);
+            }
+
+            void putString(const char *str, int size) {
+                put(size);
+                memcpy(buf + len, str, size);
+                len += size;
+            }
+
+            /* retorna falso caso o datagrama recebido esteja truncado */
+            template <typename T>
+            bool get(T &value) {
+                if (pos + (int) sizeof(value) > len) return false;
+                memcpy(&value, buf + pos, sizeof(value));
+                pos += sizeof(value);
+                return true;
+            }
+
+            /* copia a string para `str` (terminada em '\0'); falha caso não caiba em maxlen bytes */
+            bool getString(char *str, int maxlen, int &size) {
+                if (!get(size) || size < 0 || size >= maxlen || pos + size > len) return false;
+                memcpy(str, buf + pos, size);
+                str[size] = '\0';
+                pos += size;
+                return true;
+            }
+    };
+
+    class Mesh {
+        public:
+            int id, count, fd;
+            int seq;
+            std::vector<sock::SocketAddr> peers;
+            long long lastSeen[MAX_SHARDS];
+            int snapshot[MAX_SHARDS];       // seq do último resumo de cada shard cuja parte 0 chegou (-1 = nenhum)
+
+            Mesh() : id(0), count(1), fd(-1), seq(0) {
+                for (int i = 0; i < MAX_SHARDS; ++i) {
+                    lastSeen[i] = 0;
+                    snapshot[i] = -1;
+                }
+            }
+
+            /*
+                `addresses` contém o "ip:porta" da malha de todos os shards, na ordem
+                dos ids; o socket UDP deste shard é associado ao endereço de índice `shardId`
+                (ou, caso `sockfd` seja dado, é um socket já associado herdado de outro processo)
+            */
+            void open(int shardId, std::vector<std::string> &addresses, int sockfd = -1) {
+                if (addresses.size() < 2 || (int) addresses.size() > MAX_SHARDS || shardId < 0 || shardId >= (int) addresses.size()) {
+                    perror("invalid shard configuration");
+                    exit(1);
+                }
+
+                id = shardId;
+                count = (int) addresses.size();
+
+                for (auto &address : addresses) {
+                    std::string ip = address.substr(0, address.find(":"));
+                    int port = atoi(address.substr(address.find(":") + 1).c_str());
+
+                    peers.push_back(sock::SocketAddr(AF_INET, ip.c_str(), port));
+                }
+
+                if (sockfd >= 0) {
+                    fd = sockfd;
+                    return;
+                }
+
+                fd = sock::Socket(AF_INET, SOCK_DGRAM, 0);
+
+                sock::Bind(fd, &peers[id]);
+            }
+
+            bool enabled() { return count > 1; }
+
+            int playerId(int slot) { return slot * count + id; }
+
+            int owner(int playerId) { return playerId % count; }
+
+            bool isLocal(int playerId) { return playerId >= 0 && owner(playerId) == id; }
+
+            /* retorna o slot de um jogador local, ou -1 caso o id seja inválido */
+            int slotOf(int playerId) {
+                if (!isLocal(playerId) || playerId / count >= FD_SETSIZE) return -1;
+
+                return playerId / count;
+            }
+
+            void send(int shardId, Packet &packet) {
+                if (shardId >= 0 && shardId < count && shardId != id) {
+                    sock::Sendto(fd, packet.buf, packet.len, &peers[shardId]);
+                }
+            }
+
+            void sendAll(Packet &packet) {
+                for (int i = 0; i < count; ++i) send(i, packet);
+            }
+
+            int receive(Packet &packet) {
+                packet.pos = 0;
+                packet.len = sock::Recvfrom(fd, packet.buf, MAX_DATAGRAM, NULL);
+
+                return packet.len;
+            }
+
+            /* mensagens de convite: todas carregam o id de origem e o de destino */
+            void sendInvite(MeshMsg type, int from, int to) {
+                Packet packet;
+
+                packet.put(type);
+                packet.put(from);
+                packet.put(to);
+
+                send(owner(to), packet);
+            }
+
+            void sendAccept(MeshMsg type, int from, int to, const char *address, int randNum) {
+                Packet packet;
+
+                packet.put(type);
+                packet.put(from);
+                packet.put(to);
+                packet.put(randNum);
+                packet.putString(address, (int) strlen(address));
+
+                send(owner(to), packet);
+            }
+
+            void sendBroadcast(int from, const char *text, int len, const char *room) {
+                Packet packet;
+
+                packet.put(Broadcast);
+                packet.put(from);
+                packet.putString(text, len);
+                packet.putString(room, (int) strlen(room));
+
+                sendAll(packet);
+            }
+
+            /* cabeçalho de uma parte do resumo de presença; o número de jogadores é preenchido depois */
+            void beginPresence(Packet &packet, int part) {
+                int num = 0;
+
+                packet.len = 0;
+                packet.put(Presence);
+                packet.put(id);
+                packet.put(seq);
+                packet.put(part);
+                packet.put(num);
+            }
+
+            void endPresence(Packet &packet, int num) {
+                memcpy(packet.buf + PRESENCE_COUNT_OFFSET, &num, sizeof(num));
+
+                sendAll(packet);
+            }
+
+            /*
+                envia o resumo dos jogadores locais. O resumo pode ser dividido em várias
+                partes; todas carregam o mesmo `seq`, e quem recebe a parte 0 descarta
+                o que sabia antes sobre este shard.
+            */
+            void gossip(lobby::Roster &roster) {
+                Packet packet;
+                int part = 0, num = 0;
+
+                ++seq;
+
+                beginPresence(packet, part);
+
+                for (int i = 0; i < roster.size(); ++i) {
+                    int cli_id = roster.present[i];
+
+                    if (!isLocal(cli_id)) continue;
+
+                    lobby::Player &cli = roster.at(cli_id);
+                    int len = (int) strlen(cli.address);
+                    const char *room = roster.roomName(cli_id);
+                    int roomLen = (int) strlen(room);
+
+                    /* o jogador não cabe mais neste datagrama: envia e começa a próxima parte */
+                    if (packet.len + PRESENCE_ENTRY_SIZE + len + roomLen > MAX_DATAGRAM) {
+                        endPresence(packet, num);
+                        beginPresence(packet, ++part);
+                        num = 0;
+                    }
+
+                    bool available = !cli.playing;
+                    int rtt = roster.latency(cli_id);
+
+                    packet.put(cli_id);
+                    packet.put(cli.score);
+                    packet.put(rtt);
+                    packet.put(available);
+                    packet.putString(cli.address, len);
+                    packet.putString(room, roomLen);
+                    ++num;
+                }
+
+                endPresence(packet, num);
+            }
+
+            /* remove da visão global todos os jogadores pertencentes ao shard `shardId` */
+            void forget(int shardId, lobby::Roster &roster) {
+                /* de trás para frente: a remoção move o último elemento para a posição removida */
+                for (int i = roster.size() - 1; i >= 0; --i) {
+                    if (owner(roster.present[i]) == shardId) roster.remove(roster.present[i]);
+                }
+            }
+
+            void applyPresence(Packet &packet, lobby::Roster &roster) {
+                int shardId, msgSeq, part, num;
+
+                if (!packet.get(shardId) || !packet.get(msgSeq) || !packet.get(part) || !packet.get(num)) return;
+
+                if (shardId < 0 || shardId >= count || shardId == id) return;
+
+                lastSeen[shardId] = sock::nowMs();
+
+                /*
+                    a parte 0 abre um novo resumo; as demais só valem para o resumo aberto
+                    (uma parte de um resumo cuja parte 0 se perdeu, ou chegou fora de ordem, é descartada)
+                */
+                if (part == 0) {
+                    forget(shardId, roster);
+                    snapshot[shardId] = msgSeq;
+                } else if (msgSeq != snapshot[shardId]) {
+                    return;
+                }
+
+                for (int i = 0; i < num; ++i) {
+                    int cli_id, score, rtt, len;
+                    bool available;
+                    char address[ADDR_LEN], room[ROOM_NAME_LEN];
+
+                    if (!packet.get(cli_id) || !packet.get(score) || !packet.get(rtt) || !packet.get(available) || !packet.getString(address, ADDR_LEN, len)
+                            || !packet.getString(room, ROOM_NAME_LEN, len)) return;
+
+                    if (owner(cli_id) != shardId) continue;
+
+                    /* um jogador já conhecido só é recriado caso o endereço tenha mudado; os demais campos são atualizados */
+                    if ((!roster.has(cli_id) || strcmp(roster.at(cli_id).address, address) != 0) && !roster.add(cli_id, address)) continue;
+
+                    lobby::Player &player = roster.at(cli_id);
+
+                    if (player.score != score || player.playing != !available || player.rtt != rtt) roster.changed.insert(cli_id);
+
+                    player.score = score;
+                    player.playing = !available;
+                    player.rtt = rtt;
+
+                    /* as salas são casadas pelo nome (o índice de uma sala é local a cada shard) */
+                    roster.join(cli_id, roster.findRoom(room, true));
+                }
+            }
+
+            /* esquece shards que pararam de enviar presença */
+            void expire(lobby::Roster &roster) {
+                long long now = sock::nowMs();
+
+                for (int i = 0; i < count; ++i) {
+                    if (i != id && lastSeen[i] != 0 && now - lastSeen[i] > SHARD_TIMEOUT_MS) {
+                        forget(i, roster);
+                        lastSeen[i] = 0;
+                    }
+                }
+            }
+    };
+
+    /*
+        Jogadores locais que aceitaram o convite de outro shard: ficam reservados
+        (jogando) até o AcceptAck ou o Abort do shard de quem convidou. Como a
+        malha é UDP, qualquer um dos datagramas pode se perder; a reserva expira
+        em ACCEPT_TIMEOUT_MS, e uma resposta que chegue depois é ignorada.
+    */
+    class Reservations {
+        public:
+            std::vector<int> peer;              // quem convidou, por slot
+            std::vector<long long> deadline;
+            lobby::IndexSet slots;
+
+            void init(int numSlots) {
+                peer.assign(numSlots, -1);
+                deadline.assign(numSlots, 0);
+                slots.init(numSlots);
+            }
+
+            bool empty() { return slots.empty(); }
+
+            void hold(int slot, int idPeer, long long nowMs) {
+                peer[slot] = idPeer;
+                deadline[slot] = nowMs + ACCEPT_TIMEOUT_MS;
+
+                slots.insert(slot);
+            }
+
+            /* encerra a reserva do slot; falso caso ele não esteja esperando uma resposta de `idPeer` */
+            bool release(int slot, int idPeer) {
+                if (!slots.has(slot) || peer[slot] != idPeer) return false;
+
+                slots.erase(slot);
+
+                return true;
+            }
+
+            /* o jogador saiu: não há mais o que liberar */
+            void drop(int slot) { slots.erase(slot); }
+
+            /* entrega as reservas vencidas a `expire(slot, idPeer)` e as esquece */
+            template <typename Expire>
+            void expire(long long nowMs, Expire expire) {
+                /* de trás para frente: a remoção move o último elemento para a posição removida */
+                for (int k = slots.size - 1; k >= 0; --k) {
+                    int slot = slots[k];
+
+                    if (nowMs < deadline[slot]) continue;
+
+                    slots.erase(slot);
+
+                    expire(slot, peer[slot]);
+                }
+            }
+    };
+}
+
+#endif
@@ -13,12 +13,32 @@
 #include <sys/socket.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/uio.h>
+
+#include <schema.h>
+#include <trace.h>
+#include <iostat.h>
 
 #include <set>
 #include <map>
 #include <string>
+#include <vector>
 
 #define MAX_LINE 1000
+#define VIRTUAL_FD_BASE (1 << 24)   /* descritores de conexões em memória (ver sock::Transport) */
+
+#define MAX_BROADCAST 256
+#define MAX_BROADCAST_BATCH 8192
+/* status (1) + id de quem enviou (4) + tamanho do texto (4) */
+#define BROADCAST_HEADER_SIZE 9
+#define ADDR_LEN 24         /* "255.255.255.255:65535" + '\0' */
+#define ROOM_NAME_LEN 16    /* nome de sala (RoomMsg), incluindo o '\0' */
+#define MAXSUBSCRIBE 64     /* ids num SubscribeMsg/UnsubscribeMsg */
+#define BEST_PEER -1        /* NewGameMsg para este id: o servidor escolhe o adversário de menor latência */
+#define BOT_PEER -2         /* NewGameMsg para este id: partida contra o próprio servidor (ver include/bot.h) */
+
+/* limite para tabelas indexadas pelo MessageStatus */
+#define NUM_MSG_TYPES 16
 
 namespace sock {
     enum MessageStatus : char {
@@ -26,7 +46,33 @@ namespace sock {
         AcceptMsg,
         DenyMsg,
         UpdateList,
-        FinishGame
+        FinishGame,
+        SubscribeMsg,
+        UnsubscribeMsg,
+        PresenceMsg,
+        BroadcastMsg,
+        SessionMsg,     // servidor -> cliente: id e ficha da sessão
+        ResumeMsg,      // cliente -> servidor: retoma a sessão anterior depois de um reinício
+        RoomMsg,        // cliente -> servidor: entra numa sala; servidor -> cliente: sala atual
+        PingMsg         // servidor -> cliente: marca de tempo, que o cliente devolve (mede o RTT)
+    };
+
+    const char *messageName(int status) {
+        static const char *names[] = {
+            "NewGameMsg", "AcceptMsg", "DenyMsg", "UpdateList", "FinishGame",
+            "SubscribeMsg", "UnsubscribeMsg", "PresenceMsg", "BroadcastMsg",
+            "SessionMsg", "ResumeMsg", "RoomMsg", "PingMsg"
+        };
+
+        if (status < 0 || status >= (int) (sizeof(names) / sizeof(names[0]))) return "Unknown";
+
+        return names[status];
+    }
+
+    enum PresenceStatus : char {
+        PlayerAvailable,
+        PlayerPlaying,
+        PlayerLeft
     };
 
     class SocketAddr {
@@ -180,7 +226,11 @@ namespace sock {
             Caso o retorno do accept seja igual a -1, então houve algum erro com a tentativa
             de aceitar a conexão com o cliente.
         */
-        if ((connfd = accept(sockfd, sockAddrAux, &addrlen)) == -1 ) {
+        IOSTAT_BEGIN();
+        connfd = accept(sockfd, sockAddrAux, &addrlen);
+        IOSTAT_END(OpAccept, -1, connfd);
+
+        if (connfd == -1 ) {
             perror("accept");
             exit(1);
         }
@@ -206,38 +256,175 @@ namespace sock {
         }
     }
 
+    /* observadores opcionais dos bytes lidos e escritos nos sockets (captura de tráfego, ver include/capture.h) */
+    typedef void (*IoHook)(int sockfd, const char *buf, int len);
+
+    IoHook inputHook = NULL, outputHook = NULL;
+
+    /*
+        Transporte sem o kernel: descritores a partir de VIRTUAL_FD_BASE são
+        conexões em memória (include/loopback.h), e Read/Write/Writev/Close os
+        entregam às funções registradas aqui. write com `block` falso escreve
+        o que couber (0 caso nada caiba); -1 indica que o outro lado fechou.
+    */
+    class Transport {
+        public:
+            int (*read)(int sockfd, char *buf, int len);
+            int (*write)(int sockfd, const char *buf, int len, bool block);
+            void (*close)(int sockfd);
+    };
+
+    Transport *transport = NULL;
+
+    inline bool isVirtual(int sockfd) { return sockfd >= VIRTUAL_FD_BASE && transport != NULL; }
+
     void Write(int sockfd, char *buf, int sizebuf) {
+        TRACE_SPAN(StageWrite, sockfd);
+
         /*
             escreve o buffer `buf` no socket connfd conectado com o cliente, para que o
             possa receber o horário obtido pelo servidor
         */
 
+        int n;
+
+        if (isVirtual(sockfd)) {
+            n = transport->write(sockfd, buf, sizebuf, true);
+        } else {
+            IOSTAT_BEGIN();
+            n = write(sockfd, buf, sizebuf);
+            IOSTAT_END(OpWrite, sizebuf, n);
+        }
+
         /* verifica se houve algum erro com a escrita do buffer no socket descriptor */
-        if (!write(sockfd, buf, sizebuf)) {
+        if (!n) {
             perror("Something went wrong");
             exit(1);
         }
+
+        if (outputHook != NULL && n > 0) outputHook(sockfd, buf, n);
     }
 
     int Read(int sockfd, char *recvline, int maxline) {
         int n;
 
-        if ((n = read(sockfd, recvline, maxline)) < 0) {
+        TRACE_SPAN(StageRead, sockfd);
+
+        if (isVirtual(sockfd)) {
+            n = transport->read(sockfd, recvline, maxline);
+        } else {
+            IOSTAT_BEGIN();
+            n = read(sockfd, recvline, maxline);
+            IOSTAT_END(OpRead, maxline, n);
+        }
+
+        if (n < 0) {
+            /* conexão abortada pelo outro lado (RST): tratada como fim de conexão */
+            if (errno == ECONNRESET) return 0;
+
             perror("read error");
             exit(1);
         }
+
+        if (inputHook != NULL && n > 0) inputHook(sockfd, recvline, n);
         
         // recvline[n] = 0;
 
         return n;
     }
 
+    /* passa ao gancho de saída os `n` primeiros bytes de `iov` */
+    void writevHook(int sockfd, struct iovec *iov, int iovcnt, int n) {
+        for (int i = 0; i < iovcnt && n > 0; ++i) {
+            int len = ((int) iov[i].iov_len < n) ? (int) iov[i].iov_len : n;
+
+            outputHook(sockfd, (char *) iov[i].iov_base, len);
+
+            n -= len;
+        }
+    }
+
+    /* Writev numa conexão em memória, com a mesma semântica: escreve o que couber, -1 caso nada caiba */
+    int writevVirtual(int sockfd, struct iovec *iov, int iovcnt, int total) {
+        int n = 0;
+
+        for (int i = 0; i < iovcnt; ++i) {
+            int w = transport->write(sockfd, (const char *) iov[i].iov_base, iov[i].iov_len, false);
+
+            if (w < 0) return -1;
+
+            n += w;
+
+            if (w < (int) iov[i].iov_len) break;
+        }
+
+        if (n == 0 && total > 0) return -1;
+
+        if (outputHook != NULL) writevHook(sockfd, iov, iovcnt, n);
+
+        return n;
+    }
+
+    int Writev(int sockfd, struct iovec *iov, int iovcnt) {
+        struct msghdr msg;
+        int n, total = 0;
+
+        TRACE_SPAN(StageWrite, sockfd);
+
+        bzero(&msg, sizeof(msg));
+
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        for (int i = 0; i < iovcnt; ++i) total += iov[i].iov_len;
+
+        if (isVirtual(sockfd)) return writevVirtual(sockfd, iov, iovcnt, total);
+
+        /*
+            writev não bloqueante (sendmsg com MSG_DONTWAIT): retorna quantos bytes
+            couberam no buffer de envio, ou -1 caso nada tenha sido escrito. Uma
+            escrita parcial deixa uma mensagem pela metade na conexão: cabe a quem
+            chama descartá-la (ver Shutdown)
+        */
+        IOSTAT_BEGIN();
+        n = sendmsg(sockfd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        IOSTAT_END(OpWritev, total, n);
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EPIPE || errno == ECONNRESET) return -1;
+
+            perror("sendmsg error");
+            exit(1);
+        }
+
+        if (n == 0 && total > 0) return -1;
+
+        if (outputHook != NULL) writevHook(sockfd, iov, iovcnt, n);
+
+        return n;
+    }
+
+    /*
+        encerra a conexão sem liberar o descritor: o próximo Read retorna 0 e o
+        dono da conexão a fecha pelo caminho normal. Numa conexão em memória é o
+        outro lado que vê o fim e fecha a sua ponta
+    */
+    void Shutdown(int sockfd) {
+        if (isVirtual(sockfd)) transport->close(sockfd);
+        else shutdown(sockfd, SHUT_RDWR);
+    }
+
     void Close(int sockfd) {
       /* 
          Quando chamamos a syscall close(), começamos a sequência padrão para término da conexão TCP.
          Um FIN é enviado para cada direção e cada FIN é reconhecido pelos extremos (servidor e cliente)
          para que assim a conexão seja de fato terminada.
       */
+      if (isVirtual(sockfd)) {
+          transport->close(sockfd);
+          return;
+      }
+
       close(sockfd);
     }
 
@@ -327,7 +514,17 @@ namespace sock {
     int Select(int maxfdp1, fd_set *rset) {
         int n;
         
-        if ((n = select(maxfdp1, rset, NULL, NULL, NULL)) < 0) {
+        IOSTAT_BEGIN();
+        n = select(maxfdp1, rset, NULL, NULL, NULL);
+        IOSTAT_END(OpSelect, -1, n);
+
+        if (n < 0) {
+            /* interrompido por um sinal: nenhum descritor pronto */
+            if (errno == EINTR) {
+                FD_ZERO(rset);
+                return 0;
+            }
+
             perror("select error");
             exit(1);
         }
@@ -335,12 +532,76 @@ namespace sock {
         return n;
     }
 
+    int Select(int maxfdp1, fd_set *rset, struct timeval *timeout) {
+        int n;
+
+        /* igual ao Select acima, mas retorna 0 caso o tempo `timeout` se esgote */
+        IOSTAT_BEGIN();
+        n = select(maxfdp1, rset, NULL, NULL, timeout);
+        IOSTAT_END(OpSelect, -1, n);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                FD_ZERO(rset);
+                return 0;
+            }
+
+            perror("select error");
+            exit(1);
+        }
+
+        return n;
+    }
+
+    long long nowMs() {
+        struct timespec ts;
+
+        /* relógio monotônico: não é afetado por ajustes no horário do sistema */
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    long long nowUs() {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+
     int Recvfrom(int sockfd, char msg[], int maxlen, SocketAddr *sockAddr) {
         int n;
         socklen_t addrlen =  (sockAddr != NULL) ? sizeof(sockAddr->addr) : 0;
         struct sockaddr *sockAddrAux = (sockAddr != NULL) ? (struct sockaddr *) &sockAddr->addr : NULL;
 
-        if ((n = recvfrom(sockfd, msg, maxlen, 0, sockAddrAux, &addrlen)) < 0) {
+        IOSTAT_BEGIN();
+        n = recvfrom(sockfd, msg, maxlen, 0, sockAddrAux, &addrlen);
+        IOSTAT_END(OpRecvfrom, -1, n);
+
+        if (n < 0) {
+            perror("recvfrom error");
+            exit(1);
+        }
+
+        msg[n] = '\0';
+
+        return n;
+    }
+
+    /* Recvfrom que não espera: -1 caso não haja datagrama */
+    int TryRecvfrom(int sockfd, char msg[], int maxlen, SocketAddr *sockAddr) {
+        int n;
+        socklen_t addrlen =  (sockAddr != NULL) ? sizeof(sockAddr->addr) : 0;
+        struct sockaddr *sockAddrAux = (sockAddr != NULL) ? (struct sockaddr *) &sockAddr->addr : NULL;
+
+        IOSTAT_BEGIN();
+        n = recvfrom(sockfd, msg, maxlen, MSG_DONTWAIT, sockAddrAux, &addrlen);
+        IOSTAT_END(OpRecvfrom, -1, n);
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return -1;
+
             perror("recvfrom error");
             exit(1);
         }
@@ -354,170 +615,347 @@ namespace sock {
         socklen_t addrlen =  (sockAddr != NULL) ? sizeof(sockAddr->addr) : 0;
         struct sockaddr *sockAddrAux = (sockAddr != NULL) ? (struct sockaddr *) &sockAddr->addr : NULL;
 
-        if (sendto(sockfd, msg, strlen(msg), 0, sockAddrAux, addrlen) < 0) {
+        IOSTAT_BEGIN();
+        int n = sendto(sockfd, msg, strlen(msg), 0, sockAddrAux, addrlen);
+        IOSTAT_END(OpSendto, strlen(msg), n);
+
+        if (n < 0) {
             perror("sendto error");
             exit(1);
         }
     }
 
-    void writeDenyMsg(int sockfd) {
-        if (sockfd >= 0) {
-            auto status = sock::DenyMsg;
+    void Sendto(int sockfd, char msg[], int len, SocketAddr *sockAddr) {
+        socklen_t addrlen =  (sockAddr != NULL) ? sizeof(sockAddr->addr) : 0;
+        struct sockaddr *sockAddrAux = (sockAddr != NULL) ? (struct sockaddr *) &sockAddr->addr : NULL;
 
-            // send message (with address of peer) to client to start game
-            sock::Write(sockfd, (char *) &status, sizeof(status));
+        /* versão binária do Sendto: envia exatamente `len` bytes (a mensagem pode conter '\0') */
+        IOSTAT_BEGIN();
+        int n = sendto(sockfd, msg, len, 0, sockAddrAux, addrlen);
+        IOSTAT_END(OpSendto, len, n);
+
+        if (n < 0) {
+            perror("sendto error");
+            exit(1);
         }
     }
 
-    void writeDenyMsg2(int sockfd, int idCli) {
-        if (sockfd >= 0) {
-            auto status = sock::DenyMsg;
-            
-            // send message to peer (to start a new game)
-            sock::Write(sockfd, (char *) &status, sizeof(status));
-
-            // send to peer the id of client i
-            sock::Write(sockfd, (char *) &idCli, sizeof(idCli));
+    /*
+        O formato de cada mensagem, nas duas direções, declarado uma única vez
+        (ver include/schema.h). As funções write e read abaixo são atalhos para
+        send()/receive() com estes tipos.
+    */
+    namespace msg {
+        using namespace schema;
+
+        typedef Message<NewGameMsg, Int> NewGame;                       // id do outro jogador (nas duas direções)
+        typedef Message<AcceptMsg, Scalar<char>, Address> Accept;       // servidor -> cliente: sorteio, endereço do outro jogador
+        typedef Message<AcceptMsg, Int> AcceptReply;                    // cliente -> servidor: id de quem convidou
+        typedef Message<DenyMsg> Deny;                                  // servidor -> cliente
+        typedef Message<DenyMsg, Int> DenyReply;                        // cliente -> servidor: id de quem convidou
+        typedef Message<UpdateList> ListRequest;                        // cliente -> servidor
+        typedef Message<FinishGame, Int> Finish;                        // cliente -> servidor: pontos da partida
+        typedef Message<SubscribeMsg, IntArray<MAXSUBSCRIBE>> Subscribe;
+        typedef Message<UnsubscribeMsg, IntArray<MAXSUBSCRIBE>> Unsubscribe;
+        typedef Message<PresenceMsg, Int, Scalar<PresenceStatus>, Int, String<ADDR_LEN - 1>> Presence;   // id, presença, score, endereço
+        typedef Message<BroadcastMsg, Int, String<MAX_BROADCAST>> Broadcast;    // servidor -> cliente: id de quem anunciou, texto
+        typedef Message<BroadcastMsg, String<MAX_BROADCAST>> Announce;          // cliente -> servidor: texto
+        typedef Message<SessionMsg, Int, Long> Session;                 // id, ficha da sessão
+        typedef Message<ResumeMsg, Int, Long> Resume;
+        typedef Message<RoomMsg, String<ROOM_NAME_LEN - 1>> Room;       // nas duas direções ("" é o lobby principal)
+        typedef Message<PingMsg, Long> Ping;                            // nas duas direções
+
+        /*
+            servidor -> cliente: tamanho (int) e, nesses bytes, o id do destinatário e a
+            lista de clientes da sala. Cada cliente ocupa de 10 a 15 bytes com IPv4 (eram
+            cerca de 40): o id vai junto com o bit de disponível (id * 2 + disponível).
+        */
+        typedef Record<Int> ListSize;
+        typedef Record<VarInt, VarInt> ListHeader;                      // id, número de clientes
+        typedef Record<VarInt, ZigZag, VarInt, Address> ClientEntry;    // id * 2 + disponível, score, RTT, endereço
+        typedef Message<UpdateList, Bytes> ListOfClients;
+    }
+
+    static_assert(msg::Broadcast::maxSize - MAX_BROADCAST == BROADCAST_HEADER_SIZE, "BROADCAST_HEADER_SIZE must match msg::Broadcast");
+
+    /* lê exatamente `len` bytes; falso caso a conexão termine antes */
+    bool readFull(int sockfd, char *buf, int len) {
+        for (int got = 0, n; got < len; got += n) {
+            if ((n = sock::Read(sockfd, buf + got, len - got)) == 0) return false;
         }
+
+        return true;
     }
 
-    void writeNewGameMsg(int sockfd, int idCli) {
-        if (sockfd >= 0) {
-            auto status = sock::NewGameMsg;
-            
-            // send message to peer (to start a new game)
-            sock::Write(sockfd, (char *) &status, sizeof(status));
-
-            // send to peer the id of client i
-            sock::Write(sockfd, (char *) &idCli, sizeof(idCli));
+    /* codifica a mensagem M num buffer da pilha e a envia com uma única escrita */
+    template <typename M, typename... V>
+    void send(int sockfd, const V &... values) {
+        static_assert(M::maxSize > 0, "send() needs a message with a bounded size");
+
+        char buf[M::maxSize];
+
+        if (sockfd >= 0) sock::Write(sockfd, buf, M::encode(buf, values...));
+    }
+
+    /*
+        lê os campos de M (o status já foi lido por quem despacha a mensagem): uma
+        leitura para os campos fixos e uma para cada campo variável. Retorna o número
+        de bytes lidos, ou -1 caso a conexão termine ou a mensagem seja inválida;
+        um campo variável maior que o limite do schema (sempre o último da mensagem)
+        é consumido e descartado.
+    */
+    template <typename M, typename... V>
+    int receive(int sockfd, V &... values) {
+        typedef typename M::Body Body;
+
+        static_assert(Body::maxSize > 0, "receive() needs a message with a bounded size");
+
+        char buf[Body::maxSize > 0 ? Body::maxSize : 1];
+        int have = 0, total;
+
+        if (sockfd < 0) return -1;
+
+        while ((total = Body::need(buf, have)) > have) {
+            if (total > Body::maxSize) {
+                for (int n; have < total; have += n) {
+                    n = (total - have < Body::maxSize) ? total - have : Body::maxSize;
+
+                    if (!readFull(sockfd, buf, n)) return -1;
+                }
+
+                return -1;
+            }
+
+            if (!readFull(sockfd, buf + have, total - have)) return -1;
+
+            have = total;
         }
+
+        if (total < 0 || Body::decode(buf, values...) < 0) return -1;
+
+        return have;
+    }
+
+    void writeDenyMsg(int sockfd) {
+        sock::send<msg::Deny>(sockfd);
+    }
+
+    void writeDenyMsg2(int sockfd, int idCli) {
+        sock::send<msg::DenyReply>(sockfd, idCli);
+    }
+
+    void writeNewGameMsg(int sockfd, int idCli) {
+        sock::send<msg::NewGame>(sockfd, idCli);
+    }
+
+    /* SessionMsg e ResumeMsg têm o mesmo formato: id do jogador e ficha da sessão */
+    void writeSessionMsg(int sockfd, MessageStatus status, int idCli, long long session) {
+        if (status == ResumeMsg) sock::send<msg::Resume>(sockfd, idCli, session);
+        else sock::send<msg::Session>(sockfd, idCli, session);
+    }
+
+    void readSessionMsg(int sockfd, int &idCli, long long &session) {
+        sock::receive<msg::Session>(sockfd, idCli, session);
+    }
+
+    /* a marca de tempo só tem sentido para o servidor; o cliente a devolve sem interpretá-la */
+    void writePingMsg(int sockfd, long long stamp) {
+        // a single write: a second small segment would wait for the peer's delayed ACK (Nagle) and inflate the RTT
+        sock::send<msg::Ping>(sockfd, stamp);
+    }
+
+    void readPingMsg(int sockfd, long long &stamp) {
+        sock::receive<msg::Ping>(sockfd, stamp);
     }
 
     void readNewGameMsg(int sockfd, int &idCli) {
-        if (sockfd >= 0) {
-            // send to peer the id of client i
-            sock::Read(sockfd, (char *) &idCli, sizeof(idCli));
-        }
+        sock::receive<msg::NewGame>(sockfd, idCli);
     }
 
-    void writeAcceptMsg(int sockfd, std::string address, int randNum) {
-        if (sockfd >= 0) {
-            auto status = sock::AcceptMsg;
+    /* "ip:porta" (IPv4) ou "[ip]:porta" (IPv6) no formato binário dos campos Address; falso caso inválido */
+    bool parseEndpoint(const char *text, schema::Endpoint &endpoint) {
+        const char *colon = strrchr(text, ':'), *ip = text;
+        char buf[INET6_ADDRSTRLEN];
+
+        memset(&endpoint, 0, sizeof(endpoint));
 
-            // send message (with address of peer) to client to start game
-            sock::Write(sockfd, (char *) &status, sizeof(status));
+        if (colon == NULL) return false;
 
-            sock::Write(sockfd, (char *) &randNum, sizeof(randNum));
+        int len = (int) (colon - text), port = atoi(colon + 1);
 
-            auto len = (int) address.size();
+        if (text[0] == '[' && len >= 2 && text[len - 1] == ']') {
+            ++ip;
+            len -= 2;
+        }
+
+        if (len <= 0 || len >= (int) sizeof(buf) || port < 0 || port > 65535) return false;
 
-            sock::Write(sockfd, (char *) &len, sizeof(len));
+        memcpy(buf, ip, len);
+        buf[len] = '\0';
 
-            sock::Write(sockfd, (char *) address.c_str(), len * sizeof(char));
+        if (inet_pton(AF_INET, buf, endpoint.addr) == 1) {
+            endpoint.family = 4;
+        } else if (inet_pton(AF_INET6, buf, endpoint.addr) == 1) {
+            endpoint.family = 6;
+        } else {
+            return false;
         }
+
+        endpoint.port = htons((unsigned short) port);
+
+        return true;
     }
 
-    void writeAcceptMsg2(int sockfd, int idCli) {
-        if (sockfd >= 0) {
-            auto status = sock::AcceptMsg;
-            
-            // send message to peer (to start a new game)
-            sock::Write(sockfd, (char *) &status, sizeof(status));
-
-            // send to peer the id of client i
-            sock::Write(sockfd, (char *) &idCli, sizeof(idCli));
-        }
+    /* texto "ip:porta" (ou "[ip]:porta") do endereço, para exibição */
+    void formatEndpoint(const schema::Endpoint &endpoint, char *out, int size) {
+        char ip[INET6_ADDRSTRLEN] = "";
+
+        inet_ntop((endpoint.family == 6) ? AF_INET6 : AF_INET, endpoint.addr, ip, sizeof(ip));
+
+        snprintf(out, size, (endpoint.family == 6) ? "[%s]:%d" : "%s:%d", ip, ntohs(endpoint.port));
     }
 
-    void readAcceptMsg(int sockfd, char *recvline, std::string &address, int &randNum) {
-        if (sockfd >= 0) {
-            sock::Read(sockfd, (char *) &randNum, sizeof(randNum));
-            
-            int len;
+    /* endereço do socket UDP descrito por `endpoint` (os sockets do jogo são IPv4) */
+    SocketAddr endpointAddr(const schema::Endpoint &endpoint) {
+        SocketAddr addr(AF_INET, 0, 0);
 
-            sock::Read(sockfd, (char *) &len, sizeof(len));
+        memcpy(&addr.addr.sin_addr, endpoint.addr, sizeof(addr.addr.sin_addr));
+        addr.addr.sin_port = endpoint.port;
 
-            sock::Read(sockfd, (char *) recvline, len * sizeof(char));
+        return addr;
+    }
 
-            recvline[len] = '\0';
+    void writeAcceptMsg(int sockfd, const schema::Endpoint &peer, int randNum) {
+        // send message (with address of peer) to client to start game
+        sock::send<msg::Accept>(sockfd, (char) randNum, peer);
+    }
 
-            address = std::string(recvline);
-        }
+    void writeAcceptMsg2(int sockfd, int idCli) {
+        sock::send<msg::AcceptReply>(sockfd, idCli);
     }
 
-    void writeListOfClients(int sockfd, int idCli, std::map<int, std::string> &clients, std::set<int> &playing, std::map<int, int> &scores) {
-        if (sockfd >= 0) {
-            auto status = sock::UpdateList;
+    void readAcceptMsg(int sockfd, schema::Endpoint &peer, int &randNum) {
+        char rand = 0;
 
-            sock::Write(sockfd, (char *) &status, sizeof(status));
+        if (sock::receive<msg::Accept>(sockfd, rand, peer) < 0) memset(&peer, 0, sizeof(peer));
 
-            int num_clis = (int) clients.size();
+        randNum = rand;
+    }
 
-            sock::Write(sockfd, (char *) &idCli, sizeof(idCli));
+    /* status é SubscribeMsg ou UnsubscribeMsg; listas maiores que MAXSUBSCRIBE vão em várias mensagens */
+    void writeSubscribeMsg(int sockfd, MessageStatus status, int num_ids, int *ids) {
+        int i = 0;
 
-            sock::Write(sockfd, (char *) &num_clis, sizeof(num_clis));
+        do {
+            int n = (num_ids - i < MAXSUBSCRIBE) ? num_ids - i : MAXSUBSCRIBE;
 
-            for (auto &cli : clients) {
-                sock::Write(sockfd, (char *) &cli.first, sizeof(int));
+            schema::Ints chunk(ids + i, n);
 
-                int score = scores[cli.first];
+            if (status == UnsubscribeMsg) sock::send<msg::Unsubscribe>(sockfd, chunk);
+            else sock::send<msg::Subscribe>(sockfd, chunk);
 
-                sock::Write(sockfd, (char *) &score, sizeof(int));
+            i += n;
+        } while (i < num_ids);
+    }
 
-                bool available = true;
+    /* retorna o número de ids lidos (no máximo MAXSUBSCRIBE), ou -1 caso a mensagem seja inválida */
+    int readSubscribeMsg(int sockfd, int *ids) {
+        schema::IntBuffer buf(ids);
 
-                if (playing.find(cli.first) != playing.end()) available = false;
+        if (sock::receive<msg::Subscribe>(sockfd, buf) < 0) return -1;
 
-                sock::Write(sockfd, (char *) &available, sizeof(available));
+        return buf.count;
+    }
 
-                int len = (int) cli.second.size();
+    void writePresenceMsg(int sockfd, int idCli, PresenceStatus presence, int score, const char *address) {
+        sock::send<msg::Presence>(sockfd, idCli, presence, score, schema::Text(address));
+    }
 
-                sock::Write(sockfd, (char *) &len, sizeof(len));
+    void readPresenceMsg(int sockfd, int &idCli, PresenceStatus &presence, int &score, std::string &address) {
+        sock::receive<msg::Presence>(sockfd, idCli, presence, score, address);
+    }
 
-                sock::Write(sockfd, (char *) cli.second.c_str(), len * sizeof(char));
-            }
-        }
+    /* cliente -> servidor */
+    void writeBroadcastMsg(int sockfd, const char *text, int len) {
+        sock::send<msg::Announce>(sockfd, schema::Text(text, len));
+    }
+
+    /* RoomMsg nos dois sentidos: nome da sala ("" é o lobby principal) */
+    void writeRoomMsg(int sockfd, const char *name) {
+        sock::send<msg::Room>(sockfd, schema::Text(name));
     }
 
-    void readListOfClients(int sockfd, char *recvline, std::map<int, std::string> &clients, std::set<int> &playing, std::map<int, int> &scores, int &myId) {
-        int num_clis;
+    /*
+        lê o texto de um BroadcastMsg (cliente -> servidor) para `recvline` (MAX_BROADCAST + 1 bytes);
+        textos maiores são consumidos e descartados (retorna -1)
+    */
+    int readBroadcastMsg(int sockfd, char *recvline) {
+        schema::TextBuffer text(recvline);
+
+        if (sock::receive<msg::Announce>(sockfd, text) < 0) return -1;
+
+        return text.len;
+    }
 
-        sock::Read(sockfd, (char *) &myId, sizeof(myId));
+    /* nome para `name` (ROOM_NAME_LEN bytes); nomes maiores são descartados (retorna -1) */
+    int readRoomMsg(int sockfd, char *name) {
+        schema::TextBuffer text(name);
 
-        sock::Read(sockfd, (char *) &num_clis, sizeof(num_clis));
+        if (sock::receive<msg::Room>(sockfd, text) < 0) return -1;
+
+        return text.len;
+    }
+
+    /* codifica um BroadcastMsg (servidor -> clientes) em `buf`; retorna o número de bytes usados */
+    int encodeBroadcastMsg(char *buf, int idCli, const char *text, int len) {
+        return msg::Broadcast::encode(buf, idCli, schema::Text(text, len));
+    }
+
+    void readBroadcastMsgFrom(int sockfd, int &idCli, std::string &text) {
+        if (sock::receive<msg::Broadcast>(sockfd, idCli, text) < 0) text.clear();
+    }
+
+    /* a lista chega inteira (tamanho e uma leitura) e é decodificada da memória */
+    void readListOfClients(int sockfd, std::map<int, std::string> &clients, std::set<int> &playing, std::map<int, int> &scores, std::map<int, int> &rtts, int &myId) {
+        static std::vector<char> payload;
+        int size = 0, num_clis = 0, off;
 
         scores.clear();
+        rtts.clear();
         playing.clear();
         clients.clear();
 
-        for (int i = 0; i < num_clis; ++i) {
-            int cli_id;
+        if (sock::receive<msg::ListSize>(sockfd, size) < 0 || size < 0 || size > SCHEMA_MAX_FIELD) return;
 
-            sock::Read(sockfd, (char *) &cli_id, sizeof(int));
+        payload.resize(size + 1);
 
-            int score;
+        if (!readFull(sockfd, &payload[0], size)) return;
 
-            sock::Read(sockfd, (char *) &score, sizeof(int));
+        const char *buf = &payload[0];
 
-            scores[cli_id] = score;
+        if ((off = msg::ListHeader::parse(buf, size, myId, num_clis)) < 0) return;
 
-            bool available;
+        for (int i = 0; i < num_clis; ++i) {
+            int packed, score, rtt, n;
+            schema::Endpoint endpoint;
+            char address[INET6_ADDRSTRLEN + 8];
 
-            sock::Read(sockfd, (char *) &available, sizeof(available));
+            if ((n = msg::ClientEntry::parse(buf + off, size - off, packed, score, rtt, endpoint)) < 0) break;
 
-            if (!available) playing.insert(cli_id);
+            off += n;
 
-            int len;
+            int cli_id = (int) ((unsigned) packed >> 1);
 
-            sock::Read(sockfd, (char *) &len, sizeof(len));
+            scores[cli_id] = score;
+            rtts[cli_id] = rtt;
 
-            sock::Read(sockfd, (char *) recvline, len * sizeof(char));
+            if (!(packed & 1)) playing.insert(cli_id);
 
-            recvline[len] = '\0';
+            formatEndpoint(endpoint, address, sizeof(address));
 
-            clients[cli_id] = std::string(recvline);
+            clients[cli_id] = address;
         }
     }
 }
 
-#endif
\ No newline at end of file
+#endif
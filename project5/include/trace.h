@@ -0,0 +1,236 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+    Pontos de trace do loop do servidor.
+
+    Cada etapa (espera no select, sock::Read, tratamento da mensagem,
+    sock::Write, ...) gera um evento de início e um de fim com o contador de
+    ciclos da CPU (TSC). Os eventos são gravados num buffer da própria thread,
+    sem locks nem syscalls; quando o buffer enche (ou na saída do programa)
+    ele é despejado de uma vez num arquivo binário, lido depois pelo
+    bin/analisador.o.
+
+    Os pontos só existem quando compilado com TRACE_ENABLED (make TRACE=1);
+    caso contrário as macros não geram código nenhum. O formato do arquivo
+    (Header e Event) é sempre definido, pois o analisador o utiliza.
+*/
+#define TRACE_MAGIC 0x31435254      /* "TRC1" */
+#define TRACE_VERSION 1
+#define TRACE_BUFFER 8192           /* eventos por thread antes de despejar no arquivo */
+#define TRACE_MAX_STAGES 16
+#define TRACE_NAME_LEN 16
+#define TRACE_CALIBRATION_US 20000  /* tempo usado para medir a frequência do TSC */
+
+namespace trace {
+    enum Stage : uint8_t {
+        StageSelect,    // bloqueado no select
+        StageAccept,    // nova conexão
+        StageRead,      // sock::Read
+        StageHandle,    // tratamento de uma mensagem (o switch do loop)
+        StageWrite,     // sock::Write
+        StageMesh,      // mensagens de outros shards
+        StageFlush,     // trabalho do fim da iteração
+        NUM_STAGES
+    };
+
+    enum Phase : uint8_t {
+        Begin,
+        End
+    };
+
+    const char *stageName(int stage) {
+        static const char *names[NUM_STAGES] = {"Select", "Accept", "Read", "Handle", "Write", "Mesh", "Flush"};
+
+        return (stage >= 0 && stage < NUM_STAGES) ? names[stage] : "?";
+    }
+
+    /* um evento no arquivo; `request` é 0 fora do tratamento de uma requisição */
+    struct Event {
+        uint64_t tsc;
+        uint32_t request;
+        int32_t fd;
+        uint8_t stage, phase;
+        uint16_t thread;
+        uint32_t reserved;
+    };
+
+    struct Header {
+        uint32_t magic, version;
+        uint32_t eventSize, numStages;
+        double ticksPerUs;
+        uint64_t tscStart;
+        char names[TRACE_MAX_STAGES][TRACE_NAME_LEN];
+    };
+
+    uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+    }
+
+    /* ciclos do TSC por microssegundo, medidos contra o relógio monotônico */
+    double calibrate() {
+        struct timespec t0, t1;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        uint64_t c0 = ticks();
+
+        usleep(TRACE_CALIBRATION_US);
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        uint64_t c1 = ticks();
+
+        double us = (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3;
+
+        return (c1 - c0) / us;
+    }
+
+#ifdef TRACE_ENABLED
+    class Buffer {
+        public:
+            Event events[TRACE_BUFFER];
+            int count;
+            uint16_t thread;
+            uint32_t request, nextRequest;
+            int requestFd;
+    };
+
+    int traceFd = -1;
+    std::atomic<int> numThreads(0);
+
+    thread_local Buffer buffer;
+
+    void flush(Buffer &b) {
+        int size = b.count * sizeof(Event);
+
+        /* O_APPEND: o bloco de cada thread é escrito inteiro, sem se misturar com os das outras */
+        for (int off = 0, n; off < size; off += n) {
+            if ((n = write(traceFd, (char *) b.events + off, size - off)) <= 0) break;
+        }
+
+        b.count = 0;
+    }
+
+    inline void record(Stage stage, Phase phase, int fd) {
+        if (traceFd < 0) return;
+
+        Buffer &b = buffer;
+
+        if (b.thread == 0) b.thread = ++numThreads;
+
+        if (b.count == TRACE_BUFFER) flush(b);
+
+        Event &e = b.events[b.count++];
+
+        e.tsc = ticks();
+        e.request = b.request;
+        e.fd = (fd >= 0) ? fd : b.requestFd;
+        e.stage = stage;
+        e.phase = phase;
+        e.thread = b.thread;
+    }
+
+    /* marca o início e o fim de uma etapa no escopo em que é declarado */
+    class Span {
+        public:
+            Stage stage;
+            int fd;
+
+            Span(Stage _stage, int _fd) : stage(_stage), fd(_fd) { record(stage, Begin, fd); }
+
+            ~Span() { record(stage, End, fd); }
+    };
+
+    /* os eventos seguintes (até endRequest) pertencem a uma nova requisição do descritor `fd` */
+    inline void beginRequest(int fd) {
+        buffer.request = ++buffer.nextRequest;
+        buffer.requestFd = fd;
+    }
+
+    inline void endRequest() {
+        buffer.request = 0;
+        buffer.requestFd = -1;
+    }
+
+    /* despeja o buffer da thread atual e fecha o arquivo (registrado no atexit) */
+    void stop() {
+        if (traceFd < 0) return;
+
+        flush(buffer);
+
+        close(traceFd);
+        traceFd = -1;
+    }
+
+    /* abre o arquivo de trace (variável TRACE_FILE, ou trace.bin) e grava o cabeçalho */
+    void start() {
+        const char *path = getenv("TRACE_FILE");
+
+        if (path == NULL) path = "trace.bin";
+
+        if ((traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0) {
+            perror("trace open error");
+            exit(1);
+        }
+
+        Header header;
+
+        memset(&header, 0, sizeof(header));
+
+        header.magic = TRACE_MAGIC;
+        header.version = TRACE_VERSION;
+        header.eventSize = sizeof(Event);
+        header.numStages = NUM_STAGES;
+        header.ticksPerUs = calibrate();
+        header.tscStart = ticks();
+
+        for (int i = 0; i < NUM_STAGES; ++i) strncpy(header.names[i], stageName(i), TRACE_NAME_LEN - 1);
+
+        if (write(traceFd, &header, sizeof(header)) != sizeof(header)) {
+            perror("trace write error");
+            exit(1);
+        }
+
+        endRequest();
+
+        atexit(stop);
+    }
+#endif
+}
+
+#ifdef TRACE_ENABLED
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_START() trace::start()
+#define TRACE_SPAN(stage, fd) trace::Span TRACE_CONCAT(traceSpan, __LINE__)(trace::stage, fd)
+#define TRACE_REQUEST(fd) trace::beginRequest(fd)
+#define TRACE_REQUEST_END() trace::endRequest()
+#else
+#define TRACE_START() do {} while (0)
+#define TRACE_SPAN(stage, fd) do {} while (0)
+#define TRACE_REQUEST(fd) do {} while (0)
+#define TRACE_REQUEST_END() do {} while (0)
+#endif
+
+#endif
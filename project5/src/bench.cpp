@@ -0,0 +1,235 @@
+#include <socket.h>
+#include <lobby.h>
+#include <loopback.h>
+#include <game.h>
+#include <boards.h>
+#include <bench.h>
+
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <sys/socket.h>
+
+/*
+    Microbenchmarks do projeto 5 (make bench; ver include/bench.h).
+
+        lista/codifica, lista/decodifica    writeListOfClients e readListOfClients para
+                                            salas de 8 a 2048 jogadores, sobre uma conexão
+                                            em memória (include/loopback.h): sem syscalls,
+                                            só a codificação e a cópia para o anel
+        sock_ntop, treat_line, parseMove    as conversões de texto do cliente e do servidor
+        test_board, tabuleiros/...          detecção de vitória: test_board e a avaliação
+                                            em lote de include/boards.h (ns por tabuleiro);
+                                            os três são conferidos entre si antes
+        eco/socketpair, eco/memoria         ida e volta de uma mensagem por sock::Write e
+                                            sock::Read, pelo kernel e em memória
+*/
+#define BENCH_BOARDS 4096               /* tabuleiros por lote */
+#define BENCH_RING (1 << 18)            /* anel das conexões em memória: cabe a maior lista */
+
+/* posição de uma partida aleatória, interrompida ao acaso ou no fim */
+void randomBoard(char *board, unsigned &seed) {
+    int moves = 0, stop;
+
+    for (int i = 0; i < 9; ++i) board[i] = NoPlayer;
+
+    seed = seed * 1103515245 + 12345;
+    stop = (seed >> 16) % 10;
+
+    while (moves < stop && test_board(board) == NoPlayer) {
+        seed = seed * 1103515245 + 12345;
+
+        int cell = (seed >> 16) % 9;
+
+        if (board[cell] != NoPlayer) continue;
+
+        board[cell] = (moves % 2 == 0) ? Player1 : Player2;
+        ++moves;
+    }
+}
+
+/* endereço UDP (fictício) do jogador `id` */
+std::string addressOf(int id) {
+    char address[ADDR_LEN];
+
+    snprintf(address, sizeof(address), "10.0.%d.%d:%d", (id >> 8) & 0xff, id & 0xff, 20000 + id % 10000);
+
+    return address;
+}
+
+/* lê exatamente `len` bytes de uma conexão em memória ou do kernel */
+void drain(int fd, char *buf, int len) {
+    if (!sock::readFull(fd, buf, len)) {
+        perror("bench: conexão fechada");
+        exit(1);
+    }
+}
+
+void benchLists(bench::Suite &suite, int fds[2]) {
+    const int sizes[] = {8, 64, 512, 2048};
+    std::vector<char> encoded(BENCH_RING), sink(BENCH_RING);
+    std::map<int, std::string> clients;
+    std::set<int> playing;
+    std::map<int, int> scores, rtts;
+
+    for (int size : sizes) {
+        lobby::Roster roster;
+
+        roster.init(size);
+
+        for (int id = 0; id < size; ++id) {
+            roster.add(id, addressOf(id).c_str());
+            roster.addScore(id, id % 7 - 3);
+            roster.setPlaying(id, id % 3 == 0);
+        }
+
+        /* o tamanho da mensagem, e uma cópia dela para a decodificação */
+        lobby::writeListOfClients(fds[0], 0, roster);
+
+        int len = loopback::network.readable(fds[1]);
+
+        drain(fds[1], &encoded[0], len);
+
+        suite.run("lista/codifica", size, len, [&](long long n) {
+            for (long long i = 0; i < n; ++i) {
+                /* o id do destinatário varia, e com ele o tamanho (VarInt) da mensagem */
+                lobby::writeListOfClients(fds[0], (int) (i % size), roster);
+                drain(fds[1], &sink[0], loopback::network.readable(fds[1]));
+            }
+        });
+
+        suite.run("lista/decodifica", size, len, [&](long long n) {
+            int myId;
+
+            for (long long i = 0; i < n; ++i) {
+                sock::MessageStatus msgStatus;
+
+                loopback::write(fds[0], &encoded[0], len, true);
+
+                sock::Read(fds[1], (char *) &msgStatus, sizeof(msgStatus));
+                sock::readListOfClients(fds[1], clients, playing, scores, rtts, myId);
+            }
+
+            bench::keep(myId);
+        });
+    }
+}
+
+void benchText(bench::Suite &suite) {
+    sock::SocketAddr addr(AF_INET, "192.168.100.200", 54321);
+
+    suite.run("sock_ntop", 0, 0, [&](long long n) {
+        for (long long i = 0; i < n; ++i) bench::keep(sock::sock_ntop((struct sockaddr *) &addr.addr, sizeof(addr.addr))[0]);
+    });
+
+    char move[] = "2 3";
+
+    suite.run("treat_line", 0, 0, [&](long long n) {
+        int line = 0, column = 0;
+
+        for (long long i = 0; i < n; ++i) {
+            treat_line(move, " ", line, column);
+            bench::keep(line);
+        }
+    });
+
+    suite.run("parseMove", 0, 0, [&](long long n) {
+        for (long long i = 0; i < n; ++i) bench::keep(parseMove(move));
+    });
+}
+
+void benchBoards(bench::Suite &suite) {
+    std::vector<char> cells(BENCH_BOARDS * 9);
+    std::vector<uint16_t> xs(BENCH_BOARDS), os(BENCH_BOARDS);
+    std::vector<char> expected(BENCH_BOARDS), winners(BENCH_BOARDS);
+    unsigned seed = 1;
+
+    for (int i = 0; i < BENCH_BOARDS; ++i) {
+        char *board = &cells[i * 9];
+
+        randomBoard(board, seed);
+
+        xs[i] = boards::maskOf(board, Player1);
+        os[i] = boards::maskOf(board, Player2);
+        expected[i] = test_board(board);
+    }
+
+    for (int avx2 = 0; avx2 <= (boards::hasAvx2() ? 1 : 0); ++avx2) {
+        if (avx2) boards::evaluateAvx2(&xs[0], &os[0], &winners[0], BENCH_BOARDS);
+        else boards::evaluateScalar(&xs[0], &os[0], &winners[0], BENCH_BOARDS);
+
+        for (int i = 0; i < BENCH_BOARDS; ++i) {
+            if (winners[i] != expected[i]) {
+                fprintf(stderr, "tabuleiro %d: test_board '%c', lote %s '%c'\n", i, expected[i], avx2 ? "AVX2" : "escalar", winners[i]);
+                exit(1);
+            }
+        }
+    }
+
+    suite.run("test_board", 0, 0, [&](long long n) {
+        for (long long i = 0; i < n; ++i) bench::keep(test_board(&cells[(i % BENCH_BOARDS) * 9]));
+    });
+
+    /* uma operação é um tabuleiro: `n` tabuleiros em lotes de até BENCH_BOARDS */
+    suite.run("tabuleiros/escalar", BENCH_BOARDS, 0, [&](long long n) {
+        for (long long done = 0; done < n; done += BENCH_BOARDS) {
+            boards::evaluateScalar(&xs[0], &os[0], &winners[0], (int) std::min<long long>(BENCH_BOARDS, n - done));
+            bench::keep(winners[0]);
+        }
+    });
+
+    if (boards::hasAvx2()) {
+        suite.run("tabuleiros/avx2", BENCH_BOARDS, 0, [&](long long n) {
+            for (long long done = 0; done < n; done += BENCH_BOARDS) {
+                boards::evaluateAvx2(&xs[0], &os[0], &winners[0], (int) std::min<long long>(BENCH_BOARDS, n - done));
+                bench::keep(winners[0]);
+            }
+        });
+    }
+}
+
+/* ida e volta de `size` bytes: cliente escreve, servidor lê e ecoa, cliente lê */
+void benchEcho(bench::Suite &suite, const char *name, int fds[2]) {
+    const int sizes[] = {16, 256, 4096};
+    char out[4096], in[4096];
+
+    memset(out, 'e', sizeof(out));
+
+    for (int size : sizes) {
+        suite.run(name, size, 2.0 * size, [&](long long n) {
+            for (long long i = 0; i < n; ++i) {
+                sock::Write(fds[1], out, size);
+                drain(fds[0], in, size);
+
+                sock::Write(fds[0], in, size);
+                drain(fds[1], in, size);
+            }
+        });
+    }
+}
+
+int main(int argc, char **argv) {
+    bench::Suite suite("project5", argc, argv);
+    int memory[2], kernel[2];
+
+    loopback::network.init(2, BENCH_RING);
+    loopback::enable();
+
+    loopback::network.pair(memory);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, kernel) < 0) {
+        perror("socketpair error");
+        exit(1);
+    }
+
+    benchLists(suite, memory);
+    benchText(suite);
+    benchBoards(suite);
+    benchEcho(suite, "eco/socketpair", kernel);
+    benchEcho(suite, "eco/memoria", memory);
+
+    suite.finish();
+
+    return 0;
+}
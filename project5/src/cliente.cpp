@@ -1,62 +1,91 @@
 #include <map>
+#include <deque>
 #include <string>
+#include <vector>
 #include <stdlib.h>
 #include <iostream>
 #include <socket.h>
+#include <screen.h>
+#include <game.h>
+#include <discovery.h>
 
 #define MAXLINE 1000
+#define MURAL_SIZE 5
+#define RECONNECT_ATTEMPTS 20       /* tentativas de reconexão depois de uma queda do servidor */
+#define RECONNECT_INTERVAL_MS 500
 
-enum PlayerId : char {
-    NoPlayer = ' ',
-    Player1 = 'X',
-    Player2 = 'O'
-};
-
-void getIpPort(std::string &address, std::string &ip, int &port) {
-    std::string s(address);
-    std::string token = s.substr(0, s.find(":"));
+/* tela do lobby (desenhada incrementalmente) e a parte visível da lista de clientes */
+screen::Renderer view;
+int listOffset = 0, listPage = 1;
 
-    ip = token.c_str();
+/* sala atual ("" é o lobby principal); a lista, os convites e os anúncios ficam restritos a ela */
+std::string room;
 
-    token = s.substr(s.find(":") + 1, s.size());
+/* apaga a tela para as telas que não passam pelo Renderer (jogo, convites, ...) */
+void clearScreen() {
+    printf("\033[2J\033[1;1H");
 
-    port = std::atoi(token.c_str());
+    view.invalidate();
 }
 
-void treat_line(char sendline[], std::string delimiter, int &line, int &column) {
-    std::string s(sendline);
-    std::string token = s.substr(0, s.find(delimiter));
+/*
+    estados da interface: o loop principal nunca bloqueia esperando o usuário,
+    a entrada de cada estado é tratada quando uma linha completa chega
+*/
+enum UiState {
+    Lobby,      // lista de clientes; a linha é um comando
+    Invited,    // convite recebido; esperando 'S' ou 'N'
+    Waiting,    // esperando a resposta a um convite (enter desiste)
+    Notice,     // mensagem na tela; enter volta ao lobby
+    Playing     // partida em andamento
+};
 
-    line = std::atoi(token.c_str()) - 1;
+class Game {
+    public:
+        char board[9];
+        PlayerId me;
+        int peerId;         // quem convidou (estado Invited) ou foi convidado (Waiting); -1 caso o servidor escolha
+        bool myTurn;
+        int moves;
+        sock::SocketAddr peer;
 
-    token = s.substr(s.find(delimiter) + 1, s.size());
+        Game() : me(PlayerId::NoPlayer), peerId(-1), myTurn(false), moves(0), peer(0, 0, 0) {}
 
-    column = std::atoi(token.c_str()) - 1;
-}
+        PlayerId opponent() { return (me == PlayerId::Player1) ? PlayerId::Player2 : PlayerId::Player1; }
+};
 
-void read_input(char board[], char sendline[], PlayerId player) {
+/*
+    aplica a jogada "linha coluna" (de 1 a 3) de `player`; jogadas inválidas do
+    próprio jogador (`local`) são explicadas na tela
+*/
+bool applyMove(Game &game, char *move, PlayerId player, bool local) {
     int line, column;
-    bool valid = false;
 
-    while (!valid) {
-        fflush(stdin); 
+    treat_line(move, " ", line, column);
 
-        printf("Sua vez (seu símbolo é '%c'). Dê as coordenadas (linha, coluna) no intervalo [1, 3]: ", player);
+    if (line < 0 || line > 2 || column < 0 || column > 2) {
+        if (local) printf("[Células inválidas] linha = %d, coluna = %d. Escolha uma linha e uma coluna entre 1 e 3\n", line + 1, column + 1);
 
-        while (fgets(sendline, MAXLINE, stdin) == NULL);
+        return false;
+    }
 
-        treat_line(sendline, " ", line, column);
+    if (game.board[column + line * 3] != ' ') {
+        if (local) printf("[Células inválidas] linha = %d, coluna = %d. Escolha uma célula vazia.\n", line + 1, column + 1);
 
-        if (column + line * 3 >= 9 || column + line * 3 < 0)
-            printf("[Células inválidas] linha = %d, coluna = %d. Escolha uma linha e uma coluna entre 1 e 3\n", line + 1, column + 1);
-        else {
-            if (board[column + line * 3] != ' ') printf("[Células inválidas] linha = %d, coluna = %d. Escolha uma célula vazia.\n", line + 1, column + 1);
-            else {
-                valid = true;
-                board[column + line * 3] = player;
-            }
-        }
-    };
+        return false;
+    }
+
+    game.board[column + line * 3] = player;
+    ++game.moves;
+
+    return true;
+}
+
+void promptMove(Game &game) {
+    if (game.myTurn) printf("Sua vez (seu símbolo é '%c'). Dê as coordenadas (linha, coluna) no intervalo [1, 3]: ", game.me);
+    else printf("Esperando a jogada do outro jogador...\n");
+
+    fflush(stdout);
 }
 
 /*
@@ -75,146 +104,274 @@ void update_screen(char *board) {
     }
 }
 
-char test_board(char *board) {
-    for (int i = 0; i < 3; ++i) {
-        /* horizontal test: line i */
-        if (board[0 + 3 * i] == board[1 + 3 * i] && board[1 + 3 * i] == board[2 + 3 * i]) return board[2 + 3 * i];
+void startGame(Game &game, PlayerId me) {
+    for (int i = 0; i < 9; ++i) game.board[i] = PlayerId::NoPlayer;
 
-        /* vertical test: column i */
-        if (board[i + 0 * 3] == board[i + 1 * 3] && board[i + 1 * 3] == board[i + 2 * 3]) return board[i + 2 * 3];
-    }
+    game.me = me;
+    game.myTurn = (me == PlayerId::Player1);
+    game.moves = 0;
 
-    /* diagonal test: column i */
-    if (board[0 + 0 * 3] == board[1 + 1 * 3] && board[1 + 1 * 3] == board[2 + 2 * 3]) return board[2 + 2 * 3];
+    clearScreen();
 
-    /* antidiagonal test: column i */
-    if (board[2 + 0 * 3] == board[1 + 1 * 3] && board[1 + 1 * 3] == board[0 + 2 * 3]) return board[0 + 2 * 3];
+    update_screen(game.board);
 
-    return PlayerId::NoPlayer;
+    promptMove(game);
 }
 
-char play_game(int sockfd, sock::SocketAddr ppeeraddr, PlayerId player) {
-    printf("\033[2J\033[1;1H");
-
-    char winner;
-    int line, column;
-    char board[9], sendline[MAXLINE];
+/* caso a partida tenha acabado, mostra o resultado e envia o score ao servidor */
+bool finishGame(Game &game, int serverfd) {
+    char winner = test_board(game.board);
 
-    for (int i = 0; i < 9; ++i) board[i] = PlayerId::NoPlayer;
+    if (winner == PlayerId::NoPlayer && game.moves < 9) return false;
 
-    update_screen(board);
+    int score = (winner == game.me) ? 1 : 0;
 
-    fflush(stdin);
+    clearScreen();
+    printf("************************************************************\n");
 
-    if (player == PlayerId::Player1) {
-        for (int i = 0; i < 4; ++i) {
-            read_input(board, sendline, player);
+    if (winner == game.me) {
+        printf("*              Parabéns!!! Você venceu o jogo!             *\n");
+    } else if (winner == game.opponent()) {
+        printf("*              Desculpa!!! Você perdeu o jogo!             *\n");
+    } else {
+        printf("*                Mehhhhhh!!! O jogo empatou!               *\n");
+    }
 
-            update_screen(board);
+    printf("* Tecle enter para voltar a lista de clientes disponiveis. *\n");
+    printf("************************************************************\n\n\n");
+    fflush(stdout);
 
-            sock::Sendto(sockfd, sendline, &ppeeraddr);
+    sock::send<sock::msg::Finish>(serverfd, score);
 
-            if ((winner = test_board(board)) && winner != ' ') break;
-            
-            sock::Recvfrom(sockfd, sendline, MAX_LINE, &ppeeraddr);
+    return true;
+}
 
-            treat_line(sendline, " ", line, column);
+/*
+    desiste de esperar: avisa o outro jogador (caso conhecido) e libera a reserva
+    que o servidor já tenha feito para a partida, como se ela tivesse acabado sem pontos
+*/
+void giveUp(Game &game, int serverfd) {
+    if (game.peerId >= 0) sock::writeDenyMsg2(serverfd, game.peerId);
 
-            board[column + line * 3] = PlayerId::Player2;
+    sock::send<sock::msg::Finish>(serverfd, 0);
 
-            update_screen(board);
+    game.peerId = -1;
+}
 
-            if ((winner = test_board(board)) && winner != ' ') break;
-        }
-    } else {
-        for (int i = 0; i < 4; ++i) {
-            sock::Recvfrom(sockfd, sendline, MAX_LINE, &ppeeraddr);
+/* tira a próxima linha completa (sem o '\n') do buffer da entrada padrão */
+bool nextLine(char *inbuf, int &inlen, char *line) {
+    char *end = (char *) memchr(inbuf, '\n', inlen);
 
-            treat_line(sendline, " ", line, column);
+    /* linha maior que o buffer: tratada como se estivesse completa */
+    if (end == NULL && inlen < MAX_LINE - 1) return false;
 
-            board[column + line * 3] = PlayerId::Player1;
+    int len = (end != NULL) ? (int) (end - inbuf) : inlen;
 
-            update_screen(board);
+    memcpy(line, inbuf, len);
+    line[len] = '\0';
 
-            if ((winner = test_board(board)) && winner != ' ') break;
+    if (end != NULL) ++len;
 
-            read_input(board, sendline, player);
+    memmove(inbuf, inbuf + len, inlen - len);
+    inlen -= len;
 
-            sock::Sendto(sockfd, sendline, &ppeeraddr);
-        
-            update_screen(board);
+    return true;
+}
 
-            if ((winner = test_board(board)) && winner != ' ') break;
-        }
-    }
-    
-    return winner;
+void requestList(int serverfd) {
+    sock::send<sock::msg::ListRequest>(serverfd);
 }
 
 void verify_input(int argc, char **argv) {
     /* 
         Verificamos se o usuário passou o número correto de parâmetros
     */
-    if (argc != 3) {
+    if (argc < 2) {
         char   error[MAXLINE + 1];
 
         strcpy(error, "uso: ");
         strcat(error, argv[0]);
-        strcat(error, " <IPaddress>");
-        strcat(error, " <Port>");
+        strcat(error, " <IPaddress> <Port> | <IPaddress:Port> [<IPaddress:Port> ...]");
         perror(error);
         exit(1);
     }
 }
 
-void printListOfClients(std::map<int, std::string> &clients, std::set<int> &playing, std::map<int, int> &scores, int myId) {
-    printf("\033[2J\033[1;1H");
-    printf("**********************************\n");
-    printf("*       Minhas credenciais:      *\n");
-    printf("**********************************\n");
-    auto cli = clients.find(myId);
-    bool available = true;
-    int score = scores[cli->first];
+/*
+    endereço do servidor: o dado na linha de comando (<IPaddress> <Port>) ou, com uma
+    lista de candidatos IP:porta (broadcast incluído), o menos carregado que responder
+    à descoberta (ver include/discovery.h)
+*/
+sock::SocketAddr chooseServer(int argc, char **argv) {
+    if (argc == 3 && strchr(argv[1], ':') == NULL && strchr(argv[2], ':') == NULL) return sock::SocketAddr(AF_INET, (char *) argv[1], atoi(argv[2]));
+
+    std::vector<sock::SocketAddr> targets;
+    bool broadcast = false;
+
+    for (int i = 1; i < argc; ++i) {
+        sock::SocketAddr addr(0, 0, 0);
+
+        if (!discovery::parseCandidate(argv[i], addr)) {
+            fprintf(stderr, "candidato inválido (esperado IP:porta): %s\n", argv[i]);
+            exit(1);
+        }
+
+        broadcast = broadcast || discovery::isBroadcast(addr);
+
+        targets.push_back(addr);
+    }
+
+    sock::SocketAddr chosen(0, 0, 0);
+
+    if (discovery::choose(targets, broadcast, chosen)) return chosen;
+
+    /* nenhum respondeu (servidores sem descoberta?): tenta o primeiro diretamente */
+    for (auto &target : targets) {
+        if (!discovery::isBroadcast(target)) return target;
+    }
+
+    fprintf(stderr, "nenhum servidor respondeu à descoberta\n");
+    exit(1);
+}
+
+/* RTT de um jogador até o servidor, como o servidor o mediu ("-" enquanto não medido) */
+std::string rttText(std::map<int, int> &rtts, int id) {
+    char text[32];
+    auto it = rtts.find(id);
+
+    if (it == rtts.end() || it->second <= 0) return "-";
+
+    snprintf(text, sizeof(text), "%.1f ms", it->second / 1000.0);
+
+    return text;
+}
+
+/*
+    texto de outro jogador pronto para a tela: bytes de controle (< 0x20 e 0x7f) viram '?',
+    para que um anúncio não mova o cursor, apague a tela nem mude as cores do terminal
+*/
+std::string printable(const std::string &text) {
+    std::string out(text);
+
+    for (auto &c : out) {
+        if ((unsigned char) c < 0x20 || c == 0x7f) c = '?';
+    }
 
-    if (playing.find(cli->first) != playing.end()) available = false;
+    return out;
+}
+
+/*
+    monta a tela do lobby e desenha só o que mudou desde a última vez (ver include/screen.h);
+    a lista mostra só os clientes que cabem no terminal, a partir de listOffset
+*/
+void printListOfClients(std::map<int, std::string> &clients, std::set<int> &playing, std::map<int, int> &scores, std::map<int, int> &rtts, std::set<int> &following, std::deque<std::string> &mural, int myId) {
+    static std::vector<std::string> frame;
+    char line[MAXLINE];
+
+    view.measure();
+
+    frame.clear();
+
+    frame.push_back("**********************************");
+    frame.push_back("*       Minhas credenciais:      *");
+    frame.push_back("**********************************");
+
+    auto me = clients.find(myId);
+
+    snprintf(line, sizeof(line), "* Meu usuario: %d", myId);
+    frame.push_back(line);
+
+    snprintf(line, sizeof(line), "*    - id: %s", (me != clients.end()) ? me->second.c_str() : "");
+    frame.push_back(line);
+
+    snprintf(line, sizeof(line), "*    - score: %d", scores.count(myId) ? scores[myId] : 0);
+    frame.push_back(line);
+
+    snprintf(line, sizeof(line), "*    - status: %s", playing.count(myId) ? "ocupado" : "disponível");
+    frame.push_back(line);
+
+    snprintf(line, sizeof(line), "*    - rtt: %s", rttText(rtts, myId).c_str());
+    frame.push_back(line);
+
+    snprintf(line, sizeof(line), "*    - sala: %s", room.empty() ? "(lobby principal)" : room.c_str());
+    frame.push_back(line);
+
+    frame.push_back("**********************************");
+    frame.push_back("");
+
+    frame.push_back("**********************************");
+    frame.push_back("*       Lista de clientes:       *");
+    frame.push_back("**********************************");
 
-    printf("* Meu usuario: %d                 *\n*    - id: %s  *\n*    - score: %d                  *\n*    - status: ", myId, cli->second.c_str(), score);
+    int total = (int) clients.size() - (me != clients.end() ? 1 : 0);
 
-    if (available) printf("disponível\n");
-    else printf("ocupado\n");
+    /* linhas fixas: cabeçalho acima, rodapé da lista, mural, prompt e a linha para onde o enter leva o cursor */
+    int reserved = (int) frame.size() + 2 + (mural.empty() ? 0 : (int) mural.size() + 4) + 5;
 
-    printf("**********************************\n");
-    printf("\n\n");
+    listPage = std::max(1, view.rows() - reserved);
 
-    printf("**********************************\n");
-    printf("*       Lista de clientes:       *\n");
-    printf("**********************************\n");
+    if (listOffset > total - listPage) listOffset = total - listPage;
+    if (listOffset < 0) listOffset = 0;
+
+    if (total > 0) {
+        int index = 0;
+
+        frame.push_back("*    id  endereço                 score      rtt  status");
 
-    if (clients.size() > 0) {
         for (auto &cli : clients) {
-            if (myId != cli.first) {
-                bool available = true;
-                int score = scores[cli.first];
+            if (cli.first == myId) continue;
 
-                if (playing.find(cli.first) != playing.end()) available = false;
+            if (index >= listOffset + listPage) break;
 
-                printf("* Cliente %d:                     *\n*    - id: %s  *\n*    - score: %d                  *\n*    - status: ", cli.first, cli.second.c_str(), score);
+            if (index++ < listOffset) continue;
 
-                if (available) printf("disponível\n");
-                else printf("ocupado\n");
-                printf("**********************************\n");
-            }
+            snprintf(line, sizeof(line), "* %5d  %-23s %6d %8s  %s%s", cli.first, cli.second.c_str(), scores.count(cli.first) ? scores[cli.first] : 0, rttText(rtts, cli.first).c_str(),
+                playing.count(cli.first) ? "ocupado" : "disponível", following.count(cli.first) ? " (seguindo)" : "");
+            frame.push_back(line);
         }
+
+        snprintf(line, sizeof(line), "* clientes %d-%d de %d", listOffset + 1, std::min(total, listOffset + listPage), total);
+        frame.push_back(line);
     } else {
-        printf("*              Vazia             *\n");
+        frame.push_back("*              Vazia             *");
+        frame.push_back("");
     }
 
-    printf("\nEscolha o cliente ('enter' para atualizar lista): ");
-    fflush(stdout);
+    if (mural.size() > 0) {
+        frame.push_back("");
+        frame.push_back("**********************************");
+        frame.push_back("*       Anúncios do lobby:       *");
+        frame.push_back("**********************************");
+
+        for (auto &msg : mural) frame.push_back(msg);
+    }
+
+    frame.push_back("");
+    frame.push_back("'enter' atualiza, '*' melhor adversário, '#sala' troca de sala, '<'/'>' navega");
+    frame.push_back("'+id'/'-id' segue/deixa de seguir, '!texto' anuncia, '@' joga contra o servidor");
+    frame.push_back("Escolha o cliente: ");
+
+    view.render(frame);
+}
+
+/* conecta de novo ao servidor (que pode estar reiniciando); retorna o novo socket, ou -1 */
+int reconnect(sock::SocketAddr &servaddr) {
+    for (int attempt = 0; attempt < RECONNECT_ATTEMPTS; ++attempt) {
+        int sockfd = sock::Socket(AF_INET, SOCK_STREAM, 0);
+
+        if (connect(sockfd, (struct sockaddr *) &servaddr.addr, sizeof(servaddr.addr)) == 0) return sockfd;
+
+        sock::Close(sockfd);
+
+        usleep(RECONNECT_INTERVAL_MS * 1000);
+    }
+
+    return -1;
 }
 
 int main(int argc, char **argv) {
-    char *buf = new char[MAX_LINE];
+    char *inbuf = new char[MAX_LINE];
+    char *line = new char[MAX_LINE];
     char *recvline = new char[MAX_LINE];
 
     verify_input(argc, argv);
@@ -224,7 +381,7 @@ int main(int argc, char **argv) {
         tipo internet (AF_INET), assim como a porta de conexão
         com o servidor
     */
-    sock::SocketAddr servaddr(AF_INET, (char *) argv[1], atoi(argv[2]));
+    sock::SocketAddr servaddr = chooseServer(argc, argv);
 
     /* cria um novo socket para realizar as requisições */
     int serverfd = sock::Socket(AF_INET, SOCK_STREAM, 0);
@@ -232,7 +389,7 @@ int main(int argc, char **argv) {
     /* conecta o socket criado ao servidor */
     sock::Connect(serverfd, &servaddr);
 
-    int counter = 0;
+    int inlen = 0;
     int local_port = 0; 
     char local_ip[16] = {0};
 
@@ -251,212 +408,427 @@ int main(int argc, char **argv) {
     sock::Bind(peerfd, &cliaddr);
 
     int myId = -1;
+    long long session = 0;
     std::set<int> playing;
+    std::set<int> following;
+    std::deque<std::string> mural;
     std::map<int, int> scores;
+    std::map<int, int> rtts;
     std::map<int, std::string> clients;
 
     fd_set rset;
 
-    FD_ZERO(&rset); /* limpas os bits de rset */
-    
-    std::cout << "\033[2J\033[1;1H";
-
-    sock::MessageStatus msgStatus = sock::UpdateList;
+    clearScreen();
 
-    sock::Write(serverfd, (char *) &msgStatus, sizeof(msgStatus));
+    requestList(serverfd);
 
-    int score = 0;
-    std::string aceite;
-    char winner = PlayerId::NoPlayer;
-    int n, idCli, randNum, peerport;
-    std::string address, peerip;
+    UiState state = Lobby;
+    Game game;
+    sock::MessageStatus msgStatus;
+    int n, idCli, randNum, score;
+    long long stamp = 0;
+    std::string address;
+    schema::Endpoint peerEndpoint;
+    sock::PresenceStatus presence;
 
     while (true) {
+        FD_ZERO(&rset); /* limpas os bits de rset */
+
         FD_SET(fileno(stdin), &rset); /* seta o bit de rset referente a posição 'fileno(fp)' */
 
         FD_SET(serverfd, &rset); /* seta o bit de rset referente a posição 'sockfd' */
 
-        int maxfdp1 = std::max(fileno(stdin), serverfd) + 1;
+        int maxfd = std::max(fileno(stdin), serverfd);
 
-        /* executa a função select enquanto ou o socket 'sockfd' ou o stdin não estiverem prontos para leitura */
-        int nready = sock::Select(maxfdp1, &rset);
+        /* o socket do jogo só é lido durante a partida (uma jogada que chegue antes do AcceptMsg espera no buffer) */
+        if (state == Playing) {
+            FD_SET(peerfd, &rset);
 
-        if (nready > 0) {
-            /* Verifica se o socket 'sockfd' está pronto para ser lido */
-            if (FD_ISSET(serverfd, &rset)) {
-                if ((n = sock::Read(serverfd, (char *) &msgStatus, sizeof(sock::MessageStatus))) == 0) {
-                    break;
-                }
+            maxfd = std::max(maxfd, peerfd);
+        }
 
-                switch (msgStatus) {
-                    case sock::NewGameMsg:
-                        sock::readNewGameMsg(serverfd, idCli);
+        /* executa a função select enquanto nenhum dos descritores estiver pronto para leitura */
+        int nready = sock::Select(maxfd + 1, &rset);
 
-                        printf("\033[2J\033[1;1H");
-                        printf("************************************************************\n");
-                        printf("* Convite de jogo pelo cliente: %d\n", idCli);
+        if (nready <= 0) continue;
 
-                        printf("* Voce aceita o convite? ('S' ou 'N'): ");
+        /* Verifica se o socket 'sockfd' está pronto para ser lido */
+        if (FD_ISSET(serverfd, &rset)) {
+            if ((n = sock::Read(serverfd, (char *) &msgStatus, sizeof(sock::MessageStatus))) == 0) {
+                /* o servidor caiu: reconecta e pede de volta o id anterior (o socket dos jogos continua o mesmo) */
+                int fd = (session != 0) ? reconnect(servaddr) : -1;
 
-                        aceite = "";
-                        std::getline (std::cin, aceite);
+                if (fd < 0) break;
 
-                        if (aceite == "S") {
-                            sock::writeAcceptMsg2(serverfd, idCli);
-                        } else {
-                            sock::writeDenyMsg2(serverfd, idCli);
-                            printListOfClients(clients, playing, scores, myId);
-                        }
+                sock::Close(serverfd);
+                serverfd = fd;
+
+                sock::writeSessionMsg(serverfd, sock::ResumeMsg, myId, session);
+
+                // a new process that did not restore us puts us back in the main lobby
+                if (!room.empty()) sock::writeRoomMsg(serverfd, room.c_str());
+
+                if (!following.empty()) {
+                    std::vector<int> ids(following.begin(), following.end());
 
+                    sock::writeSubscribeMsg(serverfd, sock::SubscribeMsg, (int) ids.size(), ids.data());
+                }
+
+                requestList(serverfd);
+
+                continue;
+            }
+
+            switch (msgStatus) {
+                case sock::NewGameMsg:
+                    sock::readNewGameMsg(serverfd, idCli);
+
+                    // busy (answering another invite, waiting for an answer or playing): refuse without asking
+                    if (state != Lobby) {
+                        sock::writeDenyMsg2(serverfd, idCli);
                         break;
+                    }
 
-                    case sock::AcceptMsg:
-                        sock::readAcceptMsg(serverfd, recvline, address, randNum);
+                    game.peerId = idCli;
+                    state = Invited;
 
-                        getIpPort(address, peerip, peerport);
+                    clearScreen();
+                    printf("************************************************************\n");
+                    printf("* Convite de jogo pelo cliente: %d\n", idCli);
 
-                        printf("Starting game with: %s -- %d (rand num = %d)\n", peerip.c_str(), peerport, randNum);
+                    printf("* Voce aceita o convite? ('S' ou 'N'): ");
+                    fflush(stdout);
 
-                        score = 0;
+                    break;
 
-                        winner = PlayerId::NoPlayer;
+                case sock::AcceptMsg:
+                    sock::readAcceptMsg(serverfd, peerEndpoint, randNum);
 
-                        if (randNum == 0) {
-                            sock::SocketAddr peerAddr(AF_INET, peerip.c_str(), peerport);
+                    // a match we gave up on (or never asked for): release the reservation instead of playing
+                    if (state != Waiting) {
+                        if (state != Playing) sock::send<sock::msg::Finish>(serverfd, 0);
 
-                            /* conecta o socket criado ao cliente X */
-                            sock::Connect(peerfd, &peerAddr);
-                            
-                            winner = play_game(peerfd, peerAddr, PlayerId::Player1);
+                        break;
+                    }
 
-                            printf("\033[2J\033[1;1H");
-                            printf("************************************************************\n");
+                    game.peer = sock::endpointAddr(peerEndpoint);
 
-                            if (winner == PlayerId::Player1) {
-                                score += 1;
-                                printf("*              Parabéns!!! Você venceu o jogo!             *\n");
-                            } else if (winner == PlayerId::Player2) {
-                                printf("*              Desculpa!!! Você perdeu o jogo!             *\n");
-                            } else {
-                                printf("*                Mehhhhhh!!! O jogo empatou!               *\n");
-                            }
-                        } else {
-                            sock::SocketAddr peerAddr(AF_INET, peerip.c_str(), peerport);
+                    /* conecta o socket do jogo ao outro jogador */
+                    sock::Connect(peerfd, &game.peer);
 
-                            /* conecta o socket criado ao cliente X */
-                            sock::Connect(peerfd, &peerAddr);
-                            
-                            winner = play_game(peerfd, peerAddr, PlayerId::Player2);
+                    startGame(game, (randNum == 0) ? PlayerId::Player1 : PlayerId::Player2);
 
-                            printf("\033[2J\033[1;1H");
-                            printf("************************************************************\n");
+                    state = Playing;
 
-                            if (winner == PlayerId::Player2) {
-                                score += 1;
-                                printf("*              Parabéns!!! Você venceu o jogo!             *\n");
-                            } else if (winner == PlayerId::Player1) {
-                                printf("*              Desculpa!!! Você perdeu o jogo!             *\n");
-                            } else {
-                                printf("*                Mehhhhhh!!! O jogo empatou!               *\n");
-                            }
-                        }
+                    break;
 
+                case sock::DenyMsg:
+                    // the inviter gave up before we answered
+                    if (state == Invited) {
+                        clearScreen();
+                        printf("************************************************************\n");
+                        printf("*        O convite foi cancelado pelo outro jogador.       *\n");
                         printf("* Tecle enter para voltar a lista de clientes disponiveis. *\n");
                         printf("************************************************************\n\n\n");
+                        fflush(stdout);
 
-                        msgStatus = sock::FinishGame;
+                        game.peerId = -1;
+                        state = Notice;
 
-                        sock::Write(serverfd, (char *) &msgStatus, sizeof(msgStatus));
+                        break;
+                    }
 
-                        sock::Write(serverfd, (char *) &score, sizeof(score));
+                    // only an invite we are still waiting on can be refused
+                    if (state != Waiting) break;
 
-                        if (fgets (recvline, MAX_LINE, stdin) >= 0) {
-                            printListOfClients(clients, playing, scores, myId);
-                        }
+                    clearScreen();
+                    printf("************************************************************\n");
+                    printf("*          Voce foi rejeitado pelo outro jogador.          *\n");
+                    printf("* Tecle enter para voltar a lista de clientes disponiveis. *\n");
+                    printf("************************************************************\n\n\n");
+                    fflush(stdout);
 
-                        msgStatus = sock::UpdateList;
+                    state = Notice;
 
-                        sock::Write(serverfd, (char *) &msgStatus, sizeof(msgStatus));
+                    break;
 
-                        break;
+                case sock::UpdateList:
+                    sock::readListOfClients(serverfd, clients, playing, scores, rtts, myId);
 
-                    case sock::DenyMsg:
-                        printf("\033[2J\033[1;1H");
-                        printf("************************************************************\n");
-                        printf("*          Voce foi rejeitado pelo outro jogador.          *\n");
-                        printf("* Tecle enter para voltar a lista de clientes disponiveis. *\n");
-                        printf("************************************************************\n\n\n");
+                    if (state == Lobby) printListOfClients(clients, playing, scores, rtts, following, mural, myId);
+
+                    break;
+
+                case sock::PresenceMsg:
+                    sock::readPresenceMsg(serverfd, idCli, presence, score, address);
+
+                    // update only the followed player, no need to fetch the whole list
+                    if (presence == sock::PlayerLeft) {
+                        clients.erase(idCli);
+                        scores.erase(idCli);
+                        playing.erase(idCli);
+
+                        // the server dropped the subscription: the id may come back as someone else
+                        following.erase(idCli);
+                    } else {
+                        clients[idCli] = address;
+                        scores[idCli] = score;
+
+                        if (presence == sock::PlayerPlaying) playing.insert(idCli);
+                        else playing.erase(idCli);
+                    }
+
+                    if (state == Lobby) printListOfClients(clients, playing, scores, rtts, following, mural, myId);
+
+                    break;
+
+                case sock::BroadcastMsg:
+                    sock::readBroadcastMsgFrom(serverfd, idCli, address);
+
+                    mural.push_back("[" + std::to_string(idCli) + "] " + printable(address));
+
+                    if (mural.size() > MURAL_SIZE) mural.pop_front();
+
+                    if (state == Lobby) printListOfClients(clients, playing, scores, rtts, following, mural, myId);
+
+                    break;
+
+                case sock::SessionMsg:
+                    // our id and the token that lets us take it back after a server restart
+                    sock::readSessionMsg(serverfd, myId, session);
+
+                    break;
+
+                case sock::PingMsg:
+                    // RTT measurement: the server's timestamp goes back untouched, even in the middle of a game
+                    sock::readPingMsg(serverfd, stamp);
+                    sock::writePingMsg(serverfd, stamp);
+
+                    break;
+
+                case sock::RoomMsg:
+                    // the room we are in now (the server keeps the old one if the change was refused)
+                    if (sock::readRoomMsg(serverfd, recvline) < 0) break;
+
+                    if (room != recvline) {
+                        room = recvline;
+
+                        // subscriptions and announcements do not cross rooms
+                        following.clear();
+                        mural.clear();
+
+                        listOffset = 0;
+                    }
+
+                    // the new list follows this message
+                    break;
 
-                        if (fgets (recvline, MAX_LINE, stdin) >= 0) {
-                            printListOfClients(clients, playing, scores, myId);
+                case sock::FinishGame:
+                case sock::SubscribeMsg:
+                case sock::UnsubscribeMsg:
+                case sock::ResumeMsg:
+                    break;
+            }
+        }
+
+        /* jogada do outro jogador */
+        if (state == Playing && FD_ISSET(peerfd, &rset)) {
+            sock::Recvfrom(peerfd, line, MAX_LINE - 1, &game.peer);
+
+            if (!game.myTurn && applyMove(game, line, game.opponent(), false)) {
+                update_screen(game.board);
+
+                if (finishGame(game, serverfd)) {
+                    state = Notice;
+                } else {
+                    game.myTurn = true;
+
+                    promptMove(game);
+                }
+            }
+        }
+
+        /* Verifica se o file descriptor da entrada padrão do programa (stdin) está 
+            preparado para ter seu conteúdo lido */
+        if (FD_ISSET(fileno(stdin), &rset)) {
+            /* lê tudo o que estiver disponível; as linhas completas são tratadas abaixo */
+            if ((n = sock::Read(fileno(stdin), inbuf + inlen, MAX_LINE - 1 - inlen)) == 0) break;
+
+            inlen += n;
+
+            while (nextLine(inbuf, inlen, line)) {
+                switch (state) {
+                    case Invited:
+                        if (strcmp(line, "S") == 0) {
+                            sock::writeAcceptMsg2(serverfd, game.peerId);
+
+                            state = Waiting;
+
+                            clearScreen();
+                            printf("*          Esperando o início do jogo (enter desiste)        *\n");
+                            fflush(stdout);
+                        } else {
+                            sock::writeDenyMsg2(serverfd, game.peerId);
+
+                            state = Lobby;
+
+                            printListOfClients(clients, playing, scores, rtts, following, mural, myId);
                         }
 
                         break;
 
-                    case sock::UpdateList:
-                        sock::readListOfClients(serverfd, recvline, clients, playing, scores, myId);
+                    case Waiting:
+                        giveUp(game, serverfd);
+
+                        state = Lobby;
+
+                        printListOfClients(clients, playing, scores, rtts, following, mural, myId);
+
+                        requestList(serverfd);
+
+                        break;
+
+                    case Notice:
+                        state = Lobby;
+
+                        printListOfClients(clients, playing, scores, rtts, following, mural, myId);
 
-                        printListOfClients(clients, playing, scores, myId);
+                        requestList(serverfd);
 
                         break;
 
-                    case sock::FinishGame:
+                    case Playing:
+                        if (!game.myTurn) {
+                            promptMove(game);
+                            break;
+                        }
+
+                        if (!applyMove(game, line, game.me, true)) {
+                            promptMove(game);
+                            break;
+                        }
+
+                        update_screen(game.board);
+
+                        sock::Sendto(peerfd, line, &game.peer);
+
+                        if (finishGame(game, serverfd)) {
+                            state = Notice;
+                        } else {
+                            game.myTurn = false;
+
+                            promptMove(game);
+                        }
+
                         break;
-                }
-            }
 
-            /* Verifica se o file descriptor da entrada padrão do programa (stdin) está 
-                preparado para ter seu conteúdo lido */
-            if (FD_ISSET(fileno(stdin), &rset)) {
-                /* lê o conteúdo da entrada padrão (stdin) e verifica se todo o arquivo de entrada foi lido */
-                int n = sock::Read(fileno(stdin), buf + counter, 1);
+                    case Lobby:
+                        if (line[0] == '!') {
+                            // announcement to the whole lobby (without the '!')
+                            int len = (int) strlen(line) - 1;
 
-                counter += n; /* atualiza o número de caracters contido na linha */
+                            if (len > MAX_BROADCAST) len = MAX_BROADCAST;
 
-                /* verifica se uma linha já foi lida por completo, para poder ser enviada para o servidor */
-                if (buf[counter - 1] == '\n' || buf[counter - 1] == '\t') {
-                    buf[counter] = '\0';
+                            if (len > 0) sock::writeBroadcastMsg(serverfd, line + 1, len);
 
-                    // send to server --> NewGame
-                    int peerId = atoi(buf);
-                    bool clientFound = false;
+                            break;
+                        }
+
+                        if (line[0] == '+' || line[0] == '-') {
+                            // follow / unfollow a player: the server pushes its status changes from now on
+                            int followId = atoi(line + 1);
+
+                            if (line[0] == '+') {
+                                following.insert(followId);
+                                sock::writeSubscribeMsg(serverfd, sock::SubscribeMsg, 1, &followId);
+                            } else {
+                                following.erase(followId);
+                                sock::writeSubscribeMsg(serverfd, sock::UnsubscribeMsg, 1, &followId);
+                            }
+
+                            printListOfClients(clients, playing, scores, rtts, following, mural, myId);
 
-                    for (auto &cli : clients) {
-                        if (cli.first == peerId && cli.first != myId) {
-                            clientFound = true;
                             break;
                         }
-                    }
-    
-                    if (clientFound) {
-                        printf("\033[2J\033[1;1H");
-                        printf("************************************************************\n");
-                        printf("*                Voce escolheu o cliente: %d                *\n", peerId);
-                        printf("*          Agora espere a resposta do outro cliente        *\n");
-                        printf("************************************************************\n");
 
-                        sock::writeNewGameMsg(serverfd, peerId);
-                    } else if (peerId != 0) {
-                        printf("\033[2J\033[1;1H");
-                        printf("************************************************************\n");
-                        printf("*            Voce escolheu um cliente invalido.            *\n");
-                        printf("* Tecle enter para voltar a lista de clientes disponiveis. *\n");
-                        printf("************************************************************\n\n\n");
+                        if (line[0] == '@') {
+                            // a match against the server's bot
+                            clearScreen();
+                            printf("************************************************************\n");
+                            printf("*            Pedindo uma partida contra o servidor         *\n");
+                            printf("************************************************************\n");
+                            fflush(stdout);
 
-                        if (fgets (recvline, MAX_LINE, stdin) >= 0) {
-                            printListOfClients(clients, playing, scores, myId);
+                            sock::writeNewGameMsg(serverfd, BOT_PEER);
+
+                            game.peerId = -1;
+                            state = Waiting;
+
+                            break;
                         }
-                        
-                        sock::MessageStatus msgStatus = sock::UpdateList;
 
-                        sock::Write(serverfd, (char *) &msgStatus, sizeof(msgStatus));
-                    } else {
-                        sock::MessageStatus msgStatus = sock::UpdateList;
+                        if (line[0] == '*') {
+                            // matchmaking: the server invites the available player with the lowest latency
+                            clearScreen();
+                            printf("************************************************************\n");
+                            printf("*   Procurando o adversario de menor latencia na sala...   *\n");
+                            printf("*          Agora espere a resposta do outro cliente        *\n");
+                            printf("************************************************************\n");
+                            fflush(stdout);
 
-                        sock::Write(serverfd, (char *) &msgStatus, sizeof(msgStatus));
-                    }
+                            sock::writeNewGameMsg(serverfd, BEST_PEER);
+
+                            game.peerId = -1;
+                            state = Waiting;
+
+                            break;
+                        }
+
+                        if (line[0] == '#') {
+                            // change room (an empty name goes back to the main lobby)
+                            if (strlen(line + 1) < ROOM_NAME_LEN) sock::writeRoomMsg(serverfd, line + 1);
+
+                            break;
+                        }
+
+                        if (line[0] == '<' || line[0] == '>') {
+                            // scroll the client list one page (only the visible part is drawn)
+                            listOffset += (line[0] == '>') ? listPage : -listPage;
 
-                    counter = 0; /* zera o contador de caracters da linha */
+                            printListOfClients(clients, playing, scores, rtts, following, mural, myId);
+
+                            break;
+                        }
+
+                        // send to server --> NewGame
+                        int peerId = atoi(line);
+
+                        if (peerId != myId && clients.count(peerId)) {
+                            clearScreen();
+                            printf("************************************************************\n");
+                            printf("*                Voce escolheu o cliente: %d                *\n", peerId);
+                            printf("*          Agora espere a resposta do outro cliente        *\n");
+                            printf("************************************************************\n");
+                            fflush(stdout);
+
+                            sock::writeNewGameMsg(serverfd, peerId);
+
+                            game.peerId = peerId;
+                            state = Waiting;
+                        } else if (peerId != 0) {
+                            clearScreen();
+                            printf("************************************************************\n");
+                            printf("*            Voce escolheu um cliente invalido.            *\n");
+                            printf("* Tecle enter para voltar a lista de clientes disponiveis. *\n");
+                            printf("************************************************************\n\n\n");
+                            fflush(stdout);
+
+                            state = Notice;
+                        } else {
+                            requestList(serverfd);
+                        }
+
+                        break;
                 }
             }
         }
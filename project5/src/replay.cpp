@@ -0,0 +1,492 @@
+#include <socket.h>
+#include <capture.h>
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+
+/*
+    Reprodução de uma captura do servidor (LOBBY_CAPTURE, ver include/capture.h).
+
+    Os bytes que cada cliente enviou são separados em mensagens e reenviados
+    para o servidor em <IP>:<Port> por uma conexão nova para cada conexão
+    capturada, no mesmo ritmo (velocidade 1), N vezes mais rápido
+    (velocidade N) ou sem esperar (max). Com <Cópias> > 1 cada conexão da
+    captura é reproduzida por várias conexões ao mesmo tempo. Os ids de
+    jogador nas mensagens (convites, inscrições, ...) e as fichas de sessão
+    dos ResumeMsg são traduzidos para os que o servidor deu às conexões da
+    mesma cópia.
+
+    Os PingMsg capturados não são reenviados: o replay responde aos PingMsg
+    do servidor na hora, como um cliente. No fim ele imprime a vazão, a
+    latência das respostas (UpdateList, RoomMsg e a SessionMsg de um
+    ResumeMsg, medidas a partir do instante em que o último byte do pedido
+    mais antigo ainda sem resposta foi escrito no socket) e, por tipo, quantas mensagens o servidor enviou na captura e
+    no replay; conexões que receberam uma quantidade diferente de algum tipo
+    são contadas como divergentes.
+*/
+#define REPLAY_DRAIN_MS 500     /* fim do replay: tempo sem receber nada depois da última mensagem */
+
+class Message {
+    public:
+        long long timeUs;
+        int conn;
+        capture::Kind kind;
+        std::string bytes;
+};
+
+class Conn {
+    public:
+        int fd, copy, source;
+        bool finished, shut;    // a conexão capturada fechou; o lado de escrita já foi fechado
+        std::string in, out;
+        long long queued, written;  // bytes já postos em `out` e já escritos no socket, desde o início
+        std::deque<std::pair<long long, int> > unsent;  // pedidos em `out`: onde terminam (em `queued`) e o tipo
+        int received[NUM_MSG_TYPES];
+        std::deque<long long> waiting[NUM_MSG_TYPES];  // instante em que cada pedido sem resposta foi escrito
+
+        Conn() : fd(-1), copy(0), source(0), finished(false), shut(false), queued(0), written(0) {
+            for (int i = 0; i < NUM_MSG_TYPES; ++i) received[i] = 0;
+        }
+};
+
+/* o que a captura tem de cada conexão: as mensagens do servidor por tipo e o id que ele deu a ela */
+class Source {
+    public:
+        std::string in, out;
+        int expected[NUM_MSG_TYPES];
+        int id;
+        long long session;
+
+        Source() : id(-1), session(0) {
+            for (int i = 0; i < NUM_MSG_TYPES; ++i) expected[i] = 0;
+        }
+};
+
+static std::vector<Message> messages;
+static std::vector<Source> sources;
+static std::vector<Conn> conns;
+static std::vector<std::map<int, int> > idMaps;     // por cópia: id na captura -> id no replay
+static std::vector<std::map<long long, long long> > sessionMaps;    // por cópia: ficha na captura -> ficha no replay
+static std::vector<long long> latencies[NUM_MSG_TYPES];
+static long long sent = 0, received = 0, bytesSent = 0, bytesReceived = 0;
+static int invalid = 0;
+
+/* tipo do pedido cuja resposta é `status` (-1 caso `status` não seja resposta de um pedido) */
+int requestOf(int status) {
+    switch (status) {
+        case sock::UpdateList: return sock::UpdateList;
+        case sock::RoomMsg: return sock::RoomMsg;
+        case sock::SessionMsg: return sock::ResumeMsg;
+    }
+
+    return -1;
+}
+
+Source &sourceOf(int conn) {
+    if (conn >= (int) sources.size()) sources.resize(conn + 1);
+
+    return sources[conn];
+}
+
+void load(const char *path) {
+    FILE *fp = fopen(path, "rb");
+
+    if (fp == NULL) {
+        perror("open error");
+        exit(1);
+    }
+
+    capture::Header header;
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION) {
+        fprintf(stderr, "%s: arquivo de captura inválido\n", path);
+        exit(1);
+    }
+
+    capture::Record record;
+    std::vector<char> bytes;
+
+    while (fread(&record, sizeof(record), 1, fp) == 1) {
+        bytes.resize(record.len);
+
+        if (record.len > 0 && fread(&bytes[0], 1, record.len, fp) != record.len) break;
+
+        if (record.conn < 0) continue;
+
+        Source &source = sourceOf(record.conn);
+
+        if (record.kind == capture::Open || record.kind == capture::Close) {
+            Message message;
+
+            message.timeUs = record.timeUs;
+            message.conn = record.conn;
+            message.kind = (capture::Kind) record.kind;
+
+            messages.push_back(message);
+            continue;
+        }
+
+        bool fromServer = (record.kind == capture::Output);
+        std::string &stream = fromServer ? source.out : source.in;
+        int size;
+
+        stream.append(bytes.begin(), bytes.end());
+
+        /* uma mensagem termina no registro em que seu último byte aparece */
+        while ((size = capture::messageSize(stream.data(), (int) stream.size(), fromServer)) > 0) {
+            int status = stream[0];
+
+            if (fromServer) {
+                ++source.expected[status];
+
+                if (status == sock::SessionMsg && source.id < 0) {
+                    memcpy(&source.id, stream.data() + 1, sizeof(int));
+                    memcpy(&source.session, stream.data() + 1 + sizeof(int), sizeof(long long));
+                }
+            } else if (status != sock::PingMsg) {
+                Message message;
+
+                message.timeUs = record.timeUs;
+                message.conn = record.conn;
+                message.kind = capture::Input;
+                message.bytes = stream.substr(0, size);
+
+                messages.push_back(message);
+            }
+
+            stream.erase(0, size);
+        }
+
+        if (size < 0) {
+            ++invalid;
+            stream.clear();
+        }
+    }
+
+    fclose(fp);
+
+    /* os registros são gravados em ordem, mas carregam o instante do primeiro trecho */
+    std::stable_sort(messages.begin(), messages.end(), [](const Message &a, const Message &b) { return a.timeUs < b.timeUs; });
+}
+
+/* troca um id da captura pelo da mesma cópia no replay (ids ainda desconhecidos ficam como estão) */
+void translate(std::string &bytes, int off, int copy) {
+    int id;
+
+    memcpy(&id, bytes.data() + off, sizeof(id));
+
+    auto it = idMaps[copy].find(id);
+
+    if (it != idMaps[copy].end()) memcpy(&bytes[off], &it->second, sizeof(int));
+}
+
+/* o mesmo para uma ficha de sessão */
+void translateSession(std::string &bytes, int off, int copy) {
+    long long session;
+
+    memcpy(&session, bytes.data() + off, sizeof(session));
+
+    auto it = sessionMaps[copy].find(session);
+
+    if (it != sessionMaps[copy].end()) memcpy(&bytes[off], &it->second, sizeof(long long));
+}
+
+void dispatch(Message &message, int copy, sock::SocketAddr &servaddr) {
+    Conn &conn = conns[copy * sources.size() + message.conn];
+
+    if (message.kind == capture::Open) {
+        if (conn.fd >= 0 || conn.finished) return;
+
+        conn.fd = sock::Socket(AF_INET, SOCK_STREAM, 0);
+
+        sock::Connect(conn.fd, &servaddr);
+
+        fcntl(conn.fd, F_SETFL, fcntl(conn.fd, F_GETFL, 0) | O_NONBLOCK);
+
+        return;
+    }
+
+    /* o fechamento espera o envio do que falta; depois disso só as respostas são lidas */
+    if (message.kind == capture::Close) {
+        conn.finished = true;
+        return;
+    }
+
+    if (conn.fd < 0 || conn.finished) return;
+
+    std::string bytes = message.bytes;
+    int status = bytes[0], count;
+
+    switch (status) {
+        case sock::NewGameMsg:
+        case sock::AcceptMsg:
+        case sock::DenyMsg:
+            translate(bytes, 1, copy);
+            break;
+
+        case sock::ResumeMsg:
+            translate(bytes, 1, copy);
+            translateSession(bytes, 1 + sizeof(int), copy);
+            break;
+
+        case sock::SubscribeMsg:
+        case sock::UnsubscribeMsg:
+            memcpy(&count, bytes.data() + 1, sizeof(count));
+
+            for (int k = 0; k < count; ++k) translate(bytes, 5 + 4 * k, copy);
+
+            break;
+    }
+
+    /* a latência conta a partir da escrita do pedido no socket (ver flush), não daqui */
+    conn.out += bytes;
+    conn.queued += bytes.size();
+    conn.unsent.push_back(std::make_pair(conn.queued, status));
+
+    ++sent;
+    bytesSent += bytes.size();
+}
+
+void receive(Conn &conn, long long now) {
+    char buf[65536];
+    int n, size;
+
+    while ((n = read(conn.fd, buf, sizeof(buf))) > 0) {
+        conn.in.append(buf, n);
+        bytesReceived += n;
+    }
+
+    bool eof = (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK));
+
+    while ((size = capture::messageSize(conn.in.data(), (int) conn.in.size(), true)) > 0) {
+        int status = conn.in[0];
+
+        ++conn.received[status];
+        ++received;
+
+        /* respostas agrupadas (várias UpdateList viram uma lista): a mais antiga define a latência */
+        int request = requestOf(status);
+
+        if (request >= 0 && !conn.waiting[request].empty()) {
+            latencies[status].push_back(now - conn.waiting[request].front());
+
+            conn.waiting[request].clear();
+        }
+
+        if (status == sock::SessionMsg) {
+            Source &source = sources[conn.source];
+            int id;
+            long long session;
+
+            memcpy(&id, conn.in.data() + 1, sizeof(id));
+            memcpy(&session, conn.in.data() + 1 + sizeof(int), sizeof(session));
+
+            if (source.id >= 0) idMaps[conn.copy][source.id] = id;
+
+            /* só a primeira SessionMsg: a de uma sessão retomada traz a ficha antiga */
+            if (source.session != 0) sessionMaps[conn.copy].insert(std::make_pair(source.session, session));
+        }
+
+        /* responde na hora, como o cliente */
+        if (status == sock::PingMsg && !conn.shut) {
+            conn.out.append(conn.in.data(), size);
+            conn.queued += size;
+        }
+
+        conn.in.erase(0, size);
+    }
+
+    if (size < 0) {
+        ++invalid;
+        conn.in.clear();
+    }
+
+    if (eof) {
+        sock::Close(conn.fd);
+        conn.fd = -1;
+        conn.finished = true;
+    }
+}
+
+void flush(Conn &conn) {
+    if (conn.fd < 0 || conn.out.empty()) return;
+
+    int n = send(conn.fd, conn.out.data(), conn.out.size(), MSG_NOSIGNAL);
+
+    if (n > 0) {
+        long long now = sock::nowUs();
+
+        conn.out.erase(0, n);
+        conn.written += n;
+
+        /* pedidos cujo último byte acabou de ser escrito: começa a espera pela resposta */
+        while (!conn.unsent.empty() && conn.unsent.front().first <= conn.written) {
+            conn.waiting[conn.unsent.front().second].push_back(now);
+            conn.unsent.pop_front();
+        }
+    }
+
+    /* o servidor fechou a conexão: o resto não tem para onde ir */
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        conn.out.clear();
+        conn.unsent.clear();
+    }
+
+    /* o servidor vê o fim da conexão e a fecha do seu lado, depois de responder o que recebeu */
+    if (conn.finished && conn.out.empty() && !conn.shut) {
+        shutdown(conn.fd, SHUT_WR);
+        conn.shut = true;
+    }
+}
+
+double percentile(std::vector<long long> &values, double p) {
+    return values[(size_t) (p * (values.size() - 1))];
+}
+
+int main (int argc, char **argv) {
+    /*
+       Verificamos se o usuário passou o número correto de parâmetros
+    */
+    if (argc < 4) {
+        char   error[200];
+
+        strcpy(error,"uso: ");
+        strcat(error,argv[0]);
+        strcat(error," <IP> <Port> <CaptureFile> [<Velocidade: 1, 10, ... ou max>] [<Cópias>]");
+        perror(error);
+
+        exit(1);
+    }
+
+    double speed = (argc > 4 && strcmp(argv[4], "max") != 0) ? atof(argv[4]) : (argc > 4 ? 0 : 1);
+    int copies = (argc > 5) ? std::max(1, atoi(argv[5])) : 1;
+
+    sock::SocketAddr servaddr(AF_INET, (char *) argv[1], atoi(argv[2]));
+
+    load(argv[3]);
+
+    conns.resize(copies * sources.size());
+    idMaps.resize(copies);
+    sessionMaps.resize(copies);
+
+    for (int copy = 0; copy < copies; ++copy) {
+        for (size_t k = 0; k < sources.size(); ++k) {
+            conns[copy * sources.size() + k].copy = copy;
+            conns[copy * sources.size() + k].source = k;
+        }
+    }
+
+    long long start = sock::nowUs(), lastInput = start;
+    size_t next = 0;
+    std::vector<struct pollfd> fds;
+    std::vector<int> polled;
+
+    while (true) {
+        long long now = sock::nowUs();
+
+        /* mensagens cujo instante (na escala da velocidade) já chegou, em todas as cópias */
+        while (next < messages.size() && (speed <= 0 || messages[next].timeUs / speed <= now - start)) {
+            for (int copy = 0; copy < copies; ++copy) dispatch(messages[next], copy, servaddr);
+
+            ++next;
+        }
+
+        fds.clear();
+        polled.clear();
+
+        for (size_t i = 0; i < conns.size(); ++i) {
+            flush(conns[i]);
+
+            if (conns[i].fd < 0) continue;
+
+            struct pollfd pfd = {conns[i].fd, (short) (POLLIN | (conns[i].out.empty() ? 0 : POLLOUT)), 0};
+
+            fds.push_back(pfd);
+            polled.push_back(i);
+        }
+
+        /* terminou: nada mais a enviar e o servidor ficou quieto por REPLAY_DRAIN_MS */
+        if (next == messages.size() && (fds.empty() || now - lastInput >= REPLAY_DRAIN_MS * 1000LL)) break;
+
+        int wait = REPLAY_DRAIN_MS;
+
+        if (next < messages.size()) {
+            long long due = (speed <= 0) ? 0 : (long long) (messages[next].timeUs / speed) - (now - start);
+
+            wait = (int) std::max(0LL, std::min((long long) wait, due / 1000));
+        }
+
+        if (poll(fds.empty() ? NULL : &fds[0], fds.size(), wait) < 0) {
+            perror("poll error");
+            exit(1);
+        }
+
+        now = sock::nowUs();
+
+        for (size_t k = 0; k < fds.size(); ++k) {
+            if (fds[k].revents & (POLLIN | POLLERR | POLLHUP)) {
+                receive(conns[polled[k]], now);
+
+                lastInput = now;
+            }
+        }
+    }
+
+    double seconds = (sock::nowUs() - start) / 1e6;
+
+    printf("replay de %s: %zu conexões x %d cópias, velocidade %s\n", argv[3], sources.size(), copies, (argc > 4) ? argv[4] : "1");
+    printf("  duração         %10.3f s\n", seconds);
+    printf("  enviadas        %10lld mensagens (%.0f/s), %lld bytes\n", sent, sent / seconds, bytesSent);
+    printf("  recebidas       %10lld mensagens (%.0f/s), %lld bytes\n", received, received / seconds, bytesReceived);
+
+    if (invalid > 0) printf("  fluxos inválidos %9d\n", invalid);
+
+    printf("\nlatência das respostas (us)\n  %-14s %8s %10s %10s %10s %10s %10s\n", "", "n", "min", "p50", "p90", "p99", "max");
+
+    for (int status = 0; status < NUM_MSG_TYPES; ++status) {
+        std::vector<long long> &values = latencies[status];
+
+        if (values.empty()) continue;
+
+        std::sort(values.begin(), values.end());
+
+        printf("  %-14s %8zu %10lld %10.0f %10.0f %10.0f %10lld\n", sock::messageName(status), values.size(),
+            values.front(), percentile(values, 0.5), percentile(values, 0.9), percentile(values, 0.99), values.back());
+    }
+
+    /* o PingMsg depende só do tempo, não do tráfego */
+    int divergent = 0;
+
+    printf("\nmensagens do servidor por tipo (captura x %d cópias / replay)\n", copies);
+
+    for (int status = 0; status < NUM_MSG_TYPES; ++status) {
+        long long expected = 0, got = 0;
+
+        if (status == sock::PingMsg) continue;
+
+        for (size_t i = 0; i < conns.size(); ++i) {
+            expected += sources[conns[i].source].expected[status];
+            got += conns[i].received[status];
+        }
+
+        if (expected > 0 || got > 0) printf("  %-14s %10lld %10lld%s\n", sock::messageName(status), expected, got, (expected != got) ? "  *" : "");
+    }
+
+    for (size_t i = 0; i < conns.size(); ++i) {
+        for (int status = 0; status < NUM_MSG_TYPES; ++status) {
+            if (status != sock::PingMsg && conns[i].received[status] != sources[conns[i].source].expected[status]) {
+                ++divergent;
+                break;
+            }
+        }
+    }
+
+    printf("  conexões divergentes: %d de %zu\n", divergent, conns.size());
+
+    return 0;
+}
@@ -1,26 +1,102 @@
 #include <socket.h>
+#include <shard.h>
+#include <presence.h>
+#include <broadcast.h>
+#include <ratelimit.h>
+#include <lobby.h>
+#include <alloc.h>
+#include <log.h>
+#include <trace.h>
+#include <handoff.h>
+#include <checkpoint.h>
+#include <replica.h>
+#include <latency.h>
+#include <capture.h>
+#include <scheduler.h>
+#include <bot.h>
+#include <overload.h>
+#include <discovery.h>
+#include <handlers.h>
 
 #define LISTENQ 9
 #define MAXLINE 4096
 #define NUMCOMMANDS 4
 #define MAXCOMMAND 10
 #define MAXDATASIZE 100
+#define RETRY_INTERVAL_MS 50 /* intervalo para reavaliar clientes limitados pelos token buckets */
+#define RESUME_GRACE_MS 10000 /* tempo para um jogador restaurado do checkpoint retomar a sessão */
 
-#include <set>
-#include <map>
+#include <string>
+#include <vector>
 #include <stdio.h>
 #include <cstdlib>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+/* orçamento total de requisições por conexão (requisições por segundo, rajada) */
+static const ratelimit::Rule requestRule = {20, 40};
+
+/* limites por tipo de mensagem, na ordem do enum sock::MessageStatus */
+static const ratelimit::Rule messageRules[] = {
+    {1, 3},     // NewGameMsg
+    {0, 0},     // AcceptMsg
+    {0, 0},     // DenyMsg
+    {2, 3},     // UpdateList
+    {0, 0},     // FinishGame
+    {5, 10},    // SubscribeMsg
+    {5, 10},    // UnsubscribeMsg
+    {0, 0},     // PresenceMsg
+    {1, 5},     // BroadcastMsg
+    {0, 0},     // SessionMsg
+    {1, 3},     // ResumeMsg
+    {1, 3},     // RoomMsg
+    {2, 5}      // PingMsg
+};
+
+/* pedidos feitos por sinais, tratados no fim da iteração do loop */
+volatile sig_atomic_t reportRequested = 0, stopRequested = 0;
+
+void sig_report(int signo) { reportRequested = 1; }
+
+void sig_stop(int signo) { stopRequested = 1; }
+
+/*
+    ficha de sessão nova (nunca 0, que o cliente usa para "sem sessão"): 64 bits do
+    gerador do kernel, para que uma ficha não possa ser adivinhada a partir do
+    horário e do pid do servidor. rand() fica só para o sorteio de quem começa
+*/
+long long newSession() {
+    long long session = 0;
+
+    while (session == 0) {
+        if (getrandom(&session, sizeof(session), 0) != (ssize_t) sizeof(session)) {
+            perror("getrandom error");
+            exit(1);
+        }
+    }
+
+    return session;
+}
+
+/* escopo atual das contas de alocação e de syscalls (make IOSTAT=1) */
+void enterScope(int scope) {
+    alloc::scope = scope;
+
+    IOSTAT_CONTEXT(scope);
+}
 
 int main (int argc, char **argv) {
     /* 
        Verificamos se o usuário passou o número correto de parâmetros
     */
-    if (argc != 2) {
-       char   error[100];
+    if (argc != 2 && argc < 5) {
+       char   error[200];
 
        strcpy(error,"uso: ");
        strcat(error,argv[0]);
-       strcat(error," <Port>");
+       strcat(error," <Port> [<ShardId> <ShardIP:MeshPort> <ShardIP:MeshPort> ...]");
        perror(error);
 
        exit(1);
@@ -34,24 +110,221 @@ int main (int argc, char **argv) {
     */
     sock::SocketAddr servaddr(AF_INET, (int) INADDR_ANY, atoi(argv[1])), clientaddr(0, 0, 0);
 
-    /* cria um novo socket */
-    int listenfd = sock::Socket(AF_INET, SOCK_STREAM, 0);
+    /*
+       LOBBY_STANDBY=<porta>: este processo é o reserva do primário que replica nessa
+       porta (ver include/replica.h); só segue adiante quando o primário deixar de existir
+    */
+    const char *standbyPort = getenv("LOBBY_STANDBY");
+    std::vector<checkpoint::Entry> replicated;
+
+    if (standbyPort != NULL) {
+        int shardId = (argc >= 5) ? atoi(argv[2]) : 0, numShards = (argc >= 5) ? argc - 3 : 1;
+
+        replica::follow(atoi(standbyPort), shardId, numShards, replicated);
+    }
+
+    /*
+       LOBBY_HANDOFF=<caminho>: caso outro servidor já esteja escutando nesse caminho,
+       este processo assume os sockets e o estado dele (ver include/handoff.h)
+    */
+    const char *handoffPath = getenv("LOBBY_HANDOFF");
+    handoff::Snapshot snapshot;
+    int handoffConn = (handoffPath != NULL) ? handoff::connect(handoffPath) : -1;
+
+    if (handoffConn >= 0 && !handoff::receive(handoffConn, snapshot)) {
+        perror("handoff receive error");
+        exit(1);
+    }
+
+    int listenfd;
+
+    if (handoffConn >= 0) {
+        listenfd = snapshot.listenfd;
+    } else {
+        /* cria um novo socket */
+        listenfd = sock::Socket(AF_INET, SOCK_STREAM, 0);
 
-    /* atrela este socket a uma porta e interface de rede dada por 'servaddr' */
-    sock::Bind(listenfd, &servaddr);
+        /* permite reabrir a porta logo depois de uma queda (as conexões antigas ficam em TIME_WAIT) */
+        int reuse = 1;
 
-    /* faz com que o socket vire um socket passivo (escuta requisições) */
-    sock::Listen(listenfd, LISTENQ);
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        /* atrela este socket a uma porta e interface de rede dada por 'servaddr' */
+        sock::Bind(listenfd, &servaddr);
+
+        /* faz com que o socket vire um socket passivo (escuta requisições) */
+        sock::Listen(listenfd, LISTENQ);
+    }
+
+    /* 
+       caso o servidor seja um dos shards do lobby, abre o socket da malha
+       (argv[3 + i] é o endereço da malha do shard i)
+    */
+    shard::Mesh mesh;
+
+    if (argc >= 5) {
+        std::vector<std::string> addresses(argv + 3, argv + argc);
+
+        mesh.open(atoi(argv[2]), addresses, (handoffConn >= 0) ? snapshot.meshfd : -1);
+    }
+
+    /* o processo antigo precisa ter a mesma configuração de shards (sem a confirmação ele continua servindo) */
+    if (handoffConn >= 0 && (snapshot.header.shardId != mesh.id || snapshot.header.numShards != mesh.count)) {
+        fprintf(stderr, "handoff: configuração de shards diferente da do processo atual\n");
+        exit(1);
+    }
+
+    /* socket de controle por onde o próximo processo pedirá o lobby */
+    int controlfd = -1;
+
+    if (handoffPath != NULL) controlfd = (handoffConn >= 0) ? snapshot.controlfd : handoff::listen(handoffPath);
+
+    /* LOBBY_REPLICATE=<porta>: envia as alterações do lobby a um processo reserva */
+    const char *replicatePort = getenv("LOBBY_REPLICATE");
+    replica::Primary replicas;
+
+    if (replicatePort != NULL) replicas.open(atoi(replicatePort), mesh.id, mesh.count, (handoffConn >= 0) ? snapshot.replicafd : -1);
+
+    /* 
+       todas as tabelas são reservadas aqui; depois disso o loop não aloca memória
+       (LOBBY_STRICT_ALLOC=1 faz o servidor abortar caso isso deixe de ser verdade)
+    */
+    lobby::Roster roster;
+
+    roster.init(mesh.count * FD_SETSIZE);
+
+    /*
+       LOBBY_CHECKPOINT=<caminho>: o estado dos jogadores locais é mantido num arquivo
+       mapeado em memória; depois de uma queda, o novo processo o restaura e os
+       clientes têm RESUME_GRACE_MS para retomar a sessão (ver include/checkpoint.h)
+    */
+    const char *checkpointPath = getenv("LOBBY_CHECKPOINT");
+    checkpoint::Store store;
+    lobby::IndexSet orphans;       // slots restaurados do checkpoint ainda sem conexão
+    long long orphansDeadline = 0;
+
+    orphans.init(FD_SETSIZE);
+
+    if (checkpointPath != NULL && store.open(checkpointPath, mesh.id, mesh.count) && handoffConn < 0 && standbyPort == NULL) {
+        /*
+            na troca de processo o estado vem do processo antigo (que só entrega o lobby sem jogadores
+            restaurados pendentes), e no reserva da replicação, ambos mais recentes
+        */
+        store.restore(roster, orphans);
+
+        orphansDeadline = sock::nowMs() + RESUME_GRACE_MS;
+    }
+
+    /* o reserva assume os jogadores do primário, que têm RESUME_GRACE_MS para reconectar */
+    for (int slot = 1; slot < (int) replicated.size(); ++slot) {
+        checkpoint::Entry &entry = replicated[slot];
+        int id = mesh.playerId(slot);
+
+        if (!entry.present || !roster.add(id, entry.player.address)) continue;
+
+        roster.at(id).playing = entry.player.playing;
+        roster.at(id).score = entry.player.score;
+        roster.at(id).session = entry.player.session;
+
+        roster.join(id, roster.findRoom(entry.room, true));
+
+        orphans.insert(slot);
+
+        orphansDeadline = sock::nowMs() + RESUME_GRACE_MS;
+    }
+
+    /*
+       LOBBY_CAPTURE=<caminho>: grava o tráfego de cada conexão de cliente, para ser
+       reproduzido pelo bin/replay.o (ver include/capture.h)
+    */
+    const char *capturePath = getenv("LOBBY_CAPTURE");
+
+    if (capturePath != NULL) capture::start(capturePath);
+
+    /*
+       o bot do servidor (NewGameMsg para BOT_PEER) e os workers que calculam as suas
+       jogadas; LOBBY_WORKERS=<n> liga n workers, sem eles o loop faz o cálculo (ver include/scheduler.h)
+    */
+    bot::Arena arena;
+    sched::Scheduler workers;
+
+    arena.open();
+
+    /* os workers e a thread do log não entram na contagem de alocações do loop (ver include/alloc.h) */
+    sched::onThreadStart = alloc::exemptThread;
+    logger::onThreadStart = alloc::exemptThread;
+
+    if (getenv("LOBBY_WORKERS") != NULL) workers.start(atoi(getenv("LOBBY_WORKERS")));
+
+    /*
+       atraso do loop e fila medidos a cada iteração; passados os limites (LOBBY_OVERLOAD_LAG_MS,
+       LOBBY_OVERLOAD_DEPTH) o trabalho opcional é cortado em estágios (ver include/overload.h)
+    */
+    overload::Monitor load;
+
+    load.init(FD_SETSIZE, sock::nowMs());
+
+    /* responde, na mesma porta em UDP, às sondas de descoberta dos clientes com a carga atual (ver include/discovery.h) */
+    discovery::Responder beacon;
+    int connections = 0;    // clientes conectados a este processo
+
+    beacon.open(atoi(argv[1]));
+
+    srand(time(NULL) ^ getpid());
+
+    alloc::strict = (getenv("LOBBY_STRICT_ALLOC") != NULL && atoi(getenv("LOBBY_STRICT_ALLOC")) != 0);
+
+    /* o log é escrito por uma thread de fundo; o buffer desta thread é reservado aqui */
+    logger::start();
+
+    /* só abre o arquivo de trace quando compilado com make TRACE=1 */
+    TRACE_START();
+
+    /* contas de syscalls por escopo; o relatório sai junto com o de alocações */
+    IOSTAT_START(alloc::scopeName, 0);
+    enterScope(alloc::ScopeStartup);
+
+    signal(SIGUSR1, sig_report);
+    signal(SIGINT, sig_stop);
+    signal(SIGTERM, sig_stop);
+    signal(SIGPIPE, SIG_IGN);
 
     int maxi = -1;
     fd_set rset, allset;
     int maxfd = listenfd;
     int nready, client[FD_SETSIZE];
 
-    int score;
-    std::set<int> playing;
-    std::map<int, int> scores;
-    std::map<int, std::string> clients;
+    presence::Index followers;
+    int followIds[MAXSUBSCRIBE];
+
+    followers.init(roster.capacity(), FD_SETSIZE);
+
+    /* um lote de anúncios por sala (indexado como roster.rooms) */
+    std::vector<broadcast::Batch> announcements(MAX_ROOMS);
+    char recvline[MAX_BROADCAST + 1], roomName[ROOM_NAME_LEN];
+
+    /* limites de requisição por conexão e conexões com trabalho adiado (lista pendente ou leitura suspensa) */
+    ratelimit::ClientLimits limits[FD_SETSIZE];
+    bool pendingList[FD_SETSIZE];
+    lobby::IndexSet deferred;
+
+    deferred.init(FD_SETSIZE);
+
+    for (int i = 0; i < FD_SETSIZE; ++i) pendingList[i] = false;
+
+    latency::Sampler rtts;
+
+    /* clientes que aceitaram o convite de outro shard, à espera do AcceptAck */
+    shard::Reservations reservations;
+
+    reservations.init(FD_SETSIZE);
+
+    bool presenceDirty = false;
+    long long lastGossip = 0;
+    shard::Packet packet;
+
+    /* o estado que os tratadores das mensagens de jogo usam (ver include/handlers.h) */
+    handlers::Context game(roster, mesh, followers, arena, workers, reservations, load, rtts, client, pendingList, deferred, presenceDirty);
 
     for (int i = 0; i < FD_SETSIZE; ++i) client[i] = -1; /* inicializa todos os índices do vetor de clientes como estando inativos */
 
@@ -59,21 +332,299 @@ int main (int argc, char **argv) {
 
     FD_SET(listenfd, &allset); /* seta o bit listenfd de allset */
 
+    if (mesh.enabled()) {
+        FD_SET(mesh.fd, &allset);
+
+        if (mesh.fd > maxfd) maxfd = mesh.fd;
+    }
+
+    if (controlfd >= 0) {
+        FD_SET(controlfd, &allset);
+
+        if (controlfd > maxfd) maxfd = controlfd;
+    }
+
+    if (replicas.enabled()) {
+        FD_SET(replicas.listenfd, &allset);
+
+        if (replicas.listenfd > maxfd) maxfd = replicas.listenfd;
+    }
+
+    FD_SET(arena.fd, &allset);
+
+    if (arena.fd > maxfd) maxfd = arena.fd;
+
+    if (beacon.enabled()) {
+        FD_SET(beacon.fd, &allset);
+
+        if (beacon.fd > maxfd) maxfd = beacon.fd;
+    }
+
+    if (workers.enabled()) {
+        FD_SET(workers.fd(), &allset);
+
+        if (workers.fd() > maxfd) maxfd = workers.fd();
+    }
+
+    /* retoma os clientes do processo antigo, com o mesmo slot (e portanto o mesmo id) */
+    if (handoffConn >= 0) {
+        for (int i = 0; i < snapshot.header.numSlots; ++i) {
+            handoff::SlotState &state = snapshot.slots[i];
+            int slot = state.slot, id = mesh.playerId(slot);
+
+            client[slot] = snapshot.fds[i];
+
+            capture::recorder.connect(client[slot]);
+
+            FD_SET(client[slot], &allset);
+
+            if (client[slot] > maxfd) maxfd = client[slot];
+
+            if (slot > maxi) maxi = slot;
+
+            roster.add(id, state.player.address);
+            roster.setPlaying(id, state.player.playing);
+            roster.at(id).score = state.player.score;
+            roster.at(id).session = state.player.session;
+
+            roster.join(id, roster.findRoom(state.room, true));
+
+            roster.at(id).rtt = state.player.rtt;
+            roster.at(id).tcpRtt = state.player.tcpRtt;
+
+            limits[slot].reset(requestRule, messageRules, sizeof(messageRules) / sizeof(messageRules[0]));
+
+            pendingList[slot] = state.pendingList;
+
+            if (state.pendingList) deferred.insert(slot);
+
+            for (int k = 0; k < state.numFollowing; ++k) followers.subscribe(slot, state.following[k]);
+        }
+
+        followers.settle(roster);
+
+        connections = snapshot.header.numSlots;
+
+        presenceDirty = true;
+
+        handoff::acknowledge(handoffConn);
+
+        sock::Close(handoffConn);
+
+        LOG_INFO("handoff: %d clientes retomados", snapshot.header.numSlots);
+    }
+
+    if (standbyPort != NULL) LOG_INFO("replica: o primário deixou de existir; assumindo o lobby");
+
+    if (!orphans.empty()) LOG_INFO("%s: %d jogadores restaurados", (standbyPort != NULL) ? "replica" : "checkpoint", orphans.size);
+
+    /* o arquivo passa a refletir este processo a partir daqui */
+    if (store.enabled()) store.save(roster, sock::nowMs());
+
+    int successor = -1;         // conexão do processo que vai assumir o lobby
+    long long successorDeadline = 0;
+    bool handedOff = false;
+
+    alloc::steady = true;
+
     /* 
        Servidor entra em um loop infinito esperando por novas requisições dos clientes
+       (até receber SIGINT/SIGTERM)
     */
-    for ( ; ; ) {
+    while (!stopRequested) {
+        enterScope(alloc::ScopeWait);
+
         rset = allset; /* atribuição da estrutura */
-        nready = sock::Select(maxfd + 1, &rset);
 
-        if (FD_ISSET(listenfd, &rset)) { /* nova conexão de cliente */
+        /*
+            acorda a cada RTT_SAMPLE_MS para medir o RTT dos clientes, a cada GOSSIP_INTERVAL_MS
+            para enviar o resumo de presença aos outros shards, e a cada RETRY_INTERVAL_MS
+            enquanto houver clientes limitados
+        */
+        int wait = (roster.size() > 0) ? RTT_SAMPLE_MS : -1;
+
+        if (mesh.enabled() || !orphans.empty()) wait = GOSSIP_INTERVAL_MS;
+        if (!deferred.empty() || replicas.pending() || successor >= 0) wait = RETRY_INTERVAL_MS;
+
+        /* sob carga, o que foi agrupado precisa sair, e o estágio precisa poder descer mesmo sem tráfego */
+        if (load.shedding(overload::Coalesce) && (wait < 0 || wait > OVERLOAD_COALESCE_MS)) wait = OVERLOAD_COALESCE_MS;
+
+        {
+            TRACE_SPAN(StageSelect, -1);
+
+            if (wait >= 0) {
+                struct timeval timeout = {wait / 1000, (wait % 1000) * 1000};
+
+                nready = sock::Select(maxfd + 1, &rset, &timeout);
+            } else {
+                nready = sock::Select(maxfd + 1, &rset);
+            }
+        }
+
+        /* o atraso de uma iteração é o tempo entre o retorno do select e a próxima chamada */
+        long long busyStart = sock::nowUs();
+        int ready = nready;
+
+        if (mesh.enabled() && FD_ISSET(mesh.fd, &rset)) { /* mensagem de outro shard */
+            int from, to, randNum, len, roomLen, room;
+            char address[ADDR_LEN];
+            schema::Endpoint peerEndpoint;  // address no formato do AcceptMsg
+            shard::MeshMsg meshMsg;
+
+            TRACE_SPAN(StageMesh, mesh.fd);
+
+            enterScope(alloc::ScopeMesh);
+
+            mesh.receive(packet);
+
+            if (packet.get(meshMsg)) {
+                switch (meshMsg) {
+                    case shard::Presence:
+                        mesh.applyPresence(packet, roster);
+
+                        followers.touchAll();
+
+                        break;
+
+                    case shard::Invite:
+                        if (!packet.get(from) || !packet.get(to)) break;
+
+                        // the invited player lives here: same checks as a local NewGameMsg
+                        if (mesh.slotOf(to) >= 0 && client[mesh.slotOf(to)] >= 0 && !roster.isPlaying(to) && roster.sameRoom(from, to)) {
+                            sock::writeNewGameMsg(client[mesh.slotOf(to)], from);
+                        } else {
+                            mesh.sendInvite(shard::Deny, to, from);
+                        }
+
+                        break;
+
+                    case shard::Deny:
+                        if (!packet.get(from) || !packet.get(to)) break;
+
+                        if (mesh.slotOf(to) >= 0) sock::writeDenyMsg(client[mesh.slotOf(to)]);
+
+                        break;
+
+                    case shard::Accept:
+                        if (!packet.get(from) || !packet.get(to)) break;
+
+                        // the accepting shard holds a reservation: a malformed Accept must still release it
+                        if (!packet.get(randNum) || !packet.getString(address, ADDR_LEN, len) || !sock::parseEndpoint(address, peerEndpoint)) {
+                            mesh.sendInvite(shard::Abort, to, from);
+                            break;
+                        }
+
+                        // the inviter lives here and is the authority over its own availability
+                        if (mesh.slotOf(to) >= 0 && client[mesh.slotOf(to)] >= 0 && !roster.isPlaying(to)) {
+                            int rand1 = rand() % 2;
+                            int rand2 = (rand1 == 0) ? 1 : 0;
+
+                            roster.setPlaying(to, true);
+                            roster.setPlaying(from, true);
+
+                            followers.touch(to);
+                            followers.touch(from);
+
+                            sock::writeAcceptMsg(client[mesh.slotOf(to)], peerEndpoint, rand1);
+
+                            mesh.sendAccept(shard::AcceptAck, to, from, roster.at(to).address, rand2);
+
+                            presenceDirty = true;
+                        } else {
+                            mesh.sendInvite(shard::Abort, to, from);
+                        }
+
+                        break;
+
+                    case shard::AcceptAck:
+                        if (!packet.get(from) || !packet.get(to) || !packet.get(randNum) || !packet.getString(address, ADDR_LEN, len)) break;
+
+                        // too late: the reservation already expired and the client was told
+                        if (!reservations.release(mesh.slotOf(to), from)) break;
+
+                        roster.setPlaying(from, true);
+
+                        followers.touch(from);
+
+                        if (mesh.slotOf(to) >= 0 && sock::parseEndpoint(address, peerEndpoint)) sock::writeAcceptMsg(client[mesh.slotOf(to)], peerEndpoint, randNum);
+
+                        break;
+
+                    case shard::Broadcast:
+                        if (!packet.get(from) || !packet.getString(recvline, MAX_BROADCAST + 1, len) || !packet.getString(roomName, ROOM_NAME_LEN, roomLen)) break;
+
+                        // already rate limited by the sender's shard; a room nobody is in here has no one to deliver to
+                        if ((room = roster.findRoom(roomName, false)) >= 0) announcements[room].add(from, recvline, len);
+
+                        break;
+
+                    case shard::Abort:
+                        if (!packet.get(from) || !packet.get(to)) break;
+
+                        // release the reservation made when the AcceptMsg was forwarded (unless it already expired)
+                        if (!reservations.release(mesh.slotOf(to), from)) break;
+
+                        roster.setPlaying(to, false);
+
+                        followers.touch(to);
+
+                        sock::writeDenyMsg(client[mesh.slotOf(to)]);
+
+                        presenceDirty = true;
+
+                        break;
+                }
+            }
+
+            --nready;
+        }
+
+        if (FD_ISSET(arena.fd, &rset)) { /* jogada de um cliente numa partida contra o bot */
+            enterScope(alloc::ScopeWork);
+
+            arena.receive(workers);
+
+            --nready;
+        }
+
+        if (beacon.enabled() && FD_ISSET(beacon.fd, &rset)) { /* sondas de descoberta */
+            enterScope(alloc::ScopeWork);
+
+            beacon.answer(connections, FD_SETSIZE - 1 - orphans.size, load.level);
+
+            --nready;
+        }
+
+        if (workers.enabled() && FD_ISSET(workers.fd(), &rset)) { /* jogadas do bot calculadas pelos workers */
+            enterScope(alloc::ScopeWork);
+
+            workers.drain([&arena](sched::Task &task) { arena.reply(task); });
+
+            --nready;
+        }
+
+        if (FD_ISSET(listenfd, &rset) && load.shedding(overload::Refuse)) { /* sobrecarga: a conexão é fechada sem entrar no lobby */
+            enterScope(alloc::ScopeAccept);
+
+            sock::Close(Accept(listenfd, &clientaddr));
+
+            ++load.refused;
+
+            --nready;
+        } else if (FD_ISSET(listenfd, &rset)) { /* nova conexão de cliente */
             int i;
+
+            TRACE_SPAN(StageAccept, listenfd);
+
+            enterScope(alloc::ScopeAccept);
+
             /* quando uma requisição for recebida, servidor a aceita */
             int connfd = Accept(listenfd, &clientaddr);      
 
-            /* informa que o file descriptor na posição i agora está ativo (e relacionado com o cliente i) */
+            /* informa que o file descriptor na posição i agora está ativo (e relacionado com o cliente i);
+               os slots restaurados do checkpoint ficam reservados para quem retomar a sessão */
             for (i = 1; i < FD_SETSIZE; ++i) {
-                if (client[i] < 0) {
+                if (client[i] < 0 && !orphans.has(i)) {
                     client[i] = connfd; /* salva descritor */
                     break;
                 }
@@ -86,6 +637,10 @@ int main (int argc, char **argv) {
                 exit(1);
             }
 
+            capture::recorder.connect(connfd);
+
+            ++connections;
+
             /* seta o bit connfd na variável allset */
             FD_SET(connfd, &allset);
 
@@ -98,110 +653,408 @@ int main (int argc, char **argv) {
             /* pega informações do socket do cliente */
             char *user_data = sock::sock_ntop((struct sockaddr *) &clientaddr.addr, sizeof(clientaddr.addr));
 
-            printf("Client: %s\n", user_data);
+            LOG_INFO("Client: %s", user_data);
+
+            roster.add(mesh.playerId(i), user_data);
+
+            /* ficha que o cliente apresenta para retomar este id depois de uma queda do servidor */
+            roster.at(mesh.playerId(i)).session = newSession();
+
+            sock::writeSessionMsg(connfd, sock::SessionMsg, mesh.playerId(i), roster.at(mesh.playerId(i)).session);
+
+            followers.touch(mesh.playerId(i));
 
-            scores[i] = 0;
-            clients[i] = std::string(user_data);
+            limits[i].reset(requestRule, messageRules, sizeof(messageRules) / sizeof(messageRules[0]));
 
-            if (--nready <= 0) continue;    /* não há mais descritores prontos para leitura. continua para a próxima iteração do loop. */
+            presenceDirty = true;
+
+            --nready;    /* o laço abaixo só percorre os clientes caso ainda haja descritores prontos para leitura */
+        }
+
+        if (controlfd >= 0 && FD_ISSET(controlfd, &rset)) { /* um novo processo quer assumir o lobby */
+            int conn = accept(controlfd, NULL, NULL);
+
+            /* a troca é feita no fim da iteração, sem trabalho pendente */
+            if (conn >= 0 && successor < 0) {
+                successor = conn;
+                successorDeadline = sock::nowMs() + HANDOFF_QUIESCE_MS;
+            } else if (conn >= 0) {
+                sock::Close(conn);
+            }
+
+            --nready;
+        }
+
+        if (replicas.enabled() && FD_ISSET(replicas.listenfd, &rset)) { /* um processo reserva se conectou */
+            replicas.accept();
+
+            --nready;
         }
 
         /* itera sobre todos os descritores abertos (igual ao numero total de clientes ativos)
             e busca o descritor do cliente que possui algum conteúdo a ser lido */
-        for (int idCli = 1; idCli <= maxi; ++idCli) {
+        for (int slot = 1; slot <= maxi && nready > 0; ++slot) {
             int n, sockfdcli;
+            int idCli = mesh.playerId(slot);
 
             /* verifica se o descritor i está ativo */
-            if ((sockfdcli = client[idCli]) < 0) continue;
+            if ((sockfdcli = client[slot]) < 0) continue;
 
             /* se estiver ativo, verifica se possui algum conteúdo pronto para ser lido */
             if (FD_ISSET(sockfdcli, &rset)) {
                 sock::MessageStatus msgStatus;
 
+                /* os eventos de trace a seguir (leitura, tratamento, escritas) formam uma requisição */
+                TRACE_REQUEST(sockfdcli);
+
+                enterScope(alloc::ScopeWait);
+
                 /* Lê o conteúdo do sockfd */
                 if ((n = sock::Read(sockfdcli, (char *) &msgStatus, sizeof(sock::MessageStatus))) == 0) {
                     /* caso nenhum caracter seja lido, então o cliente fechou a conexão (FIN enviado). então o servidor
                     também fecha a conexão (envia FIN). */
                     
+                    enterScope(alloc::ScopeAccept);
+
+                    capture::recorder.disconnect(sockfdcli);
+
+                    sock::Close(sockfdcli);
+
                     FD_CLR(sockfdcli, &allset); /* limpa os bits de allset */
 
-                    scores.erase(idCli);
-                    clients.erase(idCli);
-                    playing.erase(idCli);
+                    roster.remove(idCli);
+
+                    client[slot] = -1; /* informa que o cliente i não está mais ativo */
+
+                    --connections;
+
+                    followers.drop(slot);
+                    followers.leave(idCli, client);
+
+                    arena.end(slot);
+
+                    load.drop(slot);
+
+                    reservations.drop(slot);
+
+                    pendingList[slot] = false;
+                    deferred.erase(slot);
 
-                    client[idCli] = -1; /* informa que o cliente i não está mais ativo */                    
+                    presenceDirty = true;
                 } else {
-                    int idPeer;
+                    int idPeer = -1, slotPeer, room;
+                    long long session = 0;
+                    int resumeTo = -1;
+                    long long now = sock::nowMs();
+
+                    TRACE_SPAN(StageHandle, sockfdcli);
+
+                    enterScope(msgStatus);
+
+                    /* verifica o limite do tipo de mensagem; o conteúdo da mensagem é consumido mesmo assim.
+                       UpdateList gasta a ficha só no envio adiado, no fim da iteração */
+                    bool allowed = msgStatus == sock::UpdateList || limits[slot].allow(msgStatus, now);
 
                     switch (msgStatus) {
                         case sock::NewGameMsg:
-                            sock::Read(sockfdcli, (char *) &idPeer, sizeof(idPeer));
-
-                            // verify if peer exists and is available (is not playing already)
-                            if (client[idPeer] > 0 && playing.find(idPeer) == playing.end() && playing.find(idCli) == playing.end()) {
-                                sock::writeNewGameMsg(client[idPeer], idCli);
-                            } else { // the peer is already playing or does not exist
-                                // send message to client denying game
-                                sock::writeDenyMsg(sockfdcli);
-                            }
+                            handlers::newGame(game, slot, allowed);
 
                             break;
+
                         case sock::AcceptMsg:
-                            sock::Read(sockfdcli, (char *) &idPeer, sizeof(idPeer));
+                            handlers::accept(game, slot, now);
+
+                            break;
+
+                        case sock::DenyMsg:
+                            handlers::deny(game, slot);
+
+                            break;
+                        
+                        case sock::UpdateList:
+                            handlers::requestList(game, slot);
 
-                            // verify if both exists
-                            if (client[idPeer] >= 0) {
-                                // verify if both are available (are not playing)
-                                if (playing.find(idCli) == playing.end() && playing.find(idPeer) == playing.end()) {
-                                    auto itCli = clients.find(idCli);
-                                    auto itPeer = clients.find(idPeer);
+                            break;
 
-                                    // put both into playing list
-                                    playing.insert(idCli);
-                                    playing.insert(idPeer);
+                        case sock::FinishGame:
+                            handlers::finishGame(game, slot);
 
-                                    int rand1 = rand() % 2;
-                                    int rand2 = (rand1 == 0) ? 1 : 0;
+                            break;
 
-                                    // send message (with address of peer) to client to start game
-                                    sock::writeAcceptMsg(sockfdcli, itPeer->second, rand1);
+                        case sock::SubscribeMsg:
+                        case sock::UnsubscribeMsg:
+                            n = sock::readSubscribeMsg(sockfdcli, followIds);
 
-                                    // send message (with address of client) to peer to start game
-                                    sock::writeAcceptMsg(client[idPeer], itCli->second, rand2);
+                            if (!allowed) n = 0;
+
+                            for (int k = 0; k < n; ++k) {
+                                if (msgStatus == sock::SubscribeMsg) {
+                                    if (roster.sameRoom(idCli, followIds[k])) followers.subscribe(slot, followIds[k]);
                                 }
+                                else followers.unsubscribe(slot, followIds[k]);
                             }
-                            
+
                             break;
-                        case sock::DenyMsg:
-                            sock::Read(sockfdcli, (char *) &idPeer, sizeof(idPeer));
 
-                            // send message to peer to deny game
-                            sock::writeDenyMsg(client[idPeer]);
+                        case sock::BroadcastMsg:
+                            n = sock::readBroadcastMsg(sockfdcli, recvline);
+
+                            // announcements over the sender's budget are silently dropped
+                            if (n >= 0 && allowed && announcements[roster.at(idCli).room].add(idCli, recvline, n)) {
+                                if (mesh.enabled()) mesh.sendBroadcast(idCli, recvline, n, roster.roomName(idCli));
+                            }
 
                             break;
-                        
-                        case sock::UpdateList:
-                            sock::writeListOfClients(sockfdcli, idCli, clients, playing, scores);
+
+                        case sock::RoomMsg:
+                            n = sock::readRoomMsg(sockfdcli, roomName);
+
+                            if (n >= 0 && allowed && !roster.isPlaying(idCli) && (room = roster.findRoom(roomName, true)) >= 0 && room != roster.at(idCli).room) {
+                                roster.join(idCli, room);
+
+                                // subscriptions do not cross rooms: the player's own are dropped, and its followers (all in the old room) see it leave
+                                followers.drop(slot);
+                                followers.leave(idCli, client);
+
+                                presenceDirty = true;
+                            }
+
+                            // the reply carries the current room (the old one if the change was refused), followed by its list
+                            sock::writeRoomMsg(sockfdcli, roster.roomName(idCli));
+
+                            pendingList[slot] = true;
+
+                            deferred.insert(slot);
 
                             break;
 
-                        case sock::FinishGame:
-                            playing.erase(idCli);
+                        case sock::ResumeMsg:
+                            sock::readSessionMsg(sockfdcli, idPeer, session);
+
+                            slotPeer = mesh.slotOf(idPeer);
+
+                            // only a player restored from the checkpoint, with the same token, can be taken over
+                            if (allowed && slotPeer >= 0 && orphans.has(slotPeer) && roster.has(idPeer) && roster.at(idPeer).session == session) {
+                                resumeTo = slotPeer;
+                            }
 
-                            sock::Read(sockfdcli, (char *) &score, sizeof(score));                            
+                            break;
 
-                            scores[idCli] += score;
+                        case sock::PingMsg:
+                            handlers::ping(game, slot, allowed);
 
                             break;
+
+                        case sock::PresenceMsg:
+                        case sock::SessionMsg:
+                            break;
+                    }
+
+                    /* estourou o orçamento total: para de ler desta conexão até as fichas voltarem */
+                    if (!limits[slot].total.take(now)) {
+                        limits[slot].throttled = true;
+
+                        FD_CLR(sockfdcli, &allset);
+
+                        deferred.insert(slot);
+                    }
+
+                    /* a conexão passa para o slot restaurado (e o id antigo); o slot temporário é liberado */
+                    if (resumeTo >= 0) {
+                        int idOld = mesh.playerId(resumeTo);
+
+                        client[resumeTo] = sockfdcli;
+                        client[slot] = -1;
+
+                        limits[resumeTo] = limits[slot];
+                        pendingList[resumeTo] = pendingList[slot];
+                        pendingList[slot] = false;
+
+                        if (deferred.has(slot)) {
+                            deferred.erase(slot);
+                            deferred.insert(resumeTo);
+                        }
+
+                        orphans.erase(resumeTo);
+
+                        roster.remove(idCli);
+
+                        load.drop(slot);
+
+                        followers.drop(slot);
+                        followers.leave(idCli, client);
+                        followers.touch(idOld);
+
+                        /* caso o slot novo venha depois no laço, o descritor não pode ser lido de novo */
+                        FD_CLR(sockfdcli, &rset);
+
+                        if (resumeTo > maxi) maxi = resumeTo;
+
+                        sock::writeSessionMsg(sockfdcli, sock::SessionMsg, idOld, roster.at(idOld).session);
+
+                        presenceDirty = true;
+
+                        LOG_INFO("jogador %d retomou a sessão", idOld);
                     }
                 }
 
+                TRACE_REQUEST_END();
+
                 if (--nready <= 0) break;   /* não há mais descritores prontos para leitura. para loop então */
             }
         }
 
-        fflush(stdout);
+        /* do fim do tratamento das requisições até o fim da iteração */
+        TRACE_SPAN(StageFlush, -1);
+
+        enterScope(alloc::ScopeFlush);
+
+        /* a partir do estágio Coalesce, listas, presença e resumo saem só a cada OVERLOAD_COALESCE_MS */
+        bool flush = load.flushDue(sock::nowMs());
+
+        /* os pontos guardados entram no placar quando a carga baixa */
+        load.releaseScores([&](int slot, int points) {
+            roster.addScore(mesh.playerId(slot), points);
+
+            followers.touch(mesh.playerId(slot));
+
+            presenceDirty = true;
+        });
+
+        if (mesh.enabled()) {
+            long long now = sock::nowMs();
+
+            /* o AcceptAck (ou Abort) se perdeu: o cliente volta a ficar disponível e desiste da partida */
+            reservations.expire(now, [&](int slot, int idPeer) {
+                int id = mesh.playerId(slot);
+
+                roster.setPlaying(id, false);
+
+                followers.touch(id);
+
+                sock::writeDenyMsg(client[slot]);
+
+                mesh.sendInvite(shard::Deny, id, idPeer);
+
+                presenceDirty = true;
+            });
+
+            /* envia o resumo de presença quando algo mudou ou periodicamente (o que também serve de heartbeat) */
+            if ((presenceDirty && flush) || now - lastGossip >= GOSSIP_INTERVAL_MS) {
+                mesh.gossip(roster);
+                mesh.expire(roster);
+
+                followers.touchAll();
+
+                presenceDirty = false;
+                lastGossip = now;
+            }
+        }
+
+        /* os jogadores restaurados que não voltaram a tempo saem do lobby */
+        if (!orphans.empty() && sock::nowMs() >= orphansDeadline) {
+            for (int k = 0; k < orphans.size; ++k) {
+                int id = mesh.playerId(orphans[k]);
+
+                roster.remove(id);
+
+                followers.leave(id, client);
+            }
+
+            LOG_INFO("%d jogadores restaurados não retomaram a sessão", orphans.size);
+
+            orphans.clear();
+
+            presenceDirty = true;
+        }
+
+        /* responde as listas pendentes e volta a escutar conexões que recuperaram fichas */
+        if (!deferred.empty()) {
+            long long now = sock::nowMs();
+
+            /* de trás para frente: a remoção move o último elemento para a posição removida */
+            for (int k = deferred.size - 1; k >= 0; --k) {
+                int slot = deferred[k];
+
+                if (flush && pendingList[slot] && limits[slot].byType[sock::UpdateList].take(now)) handlers::sendList(game, slot);
+
+                if (limits[slot].throttled && limits[slot].total.ready(now)) {
+                    limits[slot].throttled = false;
+
+                    FD_SET(client[slot], &allset);
+                }
+
+                if (!pendingList[slot] && !limits[slot].throttled) deferred.erase(slot);
+            }
+        }
+
+        /* mede o RTT das conexões (kernel e PingMsg) */
+        if (rtts.due(sock::nowMs())) rtts.sample(client, maxi, mesh, roster, sock::nowMs());
+
+        /* avisa os seguidores dos jogadores que mudaram nesta iteração (ou desde o último envio agrupado) */
+        if (flush) followers.publish(client, roster, [&mesh](int slot) { return mesh.playerId(slot); });
+
+        /* envia de uma só vez todos os anúncios recebidos nesta iteração */
+        for (int r = 0; r < MAX_ROOMS; ++r) {
+            if (!announcements[r].empty()) announcements[r].fanOut(client, roster.rooms[r].members, mesh);
+        }
+
+        /* envia ao reserva, sem esperar por ele, os jogadores locais que mudaram nesta iteração */
+        replicas.queue(roster);
+        replicas.flush();
+
+        /* registra no checkpoint os jogadores locais que mudaram nesta iteração */
+        if (store.enabled()) store.journal(roster, sock::nowMs());
+        else roster.changed.clear();
+
+        capture::recorder.flush(sock::nowMs());
+
+        load.update(sock::nowUs() - busyStart, ready + deferred.size, sock::nowMs());
+
+        if (reportRequested) {
+            alloc::report(stderr);
+            latency::report(stderr, roster, mesh);
+            workers.report(stderr);
+            load.report(stderr, sock::nowMs());
+            IOSTAT_REPORT(STDERR_FILENO);
+
+            reportRequested = 0;
+        }
+
+        /* a troca não leva partidas contra o bot, convites reservados nem jogadores restaurados: espera que acabem, ou a recusa */
+        if (successor >= 0 && (!arena.active.empty() || !reservations.empty() || !orphans.empty())) {
+            if (sock::nowMs() >= successorDeadline) {
+                LOG_WARN("handoff: recusado (%d partidas contra o bot, %d convites, %d sessões a retomar)", arena.active.size, reservations.slots.size, orphans.size);
+
+                sock::Close(successor);
+                successor = -1;
+            }
+        } else if (successor >= 0) {
+            /* entrega os sockets e o estado ao novo processo; caso ele falhe, continua servindo. Ele não conhece os pontos guardados */
+            load.releaseScores([&](int slot, int points) { roster.addScore(mesh.playerId(slot), points); }, true);
+
+            handedOff = handoff::transfer(successor, listenfd, controlfd, replicas.listenfd, mesh, client, maxi, roster, followers, pendingList);
+
+            sock::Close(successor);
+            successor = -1;
+
+            if (handedOff) break;
+
+            LOG_WARN("handoff: o novo processo não confirmou; continuando");
+        }
     }
+
+    /* depois da troca o arquivo do socket de controle pertence ao novo processo */
+    if (handedOff) LOG_INFO("handoff: lobby entregue ao novo processo");
+    else if (handoffPath != NULL) unlink(handoffPath);
+
+    capture::recorder.close();
+
+    workers.stop();
+
+    alloc::report(stderr);
+
+    logger::stop();
    
     return(0);
 }
\ No newline at end of file
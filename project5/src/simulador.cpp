@@ -0,0 +1,357 @@
+#include <socket.h>
+#include <lobby.h>
+#include <loopback.h>
+#include <alloc.h>
+#include <handlers.h>
+
+#include <map>
+#include <set>
+#include <memory>
+#include <vector>
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+
+/*
+    Simulação do protocolo do lobby num único processo (ver include/loopback.h).
+
+    <Clientes> clientes simulados e o lado servidor trocam, a cada rodada,
+    as mensagens do uso normal: PingMsg (ida e volta), convites (NewGameMsg,
+    AcceptMsg de resposta e AcceptMsg com o endereço do adversário para os
+    dois), FinishGame e UpdateList (pedido e lista da sala; os pares de
+    clientes ficam juntos, distribuídos entre as MAX_ROOMS salas). O lado
+    servidor trata as mensagens com os mesmos tratadores do bin/servidor.o
+    (include/handlers.h), só sem o select; os clientes usam as mesmas funções
+    de leitura do cliente. Como num servidor com shards, cada
+    SIM_SHARD_CLIENTS clientes têm o seu lobby (Roster, presença, ...) e os
+    seus slots, o que mantém as listas do tamanho das de um shard qualquer
+    que seja o número de clientes.
+
+    Os dois lados rodam em threads próprias, e cada conexão é um par de
+    anéis em memória, sem syscalls nem limite de descritores; com "kernel"
+    as conexões são socketpairs, para comparar. O resultado é determinístico:
+    cada resposta é conferida (carimbos, ids, endereços, sorteio e o tamanho
+    de cada lista) e as diferenças são contadas como divergências.
+
+    Como no servidor, o lado servidor não deve alocar nada depois da
+    inicialização (ver include/alloc.h): as alocações dele são contadas e
+    qualquer uma é um erro; com LOBBY_STRICT_ALLOC=1 (make check-alloc) a
+    primeira aborta o programa indicando a fase. Os clientes, que guardam as
+    listas em std::map, ficam fora das contas.
+*/
+#define SIM_SHARD_CLIENTS (FD_SETSIZE - 2)  /* clientes por lobby, nos slots 1 a FD_SETSIZE - 2 (um número par): salas de 16 */
+
+enum Phase {
+    PhasePing,
+    PhaseInvite,
+    PhaseList,
+    NUM_PHASES
+};
+
+const char *phaseNames[NUM_PHASES] = {"ping", "convite", "lista"};
+
+/* o estado de um lobby, montado como no bin/servidor.o, e o handlers::Context sobre ele */
+class Shard {
+    public:
+        lobby::Roster roster;
+        shard::Mesh mesh;
+        presence::Index followers;
+        bot::Arena arena;
+        sched::Scheduler workers;
+        shard::Reservations reservations;
+        overload::Monitor load;
+        latency::Sampler rtts;
+        int client[FD_SETSIZE];
+        bool pendingList[FD_SETSIZE];
+        lobby::IndexSet deferred;
+        bool presenceDirty;
+        handlers::Context context;
+
+        Shard() : presenceDirty(false), context(roster, mesh, followers, arena, workers, reservations, load, rtts, client, pendingList, deferred, presenceDirty) {
+            roster.init(FD_SETSIZE);
+            followers.init(roster.capacity(), FD_SETSIZE);
+            arena.open();
+            reservations.init(FD_SETSIZE);
+            load.init(FD_SETSIZE, sock::nowMs());
+            deferred.init(FD_SETSIZE);
+
+            for (int i = 0; i < FD_SETSIZE; ++i) {
+                client[i] = -1;
+                pendingList[i] = false;
+            }
+        }
+};
+
+int numClients, rounds;
+std::vector<int> serverFds, clientFds;
+std::vector<std::unique_ptr<Shard> > shards;
+
+/* lobby do cliente `i`, o slot dele nesse lobby e o id que o lobby lhe dá */
+Shard &shardOf(int i) { return *shards[i / SIM_SHARD_CLIENTS]; }
+
+int slotOf(int i) { return i % SIM_SHARD_CLIENTS + 1; }
+
+int idOf(int i) { return shardOf(i).mesh.playerId(slotOf(i)); }
+
+/* endereço UDP (fictício) do cliente `i` */
+void addressOf(int i, char *out) {
+    snprintf(out, ADDR_LEN, "10.%d.%d.%d:%d", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff, 1024 + i % 50000);
+}
+
+/* lê o status da próxima mensagem e confere se é `expected` */
+bool expect(int fd, sock::MessageStatus expected) {
+    sock::MessageStatus msgStatus;
+
+    return sock::Read(fd, (char *) &msgStatus, sizeof(msgStatus)) == sizeof(msgStatus) && msgStatus == expected;
+}
+
+/* o lado servidor: os tratadores do bin/servidor.o, na ordem em que os clientes enviam */
+void serve() {
+    for (int round = 0; round < rounds; ++round) {
+        alloc::scope = sock::PingMsg;
+
+        for (auto &shard : shards) shard->rtts.sample(shard->client, SIM_SHARD_CLIENTS, shard->mesh, shard->roster, sock::nowMs());
+
+        for (int i = 0; i < numClients; ++i) {
+            if (expect(serverFds[i], sock::PingMsg)) handlers::ping(shardOf(i).context, slotOf(i), true);
+        }
+
+        /* os pares (0, 1), (2, 3), ...: o par convida o ímpar, que aceita */
+        alloc::scope = sock::NewGameMsg;
+
+        for (int i = 0; i + 1 < numClients; i += 2) {
+            if (expect(serverFds[i], sock::NewGameMsg)) handlers::newGame(shardOf(i).context, slotOf(i), true);
+        }
+
+        alloc::scope = sock::AcceptMsg;
+
+        for (int i = 1; i < numClients; i += 2) {
+            if (expect(serverFds[i], sock::AcceptMsg)) handlers::accept(shardOf(i).context, slotOf(i), sock::nowMs());
+        }
+
+        alloc::scope = sock::FinishGame;
+
+        for (int i = 0; i < numClients - numClients % 2; ++i) {
+            if (expect(serverFds[i], sock::FinishGame)) handlers::finishGame(shardOf(i).context, slotOf(i));
+        }
+
+        alloc::scope = sock::UpdateList;
+
+        for (int i = 0; i < numClients; ++i) {
+            if (expect(serverFds[i], sock::UpdateList)) handlers::requestList(shardOf(i).context, slotOf(i));
+        }
+
+        /* as listas pedidas saem juntas, como no fim de uma iteração do servidor */
+        for (auto &shard : shards) {
+            for (int k = shard->deferred.size - 1; k >= 0; --k) {
+                int slot = shard->deferred[k];
+
+                if (shard->pendingList[slot]) handlers::sendList(shard->context, slot);
+
+                shard->deferred.erase(slot);
+            }
+        }
+    }
+}
+
+/* os clientes simulados; retorna o número de respostas divergentes e soma o tempo de cada fase */
+long long simulate(const std::vector<int> &listSizes, long long *phaseUs) {
+    std::map<int, std::string> clients;
+    std::set<int> playing;
+    std::map<int, int> scores, rtts;
+    long long divergent = 0;
+    int pairs = numClients - numClients % 2;
+
+    for (int round = 0; round < rounds; ++round) {
+        long long start = sock::nowUs();
+
+        /* o servidor envia a marca de tempo, e o cliente a devolve */
+        for (int i = 0; i < numClients; ++i) {
+            long long stamp = -1;
+
+            if (expect(clientFds[i], sock::PingMsg)) sock::readPingMsg(clientFds[i], stamp);
+
+            if (stamp <= 0) ++divergent;
+
+            sock::writePingMsg(clientFds[i], stamp);
+        }
+
+        phaseUs[PhasePing] += sock::nowUs() - start;
+        start = sock::nowUs();
+
+        for (int i = 0; i + 1 < numClients; i += 2) sock::writeNewGameMsg(clientFds[i], idOf(i + 1));
+
+        for (int i = 1; i < numClients; i += 2) {
+            int idCli = -1;
+
+            if (expect(clientFds[i], sock::NewGameMsg)) sock::readNewGameMsg(clientFds[i], idCli);
+
+            if (idCli != idOf(i - 1)) ++divergent;
+
+            sock::writeAcceptMsg2(clientFds[i], idOf(i - 1));
+        }
+
+        for (int i = 0; i < pairs; i += 2) {
+            schema::Endpoint peer[2];
+            int randNum[2] = {-1, -1};
+            char address[ADDR_LEN], expected[ADDR_LEN];
+
+            for (int k = 0; k < 2; ++k) {
+                if (expect(clientFds[i + k], sock::AcceptMsg)) sock::readAcceptMsg(clientFds[i + k], peer[k], randNum[k]);
+
+                sock::formatEndpoint(peer[k], address, sizeof(address));
+                addressOf(i + 1 - k, expected);
+
+                if (strcmp(address, expected) != 0) ++divergent;
+            }
+
+            if (randNum[0] + randNum[1] != 1) ++divergent;
+
+            /* o par sempre vence */
+            sock::send<sock::msg::Finish>(clientFds[i], 1);
+            sock::send<sock::msg::Finish>(clientFds[i + 1], 0);
+        }
+
+        phaseUs[PhaseInvite] += sock::nowUs() - start;
+        start = sock::nowUs();
+
+        for (int i = 0; i < numClients; ++i) sock::send<sock::msg::ListRequest>(clientFds[i]);
+
+        for (int i = 0; i < numClients; ++i) {
+            int myId = -1;
+
+            if (expect(clientFds[i], sock::UpdateList)) sock::readListOfClients(clientFds[i], clients, playing, scores, rtts, myId);
+
+            if (myId != idOf(i) || (int) clients.size() != listSizes[i] || !playing.empty()) ++divergent;
+
+            if (i < pairs && scores[idOf(i)] != ((i % 2 == 0) ? round + 1 : 0)) ++divergent;
+        }
+
+        phaseUs[PhaseList] += sock::nowUs() - start;
+    }
+
+    return divergent;
+}
+
+int main(int argc, char **argv) {
+    /*
+       Verificamos se o usuário passou o número correto de parâmetros
+    */
+    if (argc < 2) {
+        char   error[200];
+
+        strcpy(error,"uso: ");
+        strcat(error,argv[0]);
+        strcat(error," <Clientes> [<Rodadas>] [kernel]");
+        perror(error);
+
+        exit(1);
+    }
+
+    numClients = atoi(argv[1]);
+    rounds = (argc > 2) ? atoi(argv[2]) : 10;
+
+    bool kernel = (argc > 3 && strcmp(argv[3], "kernel") == 0);
+
+    if (numClients < 1 || rounds < 1) {
+        perror("clientes e rodadas devem ser positivos");
+        exit(1);
+    }
+
+    serverFds.assign(numClients, -1);
+    clientFds.assign(numClients, -1);
+
+    if (kernel) {
+        for (int i = 0; i < numClients; ++i) {
+            int fds[2];
+
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+                perror("socketpair error (limite de descritores?)");
+                exit(1);
+            }
+
+            serverFds[i] = fds[0];
+            clientFds[i] = fds[1];
+        }
+    } else {
+        loopback::network.init(numClients);
+        loopback::enable();
+
+        for (int i = 0; i < numClients; ++i) {
+            int fds[2] = {-1, -1};
+
+            loopback::network.pair(fds);
+
+            serverFds[i] = fds[0];
+            clientFds[i] = fds[1];
+        }
+    }
+
+    /* os pares de clientes dividem uma sala do seu lobby: o slot s fica na sala (s - 1) / 2 % MAX_ROOMS (a 0 é o lobby principal) */
+    std::vector<int> roomSizes(((numClients - 1) / SIM_SHARD_CLIENTS + 1) * MAX_ROOMS, 0), listSizes(numClients, 0);
+
+    for (int k = 0; k < (numClients - 1) / SIM_SHARD_CLIENTS + 1; ++k) shards.push_back(std::unique_ptr<Shard>(new Shard()));
+
+    for (int i = 0; i < numClients; ++i) {
+        Shard &shard = shardOf(i);
+        char address[ADDR_LEN], name[ROOM_NAME_LEN];
+        int id = idOf(i), room = (slotOf(i) - 1) / 2 % MAX_ROOMS;
+
+        shard.client[slotOf(i)] = serverFds[i];
+
+        addressOf(i, address);
+        shard.roster.add(id, address);
+
+        snprintf(name, sizeof(name), "sala%d", room);
+        shard.roster.join(id, shard.roster.findRoom((room == 0) ? "" : name, true));
+
+        ++roomSizes[i / SIM_SHARD_CLIENTS * MAX_ROOMS + room];
+    }
+
+    for (int i = 0; i < numClients; ++i) listSizes[i] = roomSizes[i / SIM_SHARD_CLIENTS * MAX_ROOMS + (slotOf(i) - 1) / 2 % MAX_ROOMS];
+
+    srand(1);
+
+    alloc::strict = (getenv("LOBBY_STRICT_ALLOC") != NULL && atoi(getenv("LOBBY_STRICT_ALLOC")) != 0);
+
+    long long phaseUs[NUM_PHASES] = {0, 0, 0};
+    long long start = sock::nowUs();
+
+    /* daqui em diante só o lado servidor é contado: esta thread passa a ser a dos clientes */
+    alloc::exemptThread();
+    alloc::steady = true;
+
+    std::thread server(serve);
+
+    long long divergent = simulate(listSizes, phaseUs);
+
+    server.join();
+
+    long long elapsed = sock::nowUs() - start;
+
+    int pairs = numClients / 2;
+    long long messages[NUM_PHASES] = {
+        2LL * numClients * rounds,
+        (long long) pairs * 7 * rounds,     // NewGameMsg x2, AcceptMsg x3, FinishGame x2
+        2LL * numClients * rounds           // UpdateList e a lista
+    };
+
+    printf("simulação: %d clientes (%s), %d rodadas, %.1f s\n", numClients, kernel ? "socketpair" : "memória", rounds, elapsed / 1e6);
+    printf("  %-10s %14s %12s %14s\n", "fase", "mensagens", "tempo (ms)", "mensagens/s");
+
+    for (int p = 0; p < NUM_PHASES; ++p) {
+        printf("  %-10s %14lld %12.1f %14.0f\n", phaseNames[p], messages[p], phaseUs[p] / 1e3, (phaseUs[p] > 0) ? messages[p] * 1e6 / phaseUs[p] : 0.0);
+    }
+
+    printf("  divergências: %lld\n", divergent);
+    printf("  alocações do servidor depois da inicialização: %lld\n", alloc::steadyCount());
+
+    if (alloc::steadyCount() > 0) alloc::report(stderr);
+
+    for (int i = 0; i < numClients; ++i) {
+        sock::Close(serverFds[i]);
+        sock::Close(clientFds[i]);
+    }
+
+    return (divergent == 0 && alloc::steadyCount() == 0) ? 0 : 1;
+}